@@ -14,6 +14,8 @@
 //
 //	programmer: ALLAN CRUSE
 //	written on: 28 JUL 2008
+//	revised on: 17 OCT 2026 -- walk the map with one VMM_BATCH call
+//	revised on: 17 OCT 2026 -- return by 'vmcall' (CPUID now resumes)
 //-------------------------------------------------------------------
 
 #include <stdio.h>		// for printf(), perror() 
@@ -25,6 +27,7 @@
 #include "myvmx.h"		// for 'regs_ia32'
 
 #define  TOS	0x0000FFE0	// stackbase address
+#define  MAXDESC	64	// most descriptors we can fetch
 
 typedef struct	{
 		unsigned long long	base_address;
@@ -32,7 +35,8 @@ typedef struct	{
 		unsigned int		memory_type;
 		} DESCRIPTOR;
 
-regs_ia32	vm;
+regs_ia32	vm, results[ MAXDESC ];
+batch_ia32	batch;
 struct utsname 	uts;
 DESCRIPTOR	*desc = (DESCRIPTOR*)(TOS + 8);
 
@@ -44,10 +48,10 @@ const char *leg[] = {   "                    ",
 			"AddressRangeUnusable",		// Type 5
 			"AddressRangeNotKnown"	};	// Type 6
 
-int int86( int fd, int id, regs_ia32 &vm )
+void plant_int86( int id, regs_ia32 &vm )
 {
 	unsigned int	*eoi = (unsigned int*)TOS;	
-	eoi[0] = 0x9090A20F;	// CPUID-instruction, NOP, NOP
+	eoi[0] = 0x90C1010F;	// 'vmcall' instruction, NOP
 
 	unsigned short	*tos = (unsigned short*)TOS;
 	tos[-1] = (1<<9);	// IF-bit (in EFLAGS)
@@ -59,8 +63,6 @@ int int86( int fd, int id, regs_ia32 &vm )
 	vm.cs  = *(unsigned short*)( id*4 + 2);
 	vm.esp = TOS - 6;
 	vm.ss  = 0x0000;
-
-	return	ioctl( fd, sizeof( regs_ia32 ), &vm );	
 }
 
 
@@ -83,24 +85,35 @@ int main( int argc, char **argv )
 	printf( "         " );
 	printf( "  BaseAddress       RangeLength       RangeType \n" );
 
-	vm.ebx = 0;
-	do	{
-		vm.eax = 0x0000E820;		// service-ID
-		vm.edx = *(int*)("PAMS");	// 'SMAP' 
-		vm.ecx = sizeof( DESCRIPTOR );	// buffer-length
-		vm.edi = (TOS+8) & 0xF;		// offset-address
-		vm.es = ((TOS+8) >> 4);		// segment-address	
-
-		int	retval = int86( fd, 0x15, vm );
-		if ( retval < 0 ) { perror( "ioctl" ); exit(1); }
-
+	// one request, repeated by the driver until EBX returns zero
+	vm.eax = 0x0000E820;		// service-ID
+	vm.ebx = 0;			// continuation-value
+	vm.edx = *(int*)("PAMS");	// 'SMAP' 
+	vm.ecx = sizeof( DESCRIPTOR );	// buffer-length
+	vm.edi = (TOS+8) & 0xF;		// offset-address
+	vm.es = ((TOS+8) >> 4);		// segment-address	
+	plant_int86( 0x15, vm );
+	results[0] = vm;
+
+	batch.regs = results;
+	batch.count = MAXDESC;
+	batch.flags = VMM_CHAIN_EBX | VMM_CHAIN_CF;
+	batch.edi_step = sizeof( DESCRIPTOR );
+	batch.keep_base = TOS - 6;	// our return-frame and
+	batch.keep_size = 6 + 4;	//  our 'vmcall' instruction
+
+	int	retval = ioctl( fd, VMM_BATCH, &batch );
+	if ( retval < 0 ) { perror( "ioctl" ); exit(1); }
+
+	for (unsigned int i = 0; i < batch.done; i++)
+		{
+		if ( results[i].eflags & 1 ) break;	// CF=1 means 'done'
 		printf( "\n " );
 		printf( "         " );
-		printf( " %016llX ", desc->base_address );
-		printf( " %016llX ", desc->region_length );
-		printf( " %s ", leg[ desc->memory_type & 7 ] );
+		printf( " %016llX ", desc[i].base_address );
+		printf( " %016llX ", desc[i].region_length );
+		printf( " %s ", leg[ desc[i].memory_type & 7 ] );
 		}
-	while ( vm.ebx );
 	printf( "\n\n" );
 
 	uname( &uts );
@@ -0,0 +1,72 @@
+//-------------------------------------------------------------------
+//	hypercall.cpp
+//
+//	This application runs a small guest which uses the hypercalls
+//	of our 'newvmm64.c' Linux Kernel Module (see VMM_HC_xxx): it
+//	writes a message to the kernel log (see it with 'dmesg'), then
+//	reads the time-stamp counter, and finally makes VMM_HC_DONE,
+//	the only hypercall which returns to us.
+//
+//		usage:  $ ./hypercall
+//
+//	written on: 17 OCT 2026
+//-------------------------------------------------------------------
+
+#include <stdio.h>		// for printf(), perror()
+#include <fcntl.h>		// for open()
+#include <stdlib.h>		// for exit()
+#include <string.h>		// for strcpy(), memcpy()
+#include <sys/mman.h>		// for mmap()
+#include <sys/ioctl.h>		// for ioctl()
+#include "myvmx.h"		// for VMM_HC()
+
+regs_ia32	vm;
+char		message[] = "hello from the guest";
+
+// the bytes of VMM_HC( function ), as an instruction's immediate
+#define HC( function )	function, 0x00, VMM_HC_SIGNATURE & 0xFF, VMM_HC_SIGNATURE >> 8
+
+unsigned char	code[] = {
+	0x66, 0xB8, HC( VMM_HC_PRINT ),	// mov eax, VMM_HC( VMM_HC_PRINT )
+	0xBE, 0x00, 0x81,		// mov si, 0x8100
+	0x66, 0xB9, 0, 0, 0, 0,		// mov ecx, length (filled in below)
+	0x0F, 0x01, 0xC1,		// vmcall
+	0x66, 0xB8, HC( VMM_HC_TIME ),	// mov eax, VMM_HC( VMM_HC_TIME )
+	0x0F, 0x01, 0xC1,		// vmcall
+	0x66, 0x89, 0xC3,		// mov ebx, eax
+	0x66, 0x89, 0xD6,		// mov esi, edx
+	0x66, 0xB8, HC( VMM_HC_DONE ),	// mov eax, VMM_HC( VMM_HC_DONE )
+	0x0F, 0x01, 0xC1,		// vmcall
+	};
+
+int main( int argc, char **argv )
+{
+	int	fd = open( "/dev/vmm", O_RDWR );
+	if ( fd < 0 ) { perror( "/dev/vmm" ); exit(1); }
+
+	int	size = 0x110000;
+	int	prot = PROT_READ | PROT_WRITE | PROT_EXEC;
+	int	flag = MAP_FIXED | MAP_SHARED;
+	if ( mmap( NULL, size, prot, flag, fd, 0 ) == MAP_FAILED )
+		{ perror( "mmap" ); exit(1); }
+
+	// our message goes at 0000:8100
+	strcpy( (char*)0x8100, message );
+
+	// our code goes at 0000:8000
+	*(unsigned int*)( code + 11 ) = strlen( message );
+	memcpy( (void*)0x8000, code, sizeof( code ) );
+
+	vm.eflags = 0x23002;	// VM=1, IOPL=3
+	vm.eip = 0x8000;
+	vm.esp = 0x7FF0;
+
+	int	retval = ioctl( fd, sizeof( vm ), &vm );
+	if ( retval < 0 ) { perror( "ioctl" ); exit(1); }
+
+	printf( "\n guest finished at %04X:%04X (retval=%d) \n",
+						vm.cs, vm.eip, retval );
+	printf( "\n\t time-stamp counter: %08X%08X ", vm.esi, vm.ebx );
+	printf( "\n\t counter rate: %u kHz ", vm.ecx );
+	printf( "\n\t carry-flag: %d \n\n", vm.eflags & 1 );
+}
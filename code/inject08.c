@@ -18,6 +18,7 @@
 //	revised on: 08 MAY 2007 -- injects interrupt-8 into guest VM
 //	revised on: 03 JUL 2007 -- fixed argument-address in 'isrGPF' 
 //	revised on: 21 JUL 2008 -- for Linux kernel version 2.6.26.
+//	revised on: 17 OCT 2026 -- no printk of the constant entry-fields
 //-------------------------------------------------------------------
 
 #include <linux/module.h>	// for init_module() 
@@ -28,6 +29,7 @@
 #include <asm/uaccess.h>	// for copy_from_user()
 #include "machine.h"		// for our VMCS fields
 #include "myvmx.h"		// for 'regs_ia32'
+#include "vmtrace.h"		// for our exit trace-rings
 
 #define N_ARENAS	11	// number of 64KB memory allocations
 #define ARENA_LENGTH  (64<<10)	// size of each allocated memory-arena
@@ -78,6 +80,9 @@ int my_mmap( struct file *file, struct vm_area_struct *vma )
 	unsigned long	physical_addr, pfn;
 	int		i;
 
+	// a nonzero file-offset asks to map one cpu's trace-ring
+	if ( vma->vm_pgoff ) return vmtrace_mmap( vma );
+
 	// we require prescribed parameter-values from our client
 	if ( user_virtaddr != 0x00000000L ) return -EINVAL;
 	if ( region_length != LEGACY_REACH ) return -EINVAL;
@@ -221,6 +226,13 @@ int init_module( void )
 		else	memset( kmem[ i ], 0x00, ARENA_LENGTH );
 		}
 
+	// allocate the trace-ring for each cpu
+	if ( vmtrace_alloc() )
+		{
+		for (i = 0; i < N_ARENAS; i++) kfree( kmem[ i ] );
+		return	-ENOMEM;
+		}
+
 	// assign usages to allocated kernel memory areas
 	vmxon_region = virt_to_phys( kmem[ 10 ] + 0x0000 );
 	guest_region = virt_to_phys( kmem[ 10 ] + 0x1000 );
@@ -252,6 +264,7 @@ void cleanup_module( void )
 	unregister_chrdev( my_major, modname );
 	remove_proc_entry( modname, NULL );
 	for (i = 0; i < N_ARENAS; i++) kfree( kmem[ i ] );
+	vmtrace_free();
 
 	printk( "<1>Removing \'%s\' module\n", modname );
 }
@@ -274,6 +287,9 @@ int my_ioctl( struct inode *inode, struct file *file,
 	signed long	desc = 0;
 	int		i, j;
 
+	// a request to empty (and set the mode of) our trace-rings
+	if ( count == VMM_TRACE ) return vmtrace_control( buf );
+
 	// sanity check: we require the client-process to pass an
 	// exact amount of data representing CPU's register-state
 	if ( count != sizeof( regs_ia32 ) ) return -EINVAL;
@@ -482,14 +498,6 @@ int my_ioctl( struct inode *inode, struct file *file,
 	// setup 'injection' of interrupt-8 into the guest VM
 	control_VM_entry_interruption_information = 0x80000008;
 
-printk( "\n" );
-printk( " VMentry-interruption-information: %08X \n", 
-			control_VM_entry_interruption_information );
-printk( " VMentry-exception-error-code:     %08X \n", 
-			control_VM_entry_exception_errorcode );
-printk( " VMentry-instruction-length:       %08X \n", 
-			control_VM_entry_instruction_length  );
-
 	//---------------------
 	// launch the guest VM 
 	//---------------------
@@ -569,19 +577,10 @@ printk( " VMentry-instruction-length:       %08X \n",
 		" popfq					\n"\
 		);
 
-// show why the VMentry failed, or else why the VMexit occurred	
-printk( "\n VM-instruction error: %08X ", info_vminstr_error );
-printk( " Exit Reason: %08X \n", info_vmexit_reason );
-printk( " VMexit-interruption-information: %08X \n",
-			info_vmexit_interrupt_information );
-printk( " VMexit-interruption-error-code:  %08X \n",
-			info_vmexit_interrupt_error_code  );
-printk( " VMexit-instruction-length:       %08X \n",
-			info_vmexit_instruction_length    );
-printk( " IDT-vectoring-information: %08X \n",
-			info_IDT_vectoring_information    );
-printk( " IDT-vectoring-error-code:  %08X \n",
-			info_IDT_vectoring_error_code     );
+	// record why the VMentry failed, or else why the VMexit occurred
+	vmtrace_exit( info_vmexit_reason, info_exit_qualification,
+			info_vmexit_interrupt_information, 
+			guest_CS_selector, guest_RIP, info_vminstr_error );
 
 	// copy the client's virtual-machine register-values
 	vm.eflags = (unsigned int)guest_RFLAGS;
@@ -15,6 +15,8 @@
 //	date begun: 29 APR 2007
 //	completion: 03 MAY 2007	-- just our initial driver-prototype
 //	revised on: 21 JUL 2008 -- for Linux kernel version 2.6.26.
+//	revised on: 17 OCT 2026 -- VMCS set up once, then changed fields only
+//	revised on: 17 OCT 2026 -- exit-reason is put in a trace-ring record
 //-------------------------------------------------------------------
 
 #include <linux/module.h>	// for init_module() 
@@ -25,6 +27,7 @@
 #include <asm/uaccess.h>	// for copy_from_user()
 #include "machine.h"		// for our VMCS fields
 #include "myvmx.h"		// for 'regs_ia32'
+#include "vmtrace.h"		// for our exit trace-rings
 
 #define N_ARENAS	11	// number of 64KB memory allocations
 #define ARENA_LENGTH  (64<<10)	// size of each allocated memory-arena
@@ -75,6 +78,9 @@ int my_mmap( struct file *file, struct vm_area_struct *vma )
 	unsigned long	physical_addr, pfn;
 	int		i;
 
+	// a nonzero file-offset asks to map one cpu's trace-ring
+	if ( vma->vm_pgoff ) return vmtrace_mmap( vma );
+
 	// we require prescribed parameter-values from our client
 	if ( user_virtaddr != 0x00000000L ) return -EINVAL;
 	if ( region_length != LEGACY_REACH ) return -EINVAL;
@@ -135,6 +141,12 @@ my_info( char *buf, char **start, off_t off, int count, int *eof, void *data )
 	len += sprintf( buf+len, "\n\t\t\t" );
 	len += sprintf( buf+len, "vmxon_region=%016lX \n", vmxon_region );
 	len += sprintf( buf+len, "\n" );
+
+	len += sprintf( buf+len, "\t%lu VMWRITEs before latest entry ",
+						vmcs_writes_latest );
+	len += sprintf( buf+len, "(%lu in %lu entries) \n", 
+					vmcs_writes_total, vmcs_entries );
+	len += sprintf( buf+len, "\n" );
 	
 	return	len;
 }
@@ -218,6 +230,13 @@ int init_module( void )
 		else	memset( kmem[ i ], 0x00, ARENA_LENGTH );
 		}
 
+	// allocate the trace-ring for each cpu
+	if ( vmtrace_alloc() )
+		{
+		for (i = 0; i < N_ARENAS; i++) kfree( kmem[ i ] );
+		return	-ENOMEM;
+		}
+
 	// assign usages to allocated kernel memory areas
 	vmxon_region = virt_to_phys( kmem[ 10 ] + 0x0000 );
 	guest_region = virt_to_phys( kmem[ 10 ] + 0x1000 );
@@ -249,6 +268,7 @@ void cleanup_module( void )
 	unregister_chrdev( my_major, modname );
 	remove_proc_entry( modname, NULL );
 	for (i = 0; i < N_ARENAS; i++) kfree( kmem[ i ] );
+	vmtrace_free();
 
 	printk( "<1>Removing \'%s\' module\n", modname );
 }
@@ -269,15 +289,22 @@ int my_ioctl( struct inode *inode, struct file *file,
 	signed long	desc = 0;
 	int		i, j;
 
+	// a request to empty (and set the mode of) our trace-rings
+	if ( count == VMM_TRACE ) return vmtrace_control( buf );
+
 	// sanity check: we require the client-process to pass an
 	// exact amount of data representing CPU's register-state
 	if ( count != sizeof( regs_ia32 ) ) return -EINVAL;
 
-	// reinitialize the Virtual Machine Control Stuctures
-	memset( phys_to_virt( vmxon_region ), 0x00, PAGE_SIZE );
-	memset( phys_to_virt( guest_region ), 0x00, PAGE_SIZE );
-	memcpy( phys_to_virt( vmxon_region ), msr0x480, 4 );
-	memcpy( phys_to_virt( guest_region ), msr0x480, 4 );
+	// initialize the Virtual Machine Control Stuctures just once
+	// (the VMCS keeps all the field-values that we wrote earlier)
+	if ( machine_stale & VMCS_STALE )
+		{
+		memset( phys_to_virt( vmxon_region ), 0x00, PAGE_SIZE );
+		memset( phys_to_virt( guest_region ), 0x00, PAGE_SIZE );
+		memcpy( phys_to_virt( vmxon_region ), msr0x480, 4 );
+		memcpy( phys_to_virt( guest_region ), msr0x480, 4 );
+		}
 
 	// initialize our guest-task's page-table and page-directory
 	pgtbl = (unsigned int*)phys_to_virt( pgtbl_region );
@@ -469,6 +496,9 @@ int my_ioctl( struct inode *inode, struct file *file,
 	control_CR3_target0 = guest_CR3;	// guest's directory
 	control_CR3_target1 = host_CR3;		// host's directory
 
+	// mark the VMCS fields whose values differ from our shadows
+	vmcs_scan();
+
 	//---------------------
 	// launch the guest VM 
 	//---------------------
@@ -494,12 +524,17 @@ int my_ioctl( struct inode *inode, struct file *file,
 		" vmptrld guest_region			\n"\
 		" movl	$3, retval			\n"\
 		"					\n"\
+		" xor	%rsi, %rsi			\n"\
 		" xor	%rdx, %rdx			\n"\
 		" mov	elements, %rcx			\n"\
 		"nxwr:					\n"\
+		" bt	%rsi, machine_dirty		\n"\
+		" jnc	skwr				\n"\
 		" mov	machine+0(%rdx), %rax		\n"\
 		" mov	machine+8(%rdx), %rbx		\n"\
 		" vmwrite (%rbx), %rax			\n"\
+		"skwr:					\n"\
+		" inc	%rsi				\n"\
 		" add	$16, %rdx			\n"\
 		" loop	nxwr				\n"\
 		"					\n"\
@@ -511,6 +546,7 @@ int my_ioctl( struct inode *inode, struct file *file,
 		" mov	_ebp, %ebp			\n"\
 		" mov	_esi, %esi			\n"\
 		" mov	_edi, %edi			\n"\
+		" incq	vmcs_entries			\n"\
 		"  vmlaunch				\n"\
 		" movl 	$5, retval			\n"\
 		" jmp	read				\n"\
@@ -535,6 +571,7 @@ int my_ioctl( struct inode *inode, struct file *file,
 		"					\n"\
 		" movl  $0, retval			\n"\
 		"over:					\n"\
+		" vmclear guest_region			\n"\
 		" vmxoff				\n"\
 		"fail:					\n"\
 		" pop	%r11				\n"\
@@ -548,13 +585,13 @@ int my_ioctl( struct inode *inode, struct file *file,
 		" popfq					\n"\
 		);
 
-// show why the VMentry failed, or else why the VMexit occurred	
-printk( "\n VM-instruction error: %08X ", info_vminstr_error );
-printk( " Exit Reason: %08X \n", info_vmexit_reason );
-printk( " VMexit-interruption-information: %08X \n",
-			info_vmexit_interrupt_information );
-printk( " VMexit-interruption-error-code:  %08X \n",
-			info_vmexit_interrupt_error_code  );
+	// our shadows are unreliable if the VMCS wasn't fully written
+	if ( ( retval )||( info_vminstr_error ) ) machine_stale = VMCS_STALE;
+
+	// record why the VMentry failed, or else why the VMexit occurred
+	vmtrace_exit( info_vmexit_reason, info_exit_qualification,
+			info_vmexit_interrupt_information, 
+			guest_CS_selector, guest_RIP, info_vminstr_error );
 
 	// copy the client's virtual-machine register-values
 	vm.eflags = (unsigned int)guest_RFLAGS;
@@ -12,12 +12,30 @@
 //	programmer: ALLAN CRUSE
 //	written on: 26 JUL 2006
 //	revised on: 29 APR 2007 -- altered our VMCS_DEF structure
+//	revised on: 17 OCT 2026 -- shadow values and dirty bitmap
+//	revised on: 17 OCT 2026 -- added width-aware 'vmcs_store()'
+//	revised on: 17 OCT 2026 -- optional per-context VMCS_FIELDS
+//	revised on: 17 OCT 2026 -- MSR-bitmap address fields enabled
 //----------------------------------------------------------------
 
 //typedef struct	{ void  *setting; int  encoding; } VMCS_DEF;
 
 typedef struct	{ int  encoding; void *setting; } VMCS_DEF;
 
+//----------------------------------------------------------------
+// A module which defines VMCS_CONTEXT before including this file
+// gets the fields below as members of a VMCS_FIELDS structure, so
+// that each of its virtual machines can own a copy; our 'machine'
+// and 'results' tables then hold each field's offset within that
+// structure (rather than its address) 
+//----------------------------------------------------------------
+#ifdef VMCS_CONTEXT
+#define VMCS_FIELD( x )		( (void*)offsetof( VMCS_FIELDS, x ) )
+typedef struct	{
+#else
+#define VMCS_FIELD( x )		( &x )
+#endif
+
 // Natural 32-bit Control fields
 unsigned int  control_VMX_pin_based;
 unsigned int  control_VMX_cpu_based;
@@ -163,6 +181,9 @@ unsigned long long  info_IO_RSI;
 unsigned long long  info_IO_RDI;
 unsigned long long  info_IO_RIP;
 unsigned long long  info_guest_linear_address;
+#ifdef VMCS_CONTEXT
+		} VMCS_FIELDS;
+#endif
 
 
 VMCS_DEF  machine[] =	{
@@ -170,168 +191,289 @@ VMCS_DEF  machine[] =	{
 	// Control fields
 	//----------------
 	// Natural 32-bit Control fields
-	{ 0x4000, &control_VMX_pin_based },
-	{ 0x4002, &control_VMX_cpu_based },
-	{ 0x4004, &control_exception_bitmap },
-	{ 0x4006, &control_pagefault_errorcode_mask },
-	{ 0x4008, &control_pagefault_errorcode_match },
-	{ 0x400A, &control_CR3_target_count },
-	{ 0x400C, &control_VM_exit_controls },
-	{ 0x400E, &control_VM_exit_MSR_store_count },
-	{ 0x4010, &control_VM_exit_MSR_load_count },
-	{ 0x4012, &control_VM_entry_controls },
-	{ 0x4014, &control_VM_entry_MSR_load_count },
-	{ 0x4016, &control_VM_entry_interruption_information },
-	{ 0x4018, &control_VM_entry_exception_errorcode },
-	{ 0x401A, &control_VM_entry_instruction_length },
-	{ 0x401C, &control_Task_PRivilege_Threshold },
+	{ 0x4000, VMCS_FIELD( control_VMX_pin_based ) },
+	{ 0x4002, VMCS_FIELD( control_VMX_cpu_based ) },
+	{ 0x4004, VMCS_FIELD( control_exception_bitmap ) },
+	{ 0x4006, VMCS_FIELD( control_pagefault_errorcode_mask ) },
+	{ 0x4008, VMCS_FIELD( control_pagefault_errorcode_match ) },
+	{ 0x400A, VMCS_FIELD( control_CR3_target_count ) },
+	{ 0x400C, VMCS_FIELD( control_VM_exit_controls ) },
+	{ 0x400E, VMCS_FIELD( control_VM_exit_MSR_store_count ) },
+	{ 0x4010, VMCS_FIELD( control_VM_exit_MSR_load_count ) },
+	{ 0x4012, VMCS_FIELD( control_VM_entry_controls ) },
+	{ 0x4014, VMCS_FIELD( control_VM_entry_MSR_load_count ) },
+	{ 0x4016, VMCS_FIELD( control_VM_entry_interruption_information ) },
+	{ 0x4018, VMCS_FIELD( control_VM_entry_exception_errorcode ) },
+	{ 0x401A, VMCS_FIELD( control_VM_entry_instruction_length ) },
+	{ 0x401C, VMCS_FIELD( control_Task_PRivilege_Threshold ) },
 	// Natural 64-bit Control fields
-	{ 0x6000, &control_CR0_mask },
-	{ 0x6002, &control_CR4_mask }, 
-	{ 0x6004, &control_CR0_shadow },
-	{ 0x6006, &control_CR4_shadow },
-	{ 0x6008, &control_CR3_target0 },
-	{ 0x600A, &control_CR3_target1 },
-	{ 0x600C, &control_CR3_target2 },
-	{ 0x600E, &control_CR3_target3 },
+	{ 0x6000, VMCS_FIELD( control_CR0_mask ) },
+	{ 0x6002, VMCS_FIELD( control_CR4_mask ) }, 
+	{ 0x6004, VMCS_FIELD( control_CR0_shadow ) },
+	{ 0x6006, VMCS_FIELD( control_CR4_shadow ) },
+	{ 0x6008, VMCS_FIELD( control_CR3_target0 ) },
+	{ 0x600A, VMCS_FIELD( control_CR3_target1 ) },
+	{ 0x600C, VMCS_FIELD( control_CR3_target2 ) },
+	{ 0x600E, VMCS_FIELD( control_CR3_target3 ) },
 	// Full 64-bit Control fields
-	{ 0x2000, &control_IO_BitmapA_address_full },
-	{ 0x2001, &control_IO_BitmapA_address_high },
-	{ 0x2002, &control_IO_BitmapB_address_full },
-	{ 0x2003, &control_IO_BitmapB_address_high },
-////	{ 0x2004, &control_MSR_Bitmaps_address_full },
-////	{ 0x2005, &control_MSR_Bitmaps_address_high }, 
-	{ 0x2006, &control_VM_exit_MSR_store_address_full },
-	{ 0x2007, &control_VM_exit_MSR_store_address_high },
-	{ 0x2008, &control_VM_exit_MSR_load_address_full },
-	{ 0x2009, &control_VM_exit_MSR_load_address_high },
-	{ 0x200A, &control_VM_entry_MSR_load_address_full },
-	{ 0x200B, &control_VM_entry_MSR_load_address_high },
-	{ 0x200C, &control_Executive_VMCS_pointer_full },
-	{ 0x200D, &control_Executive_VMCS_pointer_high },
-	{ 0x2010, &control_TSC_offset_full },
-	{ 0x2011, &control_TSC_offset_high },
-////	{ 0x2012, &control_virtual_APIC_page_address_full }, 
-////	{ 0x2013, &control_virtual_APIC_page_address_high },
+	{ 0x2000, VMCS_FIELD( control_IO_BitmapA_address_full ) },
+	{ 0x2001, VMCS_FIELD( control_IO_BitmapA_address_high ) },
+	{ 0x2002, VMCS_FIELD( control_IO_BitmapB_address_full ) },
+	{ 0x2003, VMCS_FIELD( control_IO_BitmapB_address_high ) },
+#ifdef VMCS_CONTEXT	// (our older modules omit these: early VT cpus lack them)
+	{ 0x2004, VMCS_FIELD( control_MSR_Bitmaps_address_full ) },
+	{ 0x2005, VMCS_FIELD( control_MSR_Bitmaps_address_high ) }, 
+#endif
+	{ 0x2006, VMCS_FIELD( control_VM_exit_MSR_store_address_full ) },
+	{ 0x2007, VMCS_FIELD( control_VM_exit_MSR_store_address_high ) },
+	{ 0x2008, VMCS_FIELD( control_VM_exit_MSR_load_address_full ) },
+	{ 0x2009, VMCS_FIELD( control_VM_exit_MSR_load_address_high ) },
+	{ 0x200A, VMCS_FIELD( control_VM_entry_MSR_load_address_full ) },
+	{ 0x200B, VMCS_FIELD( control_VM_entry_MSR_load_address_high ) },
+	{ 0x200C, VMCS_FIELD( control_Executive_VMCS_pointer_full ) },
+	{ 0x200D, VMCS_FIELD( control_Executive_VMCS_pointer_high ) },
+	{ 0x2010, VMCS_FIELD( control_TSC_offset_full ) },
+	{ 0x2011, VMCS_FIELD( control_TSC_offset_high ) },
+////	{ 0x2012, VMCS_FIELD( control_virtual_APIC_page_address_full ) }, 
+////	{ 0x2013, VMCS_FIELD( control_virtual_APIC_page_address_high ) },
 
 	//-------------------
 	// Host-State fields
 	//-------------------
 	// Natural 64-bit Host-State fields
-	{ 0x6C00, &host_CR0 },
-	{ 0x6C02, &host_CR3 },
-	{ 0x6C04, &host_CR4 },
-	{ 0x6C06, &host_FS_base },
-	{ 0x6C08, &host_GS_base },
-	{ 0x6C0A, &host_TR_base },
-	{ 0x6C0C, &host_GDTR_base },
-	{ 0x6C0E, &host_IDTR_base },
-	{ 0x6C10, &host_SYSENTER_ESP },
-	{ 0x6C12, &host_SYSENTER_EIP },
-	{ 0x6C14, &host_RSP },
-	{ 0x6C16, &host_RIP },
+	{ 0x6C00, VMCS_FIELD( host_CR0 ) },
+	{ 0x6C02, VMCS_FIELD( host_CR3 ) },
+	{ 0x6C04, VMCS_FIELD( host_CR4 ) },
+	{ 0x6C06, VMCS_FIELD( host_FS_base ) },
+	{ 0x6C08, VMCS_FIELD( host_GS_base ) },
+	{ 0x6C0A, VMCS_FIELD( host_TR_base ) },
+	{ 0x6C0C, VMCS_FIELD( host_GDTR_base ) },
+	{ 0x6C0E, VMCS_FIELD( host_IDTR_base ) },
+	{ 0x6C10, VMCS_FIELD( host_SYSENTER_ESP ) },
+	{ 0x6C12, VMCS_FIELD( host_SYSENTER_EIP ) },
+	{ 0x6C14, VMCS_FIELD( host_RSP ) },
+	{ 0x6C16, VMCS_FIELD( host_RIP ) },
 	// Natural 32-bit Host-State fields
-	{ 0x4C00, &host_SYSENTER_CS },
+	{ 0x4C00, VMCS_FIELD( host_SYSENTER_CS ) },
 	// Natural 16-bit Host-State fields
-	{ 0x0C00, &host_ES_selector },
-	{ 0x0C02, &host_CS_selector },
-	{ 0x0C04, &host_SS_selector },
-	{ 0x0C06, &host_DS_selector },
-	{ 0x0C08, &host_FS_selector },
-	{ 0x0C0A, &host_GS_selector },
-	{ 0x0C0C, &host_TR_selector },
+	{ 0x0C00, VMCS_FIELD( host_ES_selector ) },
+	{ 0x0C02, VMCS_FIELD( host_CS_selector ) },
+	{ 0x0C04, VMCS_FIELD( host_SS_selector ) },
+	{ 0x0C06, VMCS_FIELD( host_DS_selector ) },
+	{ 0x0C08, VMCS_FIELD( host_FS_selector ) },
+	{ 0x0C0A, VMCS_FIELD( host_GS_selector ) },
+	{ 0x0C0C, VMCS_FIELD( host_TR_selector ) },
 
 	//--------------------
 	// Guest-State fields
 	//--------------------
 	// Natural 64-bit Guest-State fields
-	{ 0x6800, &guest_CR0 },
-	{ 0x6802, &guest_CR3 },
-	{ 0x6804, &guest_CR4 },
-	{ 0x6806, &guest_ES_base },
-	{ 0x6808, &guest_CS_base },
-	{ 0x680A, &guest_SS_base },
-	{ 0x680C, &guest_DS_base },
-	{ 0x680E, &guest_FS_base },
-	{ 0x6810, &guest_GS_base },
-	{ 0x6812, &guest_LDTR_base },
-	{ 0x6814, &guest_TR_base },
-	{ 0x6816, &guest_GDTR_base },
-	{ 0x6818, &guest_IDTR_base },
-	{ 0x681A, &guest_DR7 },
-	{ 0x681C, &guest_RSP },
-	{ 0x681E, &guest_RIP },
-	{ 0x6820, &guest_RFLAGS },
-	{ 0x6822, &guest_pending_debug_x },
-	{ 0x6824, &guest_SYSENTER_ESP },
-	{ 0x6826, &guest_SYSENTER_EIP },
+	{ 0x6800, VMCS_FIELD( guest_CR0 ) },
+	{ 0x6802, VMCS_FIELD( guest_CR3 ) },
+	{ 0x6804, VMCS_FIELD( guest_CR4 ) },
+	{ 0x6806, VMCS_FIELD( guest_ES_base ) },
+	{ 0x6808, VMCS_FIELD( guest_CS_base ) },
+	{ 0x680A, VMCS_FIELD( guest_SS_base ) },
+	{ 0x680C, VMCS_FIELD( guest_DS_base ) },
+	{ 0x680E, VMCS_FIELD( guest_FS_base ) },
+	{ 0x6810, VMCS_FIELD( guest_GS_base ) },
+	{ 0x6812, VMCS_FIELD( guest_LDTR_base ) },
+	{ 0x6814, VMCS_FIELD( guest_TR_base ) },
+	{ 0x6816, VMCS_FIELD( guest_GDTR_base ) },
+	{ 0x6818, VMCS_FIELD( guest_IDTR_base ) },
+	{ 0x681A, VMCS_FIELD( guest_DR7 ) },
+	{ 0x681C, VMCS_FIELD( guest_RSP ) },
+	{ 0x681E, VMCS_FIELD( guest_RIP ) },
+	{ 0x6820, VMCS_FIELD( guest_RFLAGS ) },
+	{ 0x6822, VMCS_FIELD( guest_pending_debug_x ) },
+	{ 0x6824, VMCS_FIELD( guest_SYSENTER_ESP ) },
+	{ 0x6826, VMCS_FIELD( guest_SYSENTER_EIP ) },
 	// Natural 32-bit Guest-State fields
-	{ 0x4800, &guest_ES_limit },
-	{ 0x4802, &guest_CS_limit },
-	{ 0x4804, &guest_SS_limit },
-	{ 0x4806, &guest_DS_limit },
-	{ 0x4808, &guest_FS_limit },
-	{ 0x480A, &guest_GS_limit },
-	{ 0x480C, &guest_LDTR_limit },
-	{ 0x480E, &guest_TR_limit },
-	{ 0x4810, &guest_GDTR_limit },
-	{ 0x4812, &guest_IDTR_limit },
-	{ 0x4814, &guest_ES_access_rights },
-	{ 0x4816, &guest_CS_access_rights },
-	{ 0x4818, &guest_SS_access_rights },
-	{ 0x481A, &guest_DS_access_rights },
-	{ 0x481C, &guest_FS_access_rights },
-	{ 0x481E, &guest_GS_access_rights },
-	{ 0x4820, &guest_LDTR_access_rights },
-	{ 0x4822, &guest_TR_access_rights },
-	{ 0x4824, &guest_interruptibility },
-	{ 0x4826, &guest_activity_state },
-	{ 0x4828, &guest_SMBASE },
-	{ 0x482A, &guest_SYSENTER_CS },
+	{ 0x4800, VMCS_FIELD( guest_ES_limit ) },
+	{ 0x4802, VMCS_FIELD( guest_CS_limit ) },
+	{ 0x4804, VMCS_FIELD( guest_SS_limit ) },
+	{ 0x4806, VMCS_FIELD( guest_DS_limit ) },
+	{ 0x4808, VMCS_FIELD( guest_FS_limit ) },
+	{ 0x480A, VMCS_FIELD( guest_GS_limit ) },
+	{ 0x480C, VMCS_FIELD( guest_LDTR_limit ) },
+	{ 0x480E, VMCS_FIELD( guest_TR_limit ) },
+	{ 0x4810, VMCS_FIELD( guest_GDTR_limit ) },
+	{ 0x4812, VMCS_FIELD( guest_IDTR_limit ) },
+	{ 0x4814, VMCS_FIELD( guest_ES_access_rights ) },
+	{ 0x4816, VMCS_FIELD( guest_CS_access_rights ) },
+	{ 0x4818, VMCS_FIELD( guest_SS_access_rights ) },
+	{ 0x481A, VMCS_FIELD( guest_DS_access_rights ) },
+	{ 0x481C, VMCS_FIELD( guest_FS_access_rights ) },
+	{ 0x481E, VMCS_FIELD( guest_GS_access_rights ) },
+	{ 0x4820, VMCS_FIELD( guest_LDTR_access_rights ) },
+	{ 0x4822, VMCS_FIELD( guest_TR_access_rights ) },
+	{ 0x4824, VMCS_FIELD( guest_interruptibility ) },
+	{ 0x4826, VMCS_FIELD( guest_activity_state ) },
+	{ 0x4828, VMCS_FIELD( guest_SMBASE ) },
+	{ 0x482A, VMCS_FIELD( guest_SYSENTER_CS ) },
 	// Natural 16-bit Guest-State fields
-	{ 0x0800, &guest_ES_selector },
-	{ 0x0802, &guest_CS_selector },
-	{ 0x0804, &guest_SS_selector },
-	{ 0x0806, &guest_DS_selector },
-	{ 0x0808, &guest_FS_selector },
-	{ 0x080A, &guest_GS_selector },
-	{ 0x080C, &guest_LDTR_selector },
-	{ 0x080E, &guest_TR_selector },
+	{ 0x0800, VMCS_FIELD( guest_ES_selector ) },
+	{ 0x0802, VMCS_FIELD( guest_CS_selector ) },
+	{ 0x0804, VMCS_FIELD( guest_SS_selector ) },
+	{ 0x0806, VMCS_FIELD( guest_DS_selector ) },
+	{ 0x0808, VMCS_FIELD( guest_FS_selector ) },
+	{ 0x080A, VMCS_FIELD( guest_GS_selector ) },
+	{ 0x080C, VMCS_FIELD( guest_LDTR_selector ) },
+	{ 0x080E, VMCS_FIELD( guest_TR_selector ) },
 	// Full 64-bit Guest-State fields
-	{ 0x2800, &guest_VMCS_link_pointer_full },
-	{ 0x2801, &guest_VMCS_link_pointer_high },
-	{ 0x2802, &guest_IA32_DEBUGCTL_full },
-	{ 0x2803, &guest_IA32_DEBUGCTL_high } };
+	{ 0x2800, VMCS_FIELD( guest_VMCS_link_pointer_full ) },
+	{ 0x2801, VMCS_FIELD( guest_VMCS_link_pointer_high ) },
+	{ 0x2802, VMCS_FIELD( guest_IA32_DEBUGCTL_full ) },
+	{ 0x2803, VMCS_FIELD( guest_IA32_DEBUGCTL_high ) } };
 
 const long elements = ( sizeof( machine ) ) / sizeof( VMCS_DEF );
 
 
 VMCS_DEF  results[ ] = {
-	{ 0x681C, &guest_RSP },
-	{ 0x681E, &guest_RIP },
-	{ 0x6820, &guest_RFLAGS },
-	{ 0x0800, &guest_ES_selector },
-	{ 0x0802, &guest_CS_selector },
-	{ 0x0804, &guest_SS_selector },
-	{ 0x0806, &guest_DS_selector },
-	{ 0x0808, &guest_FS_selector },
-	{ 0x080A, &guest_GS_selector },
-	{ 0x080C, &guest_LDTR_selector },
-	{ 0x080E, &guest_TR_selector },
-	{ 0x4400, &info_vminstr_error }, 
-	{ 0x4402, &info_vmexit_reason },
-	{ 0x4404, &info_vmexit_interrupt_information },
-	{ 0x4406, &info_vmexit_interrupt_error_code },
-	{ 0x4408, &info_IDT_vectoring_information },
-	{ 0x440A, &info_IDT_vectoring_error_code },
-	{ 0x440C, &info_vmexit_instruction_length },
-	{ 0x440E, &info_vmx_instruction_information },
-	{ 0x6400, &info_exit_qualification },
-	{ 0x6402, &info_IO_RCX },
-	{ 0x6404, &info_IO_RSI },
-	{ 0x6406, &info_IO_RDI },
-	{ 0x6408, &info_IO_RIP },
-	{ 0x640A, &info_guest_linear_address } };
+	{ 0x681C, VMCS_FIELD( guest_RSP ) },
+	{ 0x681E, VMCS_FIELD( guest_RIP ) },
+	{ 0x6820, VMCS_FIELD( guest_RFLAGS ) },
+	{ 0x0800, VMCS_FIELD( guest_ES_selector ) },
+	{ 0x0802, VMCS_FIELD( guest_CS_selector ) },
+	{ 0x0804, VMCS_FIELD( guest_SS_selector ) },
+	{ 0x0806, VMCS_FIELD( guest_DS_selector ) },
+	{ 0x0808, VMCS_FIELD( guest_FS_selector ) },
+	{ 0x080A, VMCS_FIELD( guest_GS_selector ) },
+	{ 0x080C, VMCS_FIELD( guest_LDTR_selector ) },
+	{ 0x080E, VMCS_FIELD( guest_TR_selector ) },
+	{ 0x4400, VMCS_FIELD( info_vminstr_error ) }, 
+	{ 0x4402, VMCS_FIELD( info_vmexit_reason ) },
+	{ 0x4404, VMCS_FIELD( info_vmexit_interrupt_information ) },
+	{ 0x4406, VMCS_FIELD( info_vmexit_interrupt_error_code ) },
+	{ 0x4408, VMCS_FIELD( info_IDT_vectoring_information ) },
+	{ 0x440A, VMCS_FIELD( info_IDT_vectoring_error_code ) },
+	{ 0x440C, VMCS_FIELD( info_vmexit_instruction_length ) },
+	{ 0x440E, VMCS_FIELD( info_vmx_instruction_information ) },
+	{ 0x6400, VMCS_FIELD( info_exit_qualification ) },
+	{ 0x6402, VMCS_FIELD( info_IO_RCX ) },
+	{ 0x6404, VMCS_FIELD( info_IO_RSI ) },
+	{ 0x6406, VMCS_FIELD( info_IO_RDI ) },
+	{ 0x6408, VMCS_FIELD( info_IO_RIP ) },
+	{ 0x640A, VMCS_FIELD( info_guest_linear_address ) } };
 
 const long rocount = sizeof( results ) / sizeof( VMCS_DEF );
 
+
+//----------------------------------------------------------------
+// Shadow copies of the values most recently written to the VMCS,
+// with a bitmap marking those 'machine[]' entries which must be
+// rewritten before the next VM entry.  A module's write-loop can
+// skip any entry whose bit is clear (the VMCS still holds it).
+//----------------------------------------------------------------
+#define N_MACHINE	( sizeof( machine ) / sizeof( VMCS_DEF ) )
+
+//----------------------------------------------------------------
+// The 'base' argument is the address of a module's VMCS_FIELDS
+// (or is NULL if the fields are our global variables above)
+//----------------------------------------------------------------
+#define VMCS_ADDR( base, def )	( (char*)(base) + (unsigned long)(def)->setting )
+
+unsigned long long vmcs_setting( void *base, VMCS_DEF *def )
+{
+	void	*addr = VMCS_ADDR( base, def );
+
+	// bits 14:13 of the encoding give the field's width
+	switch ( ( def->encoding >> 13 ) & 3 )
+		{
+		case 0:	return	*(unsigned short*)addr;
+		case 1:	
+		case 2:	return	*(unsigned int*)addr;
+		default: return	*(unsigned long long*)addr;
+		}
+}
+
+void vmcs_store( void *base, VMCS_DEF *def, unsigned long long value )
+{
+	void	*addr = VMCS_ADDR( base, def );
+
+	// store only as many bytes as the field's width requires
+	switch ( ( def->encoding >> 13 ) & 3 )
+		{
+		case 0:	*(unsigned short*)addr = value;  break;
+		case 1:	
+		case 2:	*(unsigned int*)addr = value;  break;
+		default: *(unsigned long long*)addr = value;  break;
+		}
+}
+
+//----------------------------------------------------------------
+// Guest-state fields which a Virtual-8086 guest can change while
+// it runs (so our shadows of them aren't reliable after it ran):
+// its RSP, RIP and RFLAGS, its segment-selectors and base-values,
+// and its pending-debug, interruptibility and activity states
+//----------------------------------------------------------------
+#define VMCS_STALE	1	// 'stale' flags: VMCS contents unknown
+#define VMCS_RAN	2	//   guest has run since fields written
+
+int vmcs_guest_volatile( int encoding )
+{
+	if (( encoding >= 0x0800 )&&( encoding <= 0x080A )) return 1;
+	if (( encoding >= 0x6806 )&&( encoding <= 0x6810 )) return 1;
+	if (( encoding >= 0x681C )&&( encoding <= 0x6822 )) return 1;
+	if (( encoding == 0x4824 )||( encoding == 0x4826 )) return 1;
+	return	0;
+}
+
+int vmcs_mark_dirty( void *base, unsigned long long *shadow, 
+				unsigned long *dirty, int stale )
+{
+	unsigned long long	value;
+	int			i, count = 0, force = 0;
+
+	for (i = 0; i < N_MACHINE; i++)
+		{
+		value = vmcs_setting( base, &machine[ i ] );
+		if ( ( stale & VMCS_STALE )||( force )||( value != shadow[ i ] )
+			||( ( stale & VMCS_RAN )
+			&& vmcs_guest_volatile( machine[ i ].encoding ) ) )
+			{
+			dirty[ i / 64 ] |= ( 1UL << ( i % 64 ) );
+			shadow[ i ] = value;
+			++count;
+			}
+		else	dirty[ i / 64 ] &= ~( 1UL << ( i % 64 ) );
+
+		// a write to a 64-bit field's 'full' encoding also
+		// overwrites its 'high' half, which then needs rewriting
+		force = ( ( machine[ i ].encoding & 0x6001 ) == 0x2000 )
+			&& ( dirty[ i / 64 ] & ( 1UL << ( i % 64 ) ) );
+		}
+	return	count;
+}
+
+#ifndef VMCS_CONTEXT
+unsigned long long  machine_shadow[ N_MACHINE ];
+unsigned long	    machine_dirty[ ( N_MACHINE + 63 ) / 64 ];
+int		    machine_stale = VMCS_STALE;
+
+unsigned long	vmcs_writes_latest;	// VMWRITEs before latest entry
+unsigned long	vmcs_writes_total;	// VMWRITEs since module loaded
+unsigned long	vmcs_entries;		// VM entries since module loaded
+
+int vmcs_scan( void )
+{
+	int	i, count;
+
+	count = vmcs_mark_dirty( NULL, machine_shadow, machine_dirty, 
+							machine_stale );
+	machine_stale = VMCS_RAN;	// the guest is about to run
+
+	// our 'host_RSP' value is only known inside the launch-code
+	for (i = 0; i < N_MACHINE; i++)
+		if ( machine[ i ].setting == &host_RSP ) 
+			{
+			if ( !( machine_dirty[ i / 64 ] & ( 1UL << ( i % 64 ) ) ) )
+				++count;
+			machine_dirty[ i / 64 ] |= ( 1UL << ( i % 64 ) );
+			}
+
+	vmcs_writes_latest = count;
+	vmcs_writes_total += count;
+	return	count;
+}
+#endif
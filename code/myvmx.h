@@ -5,6 +5,21 @@
 //	programmer: ALLAN CRUSE
 //	date begun: 17 JUL 2006
 //	revised on: 26 JUL 2006 -- omit equates for VMX mnemonics
+//	revised on: 17 OCT 2026 -- 'exit_ia32' and VMM_EXITINFO call
+//	revised on: 17 OCT 2026 -- 'batch_ia32' and VMM_BATCH call
+//	revised on: 17 OCT 2026 -- VMM_PIN call
+//	revised on: 17 OCT 2026 -- 'run_ia32' and VMM_RUN call
+//	revised on: 17 OCT 2026 -- 'ports_ia32' and VMM_IOPORTS call
+//	revised on: 17 OCT 2026 -- 'msrs_ia32' and VMM_MSRS call
+//	revised on: 17 OCT 2026 -- 'exitstats_ia32' and VMM_EXITSTATS call
+//	revised on: 17 OCT 2026 -- per-cpu exit-trace rings and VMM_TRACE
+//	revised on: 17 OCT 2026 -- 'bench_ia32' and VMM_BENCH call
+//	revised on: 17 OCT 2026 -- 'runpage_ia32' and VMM_RUN_SHARED call
+//	revised on: 17 OCT 2026 -- 'ring_ia32', VMM_SUBMIT and VMM_EVENTFD
+//	revised on: 17 OCT 2026 -- 'budget_ia32' and VMM_BUDGET call
+//	revised on: 17 OCT 2026 -- 'event_ia32', VMM_EVENT and VMM_EVENTLOG
+//	revised on: 17 OCT 2026 -- 'vtimer_ia32' and VMM_VTIMER
+//	revised on: 17 OCT 2026 -- hypercall functions (VMM_HC_xxx)
 //----------------------------------------------------------------
 
 typedef struct 	{
@@ -26,4 +41,346 @@ typedef struct 	{
 		unsigned int	 gs;
 		} regs_ia32;
 
+typedef struct	{
+		unsigned int		vminstr_error;
+		unsigned int		exit_reason;
+		unsigned int		interrupt_information;
+		unsigned int		interrupt_error_code;
+		unsigned int		IDT_vectoring_information;
+		unsigned int		IDT_vectoring_error_code;
+		unsigned int		instruction_length;
+		unsigned int		instruction_information;
+		unsigned long long	exit_qualification;
+		unsigned long long	IO_RCX;
+		unsigned long long	IO_RSI;
+		unsigned long long	IO_RDI;
+		unsigned long long	IO_RIP;
+		unsigned long long	guest_linear_address;
+		} exit_ia32;
 
+// request-code to fetch all the VM-exit information fields 
+#define VMM_EXITINFO	_IOR( 'v', 1, exit_ia32 )
+
+typedef struct	{
+		regs_ia32	*regs;		// requests in, results out
+		unsigned int	count;		// number of entries in 'regs'
+		unsigned int	flags;		// VMM_CHAIN_xxx options 
+		unsigned int	edi_step;	// EDI advance per chained call
+		unsigned int	keep_base;	// guest memory to be restored
+		unsigned int	keep_size;	//   before each call runs
+		unsigned int	done;		// number of results returned
+		} batch_ia32;
+
+#define VMM_CHAIN_EBX	0x0001	// repeat regs[0] until EBX is zero
+#define VMM_CHAIN_CF	0x0002	//   or until the carry-flag is set
+
+// request-code to run a batch of guest calls
+#define VMM_BATCH	_IOWR( 'v', 2, batch_ia32 )
+
+// request-code to pin a VM to one cpu (an 'int', or -1 to unpin);
+// the caller is bound to that cpu until it unpins, and a pinned VM
+// can then be run only by a task on that cpu (else -EINVAL)
+#define VMM_PIN		_IOW( 'v', 3, int )
+
+typedef struct	{
+		regs_ia32	regs;		// guest's registers (in and out)
+		unsigned int	reason;		// VM-exit reason ending the run
+		unsigned int	port;		// for I/O exits: port-address,
+		unsigned int	size;		//   operand-size (1, 2 or 4),
+		unsigned int	flags;		//   VMM_IO_xxx bits,
+		unsigned int	data;		//   value for OUT (reply for IN)
+		unsigned int	count;		//   repetitions (REP prefix)
+		unsigned int	linear;		//   guest address (INS/OUTS)
+		} run_ia32;
+
+#define VMM_EXIT_IO	30	// 'reason' for an I/O-instruction exit
+
+#define VMM_IO_IN	0x0001	// IN (else OUT) 
+#define VMM_IO_STRING	0x0002	// INS or OUTS (client moves the data
+#define VMM_IO_REP	0x0004	//   and updates ESI/EDI/ECX itself)
+
+// request-code to run a guest (which resumes after an I/O exit) 
+#define VMM_RUN		_IOWR( 'v', 4, run_ia32 )
+
+typedef struct	{
+		unsigned int	first;		// lowest port in the range
+		unsigned int	count;		// number of ports in the range
+		unsigned int	policy;		// VMM_PORT_PASS or VMM_PORT_EXIT
+		} ports_ia32;
+
+#define VMM_PORT_PASS	0	// guest accesses the port directly
+#define VMM_PORT_EXIT	1	// guest's access exits to our client
+
+// request-code to set the policy for a range of I/O ports
+#define VMM_IOPORTS	_IOW( 'v', 5, ports_ia32 )
+
+typedef struct	{
+		unsigned int	index;		// MSR index (ECX value)
+		unsigned int	policy;		// VMM_MSR_xxx bits 
+		} msrs_ia32;
+
+#define VMM_MSR_EXIT	0x0000	// both RDMSR and WRMSR cause exits
+#define VMM_MSR_READ	0x0001	// guest's RDMSR passes through
+#define VMM_MSR_WRITE	0x0002	// guest's WRMSR passes through
+
+// request-code to set an MSR's entry in a VM's allow-list
+#define VMM_MSRS	_IOW( 'v', 6, msrs_ia32 )
+
+#define VMM_REASONS	53	// exit-reasons 0 through 52
+#define VMM_CYCLE_BINS	32	// bin n: 2^n to 2^(n+1)-1 cycles
+
+typedef struct	{
+		unsigned long long	handled[ VMM_REASONS ];
+		unsigned long long	forwarded[ VMM_REASONS ];
+		unsigned long long	cycles[ VMM_REASONS ][ VMM_CYCLE_BINS ];
+		} exitstats_ia32;
+
+// 'cycles' counts the TSC cycles from each VM exit until the guest
+// is next entered (for a forwarded exit, that includes the time our
+// client spent on it); the last bin also counts any longer delays
+
+// request-code to fetch a snapshot of a VM's exit statistics
+#define VMM_EXITSTATS	_IOR( 'v', 7, exitstats_ia32 )
+
+typedef struct	{
+		unsigned long long	tsc;		// time-stamp of record
+		unsigned long long	qualification;	// exit qualification
+		unsigned int		reason;		// VM-exit reason
+		unsigned int		interrupt_info;	// VM-exit interruption
+		unsigned int		ip;		// guest's CS:IP
+		unsigned short		cs;		//   at the VM exit
+		unsigned short		error;		// VM-instruction error
+		} trace_ia32;
+
+typedef struct	{
+		unsigned long long	head;		// records written
+		unsigned long long	tail;		// records consumed
+		unsigned long long	dropped;	// records lost
+		unsigned int		size;		// records in ring
+		unsigned int		mode;		// VMM_TRACE_xxx
+		} trace_ring_ia32;
+
+//----------------------------------------------------------------
+// Each cpu has its own trace-ring: one page that holds its ring's
+// header, followed by 'size' records (record n is in slot n%size).
+// A reader mmaps the ring at offset VMM_TRACE_MMAP(cpu), and takes
+// records 'tail' up to 'head', then stores its new 'tail'.  When
+// the ring is full, a VMM_TRACE_STOP ring drops new records, while
+// a VMM_TRACE_OVERWRITE ring reuses the oldest slot; either way,
+// 'dropped' is incremented.  Because record n may be overwritten
+// by record n+size, the reader must discard a record it copied if
+// 'head' had reached n+size by the time its copy was finished. 
+// Only 'tail' is the reader's to write: our driver keeps its own
+// copies of the other fields, which the page merely shows.
+//----------------------------------------------------------------
+#define VMM_TRACE_OVERWRITE	0	// keep the latest records
+#define VMM_TRACE_STOP		1	// keep the earliest records
+
+#define VMM_TRACE_LENGTH	0x10000	// bytes in each cpu's ring
+#define VMM_TRACE_MMAP(cpu)	( 0x1000000 + (cpu) * VMM_TRACE_LENGTH )
+
+// request-code to empty every cpu's ring and select its mode
+#define VMM_TRACE	_IOW( 'v', 8, int )
+
+// the VMX primitives timed by VMM_BENCH (indices in 'bench_ia32')
+#define VMM_BENCH_RDTSC		0	// the timer's own overhead
+#define VMM_BENCH_VMREAD	1
+#define VMM_BENCH_VMWRITE	2
+#define VMM_BENCH_VMCLEAR	3
+#define VMM_BENCH_VMPTRLD	4
+#define VMM_BENCH_VMLAUNCH	5	// VM entry and exit (round trip)
+#define VMM_BENCH_VMRESUME	6	// VM entry and exit (round trip)
+#define VMM_BENCH_VMXOFF	7	// (skipped while other VMs have 
+#define VMM_BENCH_VMXON		8	//   a VMCS active on this cpu)
+#define VMM_BENCH_OPS		9
+
+typedef struct	{
+		unsigned int		count;		// samples (0 if skipped)
+		unsigned int		pad;
+		unsigned long long	min;		// in TSC cycles
+		unsigned long long	median;
+		unsigned long long	p99;
+		} bench_op_ia32;
+
+typedef struct	{
+		regs_ia32	regs;		// guest at an exiting instruction
+		unsigned int	samples;	// timings of each primitive
+		unsigned int	cpu;		// cpu where they were taken
+		unsigned int	reason;		// exit-reason for round trips
+		unsigned int	pad;
+		bench_op_ia32	op[ VMM_BENCH_OPS ];
+		} bench_ia32;
+
+// request-code to time the VMX primitives on the caller's cpu
+#define VMM_BENCH	_IOWR( 'v', 9, bench_ia32 )
+
+//----------------------------------------------------------------
+// Each VM has a run page, which its client can mmap (one page, at
+// offset VMM_RUN_MMAP) and then run its guest by VMM_RUN_SHARED,
+// a call with no argument: the guest's registers are taken from
+// 'run.regs', and all the results are left in the page.  The I/O
+// fields of 'run' are used just as with VMM_RUN; the rest of the
+// page is written by our driver (and only read by our client).
+//----------------------------------------------------------------
+typedef struct	{
+		run_ia32		run;		// registers, reason, I/O
+		int			status;		// the call's return-value
+		unsigned int		instruction_length;
+		unsigned long long	exit_qualification;
+		unsigned int		interrupt_information;
+		unsigned int		pad;
+		unsigned long long	entries;	// VM entries so far
+		} runpage_ia32;
+
+#define VMM_RUN_MMAP	0x800000	// mmap offset of the run page
+
+// request-code to run a guest using the VM's run page
+#define VMM_RUN_SHARED	_IO( 'v', 10 )
+
+//----------------------------------------------------------------
+// Asynchronous guest calls: a client mmaps its VM's ring page (one
+// page, at offset VMM_RING_MMAP), puts requests into 'sq[]' at its
+// 'sq_tail', advances 'sq_tail' and calls VMM_SUBMIT, which returns
+// at once.  Our driver runs the requests in order (each one as the
+// plain register-call does), and puts each result into 'cq[]' at
+// 'cq_tail', with the 'tag' its request had.  The client takes the
+// results from 'cq_head' up to 'cq_tail', then advances 'cq_head'.
+// Indices run freely (entry n is in slot n % VMM_RING_SLOTS); our
+// driver alone writes 'sq_head' and 'cq_tail'.  When 'cq[]' is full
+// we stop, until a VMM_SUBMIT call says results have been taken.
+// A poll() on the VM's file reports POLLIN while results wait (and
+// POLLOUT while 'sq[]' has room), and an eventfd given by a call to
+// VMM_EVENTFD is signaled for each result.
+//----------------------------------------------------------------
+typedef struct	{
+		regs_ia32		regs;	// request in, result out
+		unsigned long long	tag;	// the client's own identifier
+		int			status;	// the call's return-value
+		unsigned int		reason;	// VM-exit reason ending the call
+		} ring_entry_ia32;
+
+#define VMM_RING_SLOTS	16	// entries in each of 'sq[]' and 'cq[]'
+#define VMM_RING_MMAP	0x801000	// mmap offset of the ring page
+
+typedef struct	{
+		unsigned int	sq_head;	// next request we take
+		unsigned int	sq_tail;	// next request slot (client's)
+		unsigned int	cq_head;	// next result slot (client's)
+		unsigned int	cq_tail;	// next result we put
+		ring_entry_ia32	sq[ VMM_RING_SLOTS ];
+		ring_entry_ia32	cq[ VMM_RING_SLOTS ];
+		} ring_ia32;
+
+// request-code to have the requests in 'sq[]' run in the background
+#define VMM_SUBMIT	_IO( 'v', 11 )
+
+// request-code to name an eventfd for results (an 'int', or -1)
+#define VMM_EVENTFD	_IOW( 'v', 12, int )
+
+//----------------------------------------------------------------
+// A VM's budget limits how long each call may keep its guest 
+// running (a budget of zero, as at open(), means no limit).  A 
+// call which uses up its budget stops the guest, and returns the
+// status -ETIMEDOUT (so an ioctl fails with errno ETIMEDOUT), with
+// the guest's registers showing the CS:IP where it was stopped.
+//----------------------------------------------------------------
+typedef struct	{
+		unsigned long long	cycles;		// TSC cycles per call,
+		unsigned int		microseconds;	//   or else the time
+		unsigned int		pad;
+		} budget_ia32;
+
+// request-code to set a VM's budget for each of its calls
+#define VMM_BUDGET	_IOW( 'v', 13, budget_ia32 )
+
+//----------------------------------------------------------------
+// Events queued for a guest are injected one at a time, in order,
+// at VM entries: an external interrupt waits until the guest has
+// IF=1 (and no blocking by STI or MOV-SS), which our driver finds 
+// out from an interrupt-window exit, so it's delivered as soon as
+// the guest can take it.  An event may be queued while the guest
+// is running (its cpu is then made to exit, to pick it up); if no
+// call is running, it waits for the next one.  Our guest runs in
+// virtual-8086 mode, so every event -- NMIs and exceptions too --
+// is delivered through its real-mode vector-table, as on an 8086:
+// no error-code is pushed, and an event for which the guest's
+// stack has no room is dropped (see /proc/vmmstat).
+//----------------------------------------------------------------
+typedef struct	{
+		unsigned int	type;		// VMM_EVENT_xxx
+		unsigned int	vector;		// interrupt or exception
+		unsigned int	error_code;	// (unused: see above)
+		unsigned int	id;		// the client's own identifier
+		} event_ia32;
+
+#define VMM_EVENT_EXTINT	0	// external interrupt
+#define VMM_EVENT_NMI		2	// non-maskable interrupt (vector 2)
+#define VMM_EVENT_EXCEPTION	3	// hardware exception (0-31)
+
+// request-code to queue an event for a guest
+#define VMM_EVENT	_IOW( 'v', 14, event_ia32 )
+
+typedef struct	{
+		unsigned int		id;	// the event's 'id'
+		unsigned int		vector;
+		unsigned long long	cycles;	// TSC cycles, queued to injected
+		} delivery_ia32;
+
+#define VMM_DELIVERIES	16	// most deliveries kept in 'recent'
+
+typedef struct	{
+		unsigned long long	delivered;	// events injected so far
+		unsigned int		pending;	// events still queued
+		unsigned int		count;		// entries in 'recent'
+		delivery_ia32		recent[ VMM_DELIVERIES ];  // oldest first
+		} eventlog_ia32;
+
+// request-code to fetch (and then empty) a VM's log of deliveries
+#define VMM_EVENTLOG	_IOR( 'v', 15, eventlog_ia32 )
+
+//----------------------------------------------------------------
+// A guest may have its own virtual 8254 timer and 8259 interrupt
+// controller (see 'vmpic.h'), which raise IRQ0 at the rate given
+// here, whether or not the host's interrupts make the guest exit.
+// The guest's own programming of the 8254 can change that rate.
+// A rate of zero removes these devices (their ports then go back
+// to exiting to our client, or not, as VMM_IOPORTS left them).
+//----------------------------------------------------------------
+typedef struct	{
+		unsigned int		hz;	// IRQ0 rate (or 0, for none)
+		unsigned int		reload;	// 8254 count now in use
+		unsigned long long	ticks;	// IRQ0s taken by the guest
+		unsigned long long	merged;	// ticks merged into another
+		} vtimer_ia32;
+
+// request-code to set a VM's timer rate (and fetch its statistics)
+#define VMM_VTIMER	_IOWR( 'v', 16, vtimer_ia32 )
+
+//----------------------------------------------------------------
+// Hypercalls: a guest in virtual-8086 mode executes VMCALL with
+// VMM_HC_SIGNATURE in the upper half of EAX and a function-number
+// in the lower half.  All but VMM_HC_DONE are completed by our 
+// driver, which resumes the guest after the VMCALL (with CF=1 if 
+// the function failed); VMM_HC_DONE returns to our client, as any
+// other VMCALL (such as one planted as a 'return' sentinel) does.
+//
+//   VMM_HC_DONE   the call is finished
+//   VMM_HC_PRINT  write ECX bytes (at most 256) from DS:SI to the
+//                 kernel log (rate-limited: lines may be dropped)
+//   VMM_HC_YIELD  let other tasks have our cpu, then carry on
+//   VMM_HC_TIME   get the time-stamp counter in EDX:EAX, and its
+//                 rate (in kHz) in ECX
+//   VMM_HC_NEXT   (in an asynchronous call, see 'ring_ia32') post
+//                 the guest's registers as the result of the call
+//                 it is serving, and load the general registers of
+//                 the next submitted call (CF=1 if there is none)
+//----------------------------------------------------------------
+#define VMM_HC_SIGNATURE	0x564D	// 'VM'
+#define VMM_HC_DONE		0
+#define VMM_HC_PRINT		1
+#define VMM_HC_YIELD		2
+#define VMM_HC_TIME		3
+#define VMM_HC_NEXT		4
+#define VMM_HC_COUNT		5
+
+#define VMM_HC( function )	( ( VMM_HC_SIGNATURE << 16 ) | ( function ) )
@@ -18,15 +18,58 @@
 //	revised on: 28 JUL 2008 -- for Linux kernel version 2.6.26.
 //	revised on: 30 JUL 2008 -- for cleanup of vmexit conditions
 //	revised on: 04 AUG 2008 -- fix for machines with > 4GB ram
+//	revised on: 17 OCT 2026 -- VMX stays on, VMCS current, between calls
+//	revised on: 17 OCT 2026 -- rewrite only the 'dirty' VMCS fields
+//	revised on: 17 OCT 2026 -- read only the exit-fields we need
+//	revised on: 17 OCT 2026 -- added VMM_BATCH for chained calls
+//	revised on: 17 OCT 2026 -- each open() gets its own VM context
+//	revised on: 17 OCT 2026 -- node-local VMXON pages; VMM_PIN call
+//	revised on: 17 OCT 2026 -- exit-handlers dispatched by reason
+//	revised on: 17 OCT 2026 -- VMM_RUN lets clients emulate I/O ports
+//	revised on: 17 OCT 2026 -- VMM_IOPORTS programs the I/O bitmaps
+//	revised on: 17 OCT 2026 -- MSR bitmap, with VMM_MSRS allow-list
+//	revised on: 17 OCT 2026 -- exit-latency histograms (VMM_EXITSTATS)
+//	revised on: 17 OCT 2026 -- VMM_BENCH times the VMX primitives
+//	revised on: 17 OCT 2026 -- per-phase timing of each ioctl
+//	revised on: 17 OCT 2026 -- host-state captured once per cpu
+//	revised on: 17 OCT 2026 -- syscall MSRs restored only when needed
+//	revised on: 17 OCT 2026 -- mmap'able run page, for VMM_RUN_SHARED
+//	revised on: 17 OCT 2026 -- asynchronous calls, through a ring page
+//	revised on: 17 OCT 2026 -- VMM_BUDGET limits each call's run-time
+//	revised on: 17 OCT 2026 -- queued event-injection (VMM_EVENT)
+//	revised on: 17 OCT 2026 -- virtual 8254/8259 raise the guest's IRQ0
+//	revised on: 17 OCT 2026 -- a guest's HLT (with IF=1) sleeps in here
+//	revised on: 17 OCT 2026 -- hypercalls (VMM_HC_xxx) completed here
+//	revised on: 17 OCT 2026 -- software backend (see 'vmsoft.h')
+//	revised on: 17 OCT 2026 -- VMX controls negotiated from capability MSRs
+//	revised on: 17 OCT 2026 -- every VM exit is logged by 'vmtrace_exit()'
 //-------------------------------------------------------------------
 
+#define VMCS_CONTEXT		// VMCS fields are per-VM (see 'machine.h')
+
 #include <linux/module.h>	// for init_module() 
 #include <linux/proc_fs.h>	// for create_proc_read_entry() 
 #include <linux/mm.h>		// for remap_pfn_range()
+#include <linux/mutex.h>	// for mutex_lock()
+#include <linux/sched.h>	// for set_cpus_allowed()
+#include <linux/sort.h>		// for sort()
+#include <linux/cpu.h>		// for register_cpu_notifier()
+#include <linux/kthread.h>	// for kthread_run()
+#include <linux/poll.h>		// for poll_wait()
+#include <linux/eventfd.h>	// for eventfd_signal()
+#include <linux/file.h>		// for fput()
+#include <linux/spinlock.h>	// for spin_lock_irqsave()
+#include <linux/vmalloc.h>	// for vmalloc()
 #include <asm/io.h>		// for virt_to_phys()
 #include <asm/uaccess.h>	// for copy_from_user()
+#include <asm/desc.h>		// for 'struct desc_ptr'
+#include <asm/tsc.h>		// for 'tsc_khz'
 #include "machine.h"		// storage for the VMCS fields
 #include "myvmx.h"		// for 'regs_ia32' structure 
+#include "vmexits.h"		// for our VM-exit handlers
+#include "vmpic.h"		// for our virtual timer and PIC
+#include "vmsoft.h"		// for our software backend
+#include "vmtrace.h"		// for our exit trace-rings
 
 #define MSR_VMX_CAPS	0x480	// index for VMX Capabilities MSRs
 #define EFER_MSR   0xC0000080	// index for Extended Feature Enable
@@ -37,6 +80,41 @@
 #define LEGACY_HIMEM 0x100000	// address-reach in 80386 VM86-mode
 #define LEGACY_VIDEO 0x0A0000	// address-base in VGA graphics mode
 #define KMEM_LENGTH  0x100000	// one-megabyte allocation of memory
+#define MAX_BATCH	256	// most guest calls in a single batch
+#define MAX_KEEP	256	// most guest bytes restored per call
+#define MAX_MSR_STATS	32	// most MSRs whose exits are counted
+#define MAX_SAMPLES	4096	// most timings of a VMX primitive
+#define EXIT_HLT	12	// VM-exit reasons: guest executed HLT,
+#define EXIT_VMCALL	18	//   or VMCALL
+#define EXIT_PREEMPTION	52	// VMX-preemption timer expired
+#define PREEMPT_TIMER	0x482E	// VMCS encoding for the timer's value
+#define MAX_EVENTS	32	// most events queued for a guest
+#define VMCS_CPU_BASED	0x4002	// VMCS encodings for event-delivery
+#define VMCS_GUEST_ES	0x0800	// (by reflecting them in VM86)
+#define VMCS_GUEST_CS	0x0802
+#define VMCS_GUEST_SS	0x0804
+#define VMCS_GUEST_DS	0x0806
+#define VMCS_GUEST_FS	0x0808
+#define VMCS_GUEST_GS	0x080A
+#define VMCS_GUEST_CS_BASE 0x6808
+#define VMCS_GUEST_RSP	0x681C
+#define VPIC_PORTS_20	0x03	// ports 0x20-0x21 in 'iomap[ 0x20 >> 3 ]'
+#define VPIC_PORTS_40	0x09	// ports 0x40,0x43 in 'iomap[ 0x40 >> 3 ]'
+
+// the phases of an ioctl which runs our guest (see 'phase_mark')
+#define PHASE_COPY_IN	0	// ioctl entry and copy_from_user
+#define PHASE_FIELDS	1	// guest-state and control fields
+#define PHASE_HOST	2	// host-state (mostly from per-cpu cache)
+#define PHASE_HOST_MSRS	3	// host MSRs the guest can write
+#define PHASE_SCAN	4	// marking the dirty fields
+#define PHASE_VMX_LOAD	5	// VMXON (if needed) and VMPTRLD
+#define PHASE_VMWRITES	6	// VMWRITEs of the dirty fields
+#define PHASE_GUEST	7	// VMLAUNCH/VMRESUME until VM exit
+#define PHASE_TABLES	8	// descriptor-table restore
+#define PHASE_RESULTS	9	// VMREADs of the exit results
+#define PHASE_HANDLERS	10	// exits completed in our driver
+#define PHASE_COPY_OUT	11	// copy_to_user and ioctl return
+#define N_PHASES	12
 
 #define __SELECTOR_TASK 0x0008
 #define __SELECTOR_LDTR 0x0010
@@ -45,31 +123,37 @@
 #define __SELECTOR_VRAM 0x0014
 #define __SELECTOR_FLAT 0x001C
 
-#define VMXON_OFFSET	0x0000
+#define MSRBITMAP_OFFSET 0x0000	// VMX MSR bitmaps (4KB)
 #define GUEST_OFFSET	0x1000
 #define PAGE_DIR_OFFSET	0x2000
 #define PAGE_TBL_OFFSET 0x3000
-#define IOBITMAP_OFFSET 0x4000
+#define IOBITMAP_OFFSET 0x4000	// VMX I/O bitmaps A and B (8KB)
 #define IDT_KERN_OFFSET 0x6000
 #define GDT_KERN_OFFSET 0x6800
 #define LDT_KERN_OFFSET 0x6A00
 #define TSS_KERN_OFFSET 0x6C00
 #define SS0_KERN_OFFSET 0xA000
 #define ISR_KERN_OFFSET 0xA000
-#define MSR_KERN_OFFSET	0xC000
 
 
 // function prototypes for device-driver methods
-int my_ioctl( struct inode *, struct file *, unsigned int, unsigned long );
+long my_ioctl( struct file *, unsigned int, unsigned long );
 int my_mmap( struct file *, struct vm_area_struct *vma );
 int my_open( struct inode *, struct file * );
+int my_release( struct inode *, struct file * );
+
+// (our hypercalls can complete asynchronous calls, see 'ring_ia32')
+int vmx_hypercall( void *vmcs, unsigned int function );
+unsigned int my_poll( struct file *, poll_table * );
 
 
 struct file_operations	my_fops = {
 				owner:		THIS_MODULE,
-				ioctl:		my_ioctl,
+				unlocked_ioctl:	my_ioctl,
 				open:		my_open,
+				release:	my_release,
 				mmap:		my_mmap,
+				poll:		my_poll,
 				};
 
 char modname[] = "newvmm64";
@@ -80,40 +164,248 @@ char iname_host[] = "vmmhost";
 char iname_task[] = "vmmguest";
 char iname_read[] = "vmmread";
 char iname_mmap[] = "vmmmmap";
+char iname_stat[] = "vmmstat";
+char iname_exit[] = "vmmexits";
+char iname_msrs[] = "vmmmsrs";
+char iname_phas[] = "vmmphase";
 char iname_help[] = "vmmhelp";
 int	my_major = 88;
 char	cpu_oem[ 16 ];
 int	cpu_features;
+int	vmx_supported;		// else every VM uses our interpreter
+int	soft;			// VMs opened from now on use it anyway
+module_param( soft, int, 0644 );
+MODULE_PARM_DESC( soft, "new VMs run in our interpreter (see vmsoft.h)" );
 unsigned long long  msr0x480[ 11 ];
 unsigned long long  efcr, efer;
 unsigned long	    original_CR0;
 unsigned long	    original_CR4;
-void	*kmem;
-unsigned long long  lower_region;
-unsigned long long  himem_region;
-unsigned long long  reach_region;
-
-unsigned long long  vmxon_region;
-unsigned long long  guest_region;
-unsigned long long  pgdir_region;
-unsigned long long  pgtbl_region;
-unsigned long long  iomap_region;
-unsigned long long  g_IDT_region;
-unsigned long long  g_GDT_region;
-unsigned long long  g_LDT_region;
-unsigned long long  g_TSS_region;
-unsigned long long  g_SS0_region;
-unsigned long long  g_ISR_region;
-unsigned long long  h_MSR_region;
-
-regs_ia32    vm;
-int retval, extints, nmiints;
-unsigned long	guest_RAX, guest_RBX, guest_RCX, guest_RDX;
-unsigned long	guest_RBP, guest_RSI, guest_RDI;
-unsigned short	host_gdtr[5], host_idtr[5], host_ldtr;
-unsigned long	msr_index, msr_value;
-void		*next_host_MSR_entry;
 
+//----------------------------------------------------------------
+// Everything belonging to one virtual machine: each open() of our
+// device-file gets one of these, and 'lock' serializes the ioctls
+// made on it (VMs belonging to different opens run concurrently)
+//----------------------------------------------------------------
+struct vmm_context	{
+	struct mutex	lock;
+	VMCS_FIELDS	vmcs;		// our copy of the VMCS fields
+	unsigned long long  shadow[ N_MACHINE ];   // as last written
+	unsigned long	dirty[ ( N_MACHINE + 63 ) / 64 ];
+	int		stale;		// VMCS_STALE or VMCS_RAN (see 'machine.h')
+	unsigned int	results_valid;	// bitmap of results[] read since exit
+	unsigned long	gpr[ 8 ];	// guest's general registers
+	VMEXIT		exit;		// what our exit-handlers see
+	exitstats_ia32	stats;		// exits and latencies, by reason
+	int		stats_reset;	// a reset waits for our next ioctl
+	int		timed_reason;	// latest exit, to time (or -1)
+	unsigned long long  exit_tsc;	// time-stamp of that exit
+	struct	{
+		unsigned int	index;
+		unsigned long	reads, writes;
+		}	msr_exits[ MAX_MSR_STATS ];	// by MSR index
+	unsigned long	msr_exits_other;	// (when that table is full)
+	unsigned int	msr_clobber;	// 'host_msrs[]' the guest can write
+	regs_ia32	vm;
+	int		extints, nmiints;
+	int		io_pending;	// client owes us an I/O completion
+	run_ia32	io;		// the I/O exit it is completing
+	unsigned int	io_length;	// length of that IN or OUT
+	runpage_ia32	*runpage;	// our client's view of its guest
+	unsigned int	read_extra;	// results[] needed by our caller
+	ring_ia32	*ring;		// asynchronous calls (see 'myvmx.h')
+	unsigned int	sq_head;	// our own copies of the indices
+	unsigned int	cq_tail;	//   that only we may advance
+	struct task_struct  *ring_task;	// runs them (once any are made)
+	wait_queue_head_t   ring_work;	// where 'ring_task' waits
+	wait_queue_head_t   ring_done;	// where poll() waits
+	struct file	*eventfd;	// signaled for each result (or NULL)
+	int		cpu;		// cpu where our VMCS is active (or -1)
+	unsigned long	cpu_epoch;	// that cpu's 'vmx_epoch' back then
+	int		pin_cpu;	// cpu this VM must run on (or -1)
+	struct task_struct  *pin_task;	// the task which pinned it, and
+	cpumask_t	pin_saved;	//   that task's cpus before then
+	int		launched;	// nonzero once launched on that cpu
+	unsigned long	writes_latest;	// VMWRITEs before latest entry
+	unsigned long	writes_total;	// VMWRITEs since this VM opened
+	unsigned long	entries;	// VM entries since this VM opened
+	unsigned long long  budget;	// TSC cycles allowed per call (or 0)
+	unsigned long long  deadline;	// when this call's budget runs out
+	unsigned long	expired;	// calls which used up their budget
+	spinlock_t	event_lock;	// guards our events (and 'guest_cpu')
+	struct	{
+		event_ia32	event;
+		unsigned long long  queued;	// time-stamp of VMM_EVENT
+		}	events[ MAX_EVENTS ];	// queue for injection
+	unsigned int	event_head, event_tail;
+	int		guest_cpu;	// cpu where our guest runs (or -1)
+	eventlog_ia32	eventlog;	// deliveries since last fetched
+	unsigned long long  event_cycles;	// total of all their times
+	unsigned long long  event_cycles_max;	//   and the longest one
+	unsigned long	events_dropped;	// guest's stack couldn't take them
+	VPIC		vpic;		// virtual timer and PIC (see 'vmpic.h')
+	int		vpic_on;	// VMM_VTIMER turned them on
+	int		ticking;	// our timer runs during this call
+	unsigned char	vpic_iomap[ 2 ];	// bits they took over
+	int		idle;		// EXIT_IDLE or EXIT_YIELD: guest sleeps
+	wait_queue_head_t   idle_wait;	// where it sleeps until it has one
+	unsigned long	idles;		// HLTs which put our guest to sleep
+	unsigned long long  idle_cycles;	// and how long it slept
+	unsigned long	yields;		// VMM_HC_YIELDs which gave up our cpu
+	unsigned long	hypercalls[ VMM_HC_COUNT ];	// by function
+	unsigned long	prints_dropped;	// VMM_HC_PRINTs rate-limited
+	int		ring_call;	// an asynchronous call is running
+	int		serving;	//   whose result is still to be posted
+	unsigned long long  serving_tag;	//   with this tag
+	int		soft;		// runs in our interpreter, not with VMX
+	SOFT_CACHE	*soft_cache;	// its decoded blocks (once it has run)
+	unsigned long long  phase_tsc;	// time-stamp of latest phase mark
+	unsigned long long  phase_now[ N_PHASES ];	// for this ioctl
+	unsigned long long  phase_last[ N_PHASES ];	// for latest run
+	unsigned long long  phase_total[ N_PHASES ];	// for all runs
+	unsigned long	phase_calls;	// ioctls in those totals
+	int		phase_ran;	// this ioctl has run our guest
+
+	void		*kmem;
+	unsigned long long  lower_region;
+	unsigned long long  himem_region;
+	unsigned long long  reach_region;
+
+	unsigned long long  guest_region;
+	unsigned long long  pgdir_region;
+	unsigned long long  pgtbl_region;
+	unsigned long long  iomap_region;
+	unsigned long long  msrbm_region;
+	unsigned long long  g_IDT_region;
+	unsigned long long  g_GDT_region;
+	unsigned long long  g_LDT_region;
+	unsigned long long  g_TSS_region;
+	unsigned long long  g_SS0_region;
+	unsigned long long  g_ISR_region;
+	};
+
+// per-cpu VMX state (each cpu enters VMX operation when first used)
+void		    *vmxon_page[ NR_CPUS ];
+unsigned long long  vmxon_region[ NR_CPUS ];
+int		    vmx_on[ NR_CPUS ];
+int		    vmx_active[ NR_CPUS ];    // VMCSs active on each cpu
+struct vmm_context  *vmx_current[ NR_CPUS ];  // whose VMCS is current
+unsigned long	    vmx_epoch[ NR_CPUS ];     // times each cpu went down
+
+// the pseudo-files show the most recently used virtual machine
+struct vmm_context  *vmm_last;
+DEFINE_MUTEX( vmm_proc_lock );
+
+unsigned int	host_msrs[] = {	MSR_KERNEL_GS_BASE, MSR_STAR, MSR_LSTAR, 
+				MSR_CSTAR, MSR_SYSCALL_MASK };
+
+#define N_HOST_MSRS	( sizeof( host_msrs ) / sizeof( unsigned int ) )
+
+//----------------------------------------------------------------
+// The parts of our host-state which belong to a cpu (rather than
+// to whichever task calls us), captured there by 'host_capture',
+// along with that cpu's values for the syscall MSRs we restore
+//----------------------------------------------------------------
+struct host_state	{
+	int		valid;		// captured since cpu came online
+	unsigned short	cs, ss, tr;	// selectors
+	struct desc_ptr	gdtr, idtr;
+	unsigned long long  tr_base;
+	unsigned long long  gs_base;
+	unsigned long long  sysenter_cs, sysenter_esp, sysenter_eip;
+	unsigned long long  msrs[ N_HOST_MSRS ];	// see 'host_msrs[]'
+	};
+
+struct host_state   host_state[ NR_CPUS ];
+
+
+unsigned long long read_msr( unsigned int index )
+{
+	unsigned int	lo, hi;
+
+	asm volatile( " rdmsr " : "=a" (lo), "=d" (hi) : "c" (index) );
+	return	( (unsigned long long)hi << 32 ) | lo;
+}
+
+unsigned long long read_tsc( void )
+{
+	unsigned int	lo, hi;
+
+	asm volatile( " rdtsc " : "=a" (lo), "=d" (hi) );
+	return	( (unsigned long long)hi << 32 ) | lo;
+}
+
+// runs on the cpu whose host-state is captured
+void host_capture( void *dummy )
+{
+	struct host_state	*hs = &host_state[ smp_processor_id() ];
+	unsigned long 		*host_gdt;
+	signed long 		desc;
+	int			i;
+
+	asm(" mov %%cs, %0 " : "=r" (hs->cs));
+	asm(" mov %%ss, %0 " : "=r" (hs->ss));
+	asm(" sgdt %0 \n sidt %1 " : "=m" (hs->gdtr), "=m" (hs->idtr) );
+
+	asm(" str %0 " : "=r" (hs->tr));
+	host_gdt = (unsigned long*)hs->gdtr.address;
+	desc = host_gdt[ (hs->tr >> 3) + 0 ]; 
+	hs->tr_base = ((desc >> 32)&0xFF000000)|((desc >> 16)&0x00FFFFFF);
+	desc = host_gdt[ (hs->tr >> 3) + 1 ]; 
+	desc <<= 48;	// maneuver to insure 'canonical' addressing
+	hs->tr_base |= (desc >> 16)&0xFFFFFFFF00000000;
+
+	// the SYSENTER MSRs, and the base-address MSR for GS
+	hs->sysenter_cs  = read_msr( 0x174 );
+	hs->sysenter_esp = read_msr( 0x175 );
+	hs->sysenter_eip = read_msr( 0x176 );
+	hs->gs_base = read_msr( 0xC0000101 );
+
+	// the syscall MSRs (but KERNEL_GS_BASE belongs to the calling
+	// task, so 'vmx_prepare' reads it whenever it is needed)
+	for (i = 0; i < N_HOST_MSRS; i++)
+		hs->msrs[ i ] = read_msr( host_msrs[ i ] );
+	hs->valid = 1;
+}
+
+//----------------------------------------------------------------
+// VM entries and VM exits leave the syscall MSRs alone, so our
+// guest can change only those whose WRMSR our client lets pass
+// through (see 'msr_set_policy').  Just those are rewritten, and
+// only once we are leaving for user space: until then we stay in
+// the kernel on this cpu, where nothing makes use of them.
+//----------------------------------------------------------------
+void host_msrs_restore( struct vmm_context *ctx, struct host_state *hs )
+{
+	unsigned long long	value;
+	int			i;
+
+	for (i = 0; i < N_HOST_MSRS; i++)
+		if ( ctx->msr_clobber & ( 1 << i ) )
+			{
+			value = hs->msrs[ i ];
+			asm volatile( " wrmsr " :: "c" (host_msrs[ i ]), 
+				"a" ((unsigned int)value), 
+				"d" ((unsigned int)( value >> 32 )) );
+			}
+}
+
+//----------------------------------------------------------------
+// Our pseudo-files report on 'vmm_last'; this returns it with our
+// 'vmm_proc_lock' held (the caller unlocks), or NULL if there's no
+// virtual machine to report on
+//----------------------------------------------------------------
+struct vmm_context *proc_context( void )
+{
+	mutex_lock( &vmm_proc_lock );
+	if ( vmm_last ) return vmm_last;
+	mutex_unlock( &vmm_proc_lock );
+	return	NULL;
+}
+
+int proc_no_context( char *buf )
+{
+	return	sprintf( buf, "\n no virtual machine has been opened \n\n" );
+}
 
 int my_info_help( char *buf, char **start, off_t off, int count, 
 							int *eof, void *data )
@@ -147,6 +439,23 @@ int my_info_help( char *buf, char **start, off_t off, int count,
 	len += sprintf( buf+len, "view map of driver's memory regions" );
 	len += sprintf( buf+len, "\n" );
 
+	len += sprintf( buf+len, "\n\t /proc/%s - ", iname_stat );
+	len += sprintf( buf+len, "view the driver's VM-entry statistics" );
+	len += sprintf( buf+len, "\n" );
+
+	len += sprintf( buf+len, "\n\t /proc/%s - ", iname_exit );
+	len += sprintf( buf+len, "view VM exits, by reason, and latencies" );
+	len += sprintf( buf+len, "\n\t\t (write to this file to reset them)" );
+	len += sprintf( buf+len, "\n" );
+
+	len += sprintf( buf+len, "\n\t /proc/%s - ", iname_msrs );
+	len += sprintf( buf+len, "view RDMSR/WRMSR exits, by MSR index" );
+	len += sprintf( buf+len, "\n" );
+
+	len += sprintf( buf+len, "\n\t /proc/%s - ", iname_phas );
+	len += sprintf( buf+len, "view where the time for our ioctls went" );
+	len += sprintf( buf+len, "\n" );
+
 	len += sprintf( buf+len, "\n\t /proc/%s - ", iname_help );
 	len += sprintf( buf+len, "view this list of driver's pseudo-files" );
 	len += sprintf( buf+len, "\n" );
@@ -155,6 +464,94 @@ int my_info_help( char *buf, char **start, off_t off, int count,
 	return	len;
 }
 
+//----------------------------------------------------------------
+// Our VMX controls, negotiated from the capability MSRs: the low
+// half of each gives its allowed-0 settings (a bit set there must
+// be 1), the high half its allowed-1 settings (a bit clear there
+// must be 0).  The TRUE_xxx_CTLS MSRs (present when bit 55 is set
+// in IA32_VMX_BASIC) show which 'default1' controls may be cleared,
+// so with them we turn on no exits beyond those in our profile.
+//----------------------------------------------------------------
+#define CTLS_PIN	0	// pin-based VM-execution controls
+#define CTLS_CPU	1	// primary processor-based controls
+#define CTLS_EXIT	2	// VM-exit controls
+#define CTLS_ENTRY	3	// VM-entry controls
+#define N_CTLS		4
+
+struct vmx_profile	{
+	char		*name;
+	unsigned int	required;	// controls our guests can't run without
+	unsigned int	wanted;		// and ones we use if the cpu allows
+	};
+
+// (the preemption timer and interrupt-window exiting are turned on
+// and off as each call needs them, see 'vmx_prepare', 'event_inject')
+struct vmx_profile  vmx_profile[ N_CTLS ] = {
+	{ "pin-based", (1<<0)|(1<<3), 0 },	// interrupts, NMIs
+	{ "cpu-based", (1<<7), (1<<25)|(1<<28) },	// HLT; I/O, MSR bitmaps
+	{ "VM-exit", (1<<9), (1<<2) },		// 64-bit host; debug controls
+	{ "VM-entry", 0, (1<<2) },		// debug controls
+	};
+
+unsigned int	vmx_ctls[ N_CTLS ];		// each one's negotiated setting
+unsigned int	vmx_ctls_may[ N_CTLS ];		// its allowed-1 settings
+unsigned int	vmx_ctls_forced[ N_CTLS ];	// settings the cpu insists on
+int		vmx_true_ctls;			// (from the TRUE_xxx_CTLS MSRs)
+
+// returns nonzero if the cpu lacks any control that we require
+int vmx_negotiate( void )
+{
+	unsigned long long	caps;
+	unsigned int		asked, missing;
+	int			i, retval = 0;
+
+	vmx_true_ctls = ( msr0x480[ 0 ] >> 55 ) & 1;
+	for (i = 0; i < N_CTLS; i++)
+		{
+		caps = ( vmx_true_ctls ) ? read_msr( 0x48D + i ) : msr0x480[ 1 + i ];
+		asked = vmx_profile[ i ].required | vmx_profile[ i ].wanted;
+		vmx_ctls_may[ i ] = caps >> 32;
+		vmx_ctls_forced[ i ] = (unsigned int)caps & ~asked;
+		vmx_ctls[ i ] = (unsigned int)caps | ( asked & vmx_ctls_may[ i ] );
+
+		missing = vmx_profile[ i ].required & ~vmx_ctls_may[ i ];
+		if ( missing )
+			{
+			printk( " cpu lacks %s controls %08X \n", 
+						vmx_profile[ i ].name, missing );
+			retval = -ENODEV;
+			}
+		}
+	return	retval;
+}
+
+// the controls which make a guest exit, for reporting those forced on
+struct	{
+	int		ctls, bit;
+	char		*name;
+	} exiting[] = {	{ CTLS_PIN, 0, "external-interrupt" },
+			{ CTLS_PIN, 3, "NMI" },
+			{ CTLS_PIN, 6, "preemption-timer" },
+			{ CTLS_CPU, 2, "interrupt-window" },
+			{ CTLS_CPU, 7, "HLT" },
+			{ CTLS_CPU, 9, "INVLPG" },
+			{ CTLS_CPU, 10, "MWAIT" },
+			{ CTLS_CPU, 11, "RDPMC" },
+			{ CTLS_CPU, 12, "RDTSC" },
+			{ CTLS_CPU, 15, "CR3-load" },
+			{ CTLS_CPU, 16, "CR3-store" },
+			{ CTLS_CPU, 19, "CR8-load" },
+			{ CTLS_CPU, 20, "CR8-store" },
+			{ CTLS_CPU, 22, "NMI-window" },
+			{ CTLS_CPU, 23, "MOV-DR" },
+			{ CTLS_CPU, 24, "unconditional-I/O" },
+			{ CTLS_CPU, 27, "monitor-trap-flag" },
+			{ CTLS_CPU, 29, "MONITOR" },
+			{ CTLS_CPU, 30, "PAUSE" },
+		};
+
+#define N_EXITING	( sizeof( exiting ) / sizeof( exiting[0] ) )
+
 char *legend[] = {	"IA32_VMX_BASIC_MSR",		// 0x480
 			"IA32_VMX_PINBASED_CTLS_MSR",	// 0x481
 			"IA32_VMX_PROCBASED_CTLS_MSR",	// 0x482
@@ -171,7 +568,8 @@ char *legend[] = {	"IA32_VMX_BASIC_MSR",		// 0x480
 int my_info_caps( char *buf, char **start, off_t off, int count, 
 							int *eof, void *data )
 {
-	int	i, len = 0;
+	struct vmm_context	*ctx;
+	int	i, n, len = 0;
 
 	len += sprintf( buf+len, "\n\n\n " );
 	len += sprintf( buf+len, "VMX-Capability Model-Specific Registers" );
@@ -183,6 +581,30 @@ int my_info_caps( char *buf, char **start, off_t off, int count,
 		}
 	len += sprintf( buf+len, "\n" );
 
+	if ( vmx_supported )
+		{
+		len += sprintf( buf+len, "\n VMX controls, negotiated from " );
+		len += sprintf( buf+len, "the %s MSRs: \n\n", ( vmx_true_ctls ) ? 
+				"TRUE_xxx_CTLS" : "xxx_CTLS" );
+		for (i = 0; i < N_CTLS; i++)
+			{
+			len += sprintf( buf+len, "     %08X ", vmx_ctls[ i ] );
+			len += sprintf( buf+len, "= %s (forced on: %08X) \n",
+				vmx_profile[ i ].name, vmx_ctls_forced[ i ] );
+			}
+		len += sprintf( buf+len, "\n exits the cpu forces on:" );
+		n = 0;
+		for (i = 0; i < N_EXITING; i++)
+			if ( vmx_ctls_forced[ exiting[ i ].ctls ] & ( 1 << exiting[ i ].bit ) )
+				{
+				len += sprintf( buf+len, " %s", exiting[ i ].name );
+				++n;
+				}
+		if ( !n ) len += sprintf( buf+len, " none" );
+		len += sprintf( buf+len, " \n" );
+		}
+	else	len += sprintf( buf+len, "\n no VMX (our VMs run in software) \n" );
+
 	len += sprintf( buf+len, "\n" );
 	len += sprintf( buf+len, " original_CR0=%08lX ", original_CR0 );
 	len += sprintf( buf+len, " PG=%ld", (original_CR0 >> 31)&1 );
@@ -210,8 +632,12 @@ int my_info_caps( char *buf, char **start, off_t off, int count,
 	len += sprintf( buf+len, " VME=%ld", (original_CR4 >> 0)&1 );
 	len += sprintf( buf+len, "\n\n" );
 
-	len += sprintf( buf+len, "\n physical address of userspace: " );
-	len += sprintf( buf+len, "0x%08llX \n", lower_region );
+	if ( ( ctx = proc_context() ) )
+		{
+		len += sprintf( buf+len, "\n physical address of userspace: " );
+		len += sprintf( buf+len, "0x%08llX \n", ctx->lower_region );
+		mutex_unlock( &vmm_proc_lock );
+		}
 	len += sprintf( buf+len, "\n\n" );
 	return	len;
 }
@@ -220,31 +646,44 @@ int my_info_caps( char *buf, char **start, off_t off, int count,
 int my_info_mmap( char *buf, char **start, off_t off, int count,
 						int *eof, void *data )
 {
-	int	len = 0;
+	struct vmm_context	*ctx;
+	int	cpu, len = 0;
+
+	if ( !( ctx = proc_context() ) ) return proc_no_context( buf );
 
 	len += sprintf( buf+len, "\n\n\n " );
 	len += sprintf( buf+len, "Physical addresses for VM memory-regions" );
 	len += sprintf( buf+len, "\n\n " );
 
 	len += sprintf( buf+len, "\n" );
-	len += sprintf( buf+len, "\t lower_region=%08llX \n", lower_region );
-	len += sprintf( buf+len, "\t himem_region=%08llX \n", himem_region );
+	len += sprintf( buf+len, "\t lower_region=%08llX \n", ctx->lower_region );
+	len += sprintf( buf+len, "\t himem_region=%08llX \n", ctx->himem_region );
 	len += sprintf( buf+len, "\n" );
-	len += sprintf( buf+len, "\t vmxon_region=%08llX \n", vmxon_region );
-	len += sprintf( buf+len, "\t guest_region=%08llX \n", guest_region );
-	len += sprintf( buf+len, "\t pgdir_region=%08llX \n", pgdir_region );
-	len += sprintf( buf+len, "\t pgtbl_region=%08llX \n", pgtbl_region );
-	len += sprintf( buf+len, "\t iomap_region=%08llX \n", iomap_region );
-	len += sprintf( buf+len, "\t g_IDT_region=%08llX \n", g_IDT_region );
-	len += sprintf( buf+len, "\t g_GDT_region=%08llX \n", g_GDT_region );
-	len += sprintf( buf+len, "\t g_LDT_region=%08llX \n", g_LDT_region );
-	len += sprintf( buf+len, "\t g_TSS_region=%08llX \n", g_TSS_region );
-	len += sprintf( buf+len, "\t g_SS0_region=%08llX \n", g_SS0_region );
-	len += sprintf( buf+len, "\t g_ISR_region=%08llX \n", g_ISR_region );
-	len += sprintf( buf+len, "\t h_MSR_region=%08llX \n", h_MSR_region );
+	len += sprintf( buf+len, "\t guest_region=%08llX \n", ctx->guest_region );
+	len += sprintf( buf+len, "\t pgdir_region=%08llX \n", ctx->pgdir_region );
+	len += sprintf( buf+len, "\t pgtbl_region=%08llX \n", ctx->pgtbl_region );
+	len += sprintf( buf+len, "\t iomap_region=%08llX \n", ctx->iomap_region );
+	len += sprintf( buf+len, "\t msrbm_region=%08llX \n", ctx->msrbm_region );
+	len += sprintf( buf+len, "\t g_IDT_region=%08llX \n", ctx->g_IDT_region );
+	len += sprintf( buf+len, "\t g_GDT_region=%08llX \n", ctx->g_GDT_region );
+	len += sprintf( buf+len, "\t g_LDT_region=%08llX \n", ctx->g_LDT_region );
+	len += sprintf( buf+len, "\t g_TSS_region=%08llX \n", ctx->g_TSS_region );
+	len += sprintf( buf+len, "\t g_SS0_region=%08llX \n", ctx->g_SS0_region );
+	len += sprintf( buf+len, "\t g_ISR_region=%08llX \n", ctx->g_ISR_region );
+	len += sprintf( buf+len, "\t run_page=%08lX \n", virt_to_phys( ctx->runpage ) );
+	len += sprintf( buf+len, "\t ring_page=%08lX \n", virt_to_phys( ctx->ring ) );
 	len += sprintf( buf+len, "\n" );
 
+	for_each_online_cpu( cpu )
+		{
+		len += sprintf( buf+len, "\t vmxon_region=%08llX ", 
+						vmxon_region[ cpu ] );
+		len += sprintf( buf+len, "(cpu %d, node %d) \n", 
+						cpu, cpu_to_node( cpu ) );
+		}
+
 	len += sprintf( buf+len, "\n\n" );
+	mutex_unlock( &vmm_proc_lock );
 	return	len;
 }
 
@@ -252,250 +691,239 @@ int my_info_mmap( char *buf, char **start, off_t off, int count,
 int my_info_ctls( char *buf, char **start, off_t off, int count,
 							int *eof, void *data )
 {
+	struct vmm_context	*ctx;
+	VMCS_FIELDS		*f;
 	int	len = 0;
 
+	if ( !( ctx = proc_context() ) ) return proc_no_context( buf );
+	f = &ctx->vmcs;
+
 	len += sprintf( buf+len, "\n VMX Execution Controls \n\n" );
 
-	len += sprintf( buf+len, " 0x%08X ", control_VMX_pin_based );
+	len += sprintf( buf+len, " 0x%08X ", f->control_VMX_pin_based );
 	len += sprintf( buf+len, "= control_VMX_pin_based \n" );
 
-	len += sprintf( buf+len, " 0x%08X ", control_VMX_cpu_based );
+	len += sprintf( buf+len, " 0x%08X ", f->control_VMX_cpu_based );
 	len += sprintf( buf+len, "= control_VMX_cpu_based \n" );
 
-	len += sprintf( buf+len, " 0x%08X ", control_exception_bitmap );
+	len += sprintf( buf+len, " 0x%08X ", f->control_exception_bitmap );
 	len += sprintf( buf+len, "= control_exception_bitmap \n" );
 
-	len += sprintf( buf+len, " 0x%08X ", control_pagefault_errorcode_mask );
+	len += sprintf( buf+len, " 0x%08X ", f->control_pagefault_errorcode_mask );
 	len += sprintf( buf+len, "= control_pagefault_errorcode_mask \n" );
 
-	len += sprintf( buf+len, " 0x%08X ", control_pagefault_errorcode_match);
+	len += sprintf( buf+len, " 0x%08X ", f->control_pagefault_errorcode_match);
 	len += sprintf( buf+len, "= control_pagefault_errorcode_match \n" );
 
-	len += sprintf( buf+len, " 0x%08X ", control_CR3_target_count );
+	len += sprintf( buf+len, " 0x%08X ", f->control_CR3_target_count );
 	len += sprintf( buf+len, "= control_CR3_target_count \n" );
 
-	len += sprintf( buf+len, " 0x%08X ", control_VM_exit_controls );
+	len += sprintf( buf+len, " 0x%08X ", f->control_VM_exit_controls );
 	len += sprintf( buf+len, "= control_VM_exit_controls \n" );
 
-	len += sprintf( buf+len, " 0x%08X ", control_VM_entry_controls );
+	len += sprintf( buf+len, " 0x%08X ", f->control_VM_entry_controls );
 	len += sprintf( buf+len, "= control_VM_entry_controls \n" );
 
 	len += sprintf( buf+len, " 0x%08X ", 
-			control_VM_entry_interruption_information );
+			f->control_VM_entry_interruption_information );
 	len += sprintf( buf+len, 
 			"= control_VM_entry_interruption_information \n" );
 
 	len += sprintf( buf+len, " 0x%08X ", 
-			control_VM_entry_exception_errorcode );
+			f->control_VM_entry_exception_errorcode );
 	len += sprintf( buf+len, 
 			"= control_VM_entry_exception_errorcode \n" );
 
 	len += sprintf( buf+len, " 0x%08X ", 
-			control_VM_entry_instruction_length );
+			f->control_VM_entry_instruction_length );
 	len += sprintf( buf+len, 
 			"= control_VM_entry_instruction_length \n" );
 
 	len += sprintf( buf+len, "\n" );
 
-	len += sprintf( buf+len, " 0x%016llX ", control_CR0_mask );
+	len += sprintf( buf+len, " 0x%016llX ", f->control_CR0_mask );
 	len += sprintf( buf+len, "= control_CR0_mask \n" );
 
-	len += sprintf( buf+len, " 0x%016llX ", control_CR4_mask );
+	len += sprintf( buf+len, " 0x%016llX ", f->control_CR4_mask );
 	len += sprintf( buf+len, "= control_CR4_mask \n" );
 
-	len += sprintf( buf+len, " 0x%016llX ", control_CR0_shadow );
+	len += sprintf( buf+len, " 0x%016llX ", f->control_CR0_shadow );
 	len += sprintf( buf+len, "= control_CR0_shadow \n" );
 
-	len += sprintf( buf+len, " 0x%016llX ", control_CR4_shadow );
+	len += sprintf( buf+len, " 0x%016llX ", f->control_CR4_shadow );
 	len += sprintf( buf+len, "= control_CR4_shadow \n" );
 
-	len += sprintf( buf+len, " 0x%016llX ", control_CR3_target0 );
+	len += sprintf( buf+len, " 0x%016llX ", f->control_CR3_target0 );
 	len += sprintf( buf+len, "= control_CR3_target0 \n" );
 
-	len += sprintf( buf+len, " 0x%016llX ", control_CR3_target1 );
+	len += sprintf( buf+len, " 0x%016llX ", f->control_CR3_target1 );
 	len += sprintf( buf+len, "= control_CR3_target1 \n" );
 
-	len += sprintf( buf+len, " 0x%016llX ", control_CR3_target2 );
+	len += sprintf( buf+len, " 0x%016llX ", f->control_CR3_target2 );
 	len += sprintf( buf+len, "= control_CR3_target2 \n" );
 
-	len += sprintf( buf+len, " 0x%016llX ", control_CR3_target3 );
+	len += sprintf( buf+len, " 0x%016llX ", f->control_CR3_target3 );
 	len += sprintf( buf+len, "= control_CR3_target3 \n" );
 
 	len += sprintf( buf+len, "\n" );
+	mutex_unlock( &vmm_proc_lock );
 	return	len;
 }
 
 int my_info_host( char *buf, char **start, off_t off, int count,
 						int *eof, void *data )
 {
+	struct vmm_context	*ctx;
+	VMCS_FIELDS		*f;
 	int	len = 0;
 
+	if ( !( ctx = proc_context() ) ) return proc_no_context( buf );
+	f = &ctx->vmcs;
+
 	len += sprintf( buf+len, "\n\n\n\n\n VMX Host State \n\n" );
 
-	len += sprintf( buf+len, " CR0=%016llX ", host_CR0 );
-	len += sprintf( buf+len, " FS_base=%016llX ", host_FS_base );
-	len += sprintf( buf+len, " GDTR_base=%016llX ", host_GDTR_base );
+	len += sprintf( buf+len, " CR0=%016llX ", f->host_CR0 );
+	len += sprintf( buf+len, " FS_base=%016llX ", f->host_FS_base );
+	len += sprintf( buf+len, " GDTR_base=%016llX ", f->host_GDTR_base );
 	len += sprintf( buf+len, "\n" );
-	len += sprintf( buf+len, " CR3=%016llX ", host_CR3 );
-	len += sprintf( buf+len, " GS_base=%016llX ", host_GS_base );
-	len += sprintf( buf+len, " IDTR_base=%016llX ", host_IDTR_base );
+	len += sprintf( buf+len, " CR3=%016llX ", f->host_CR3 );
+	len += sprintf( buf+len, " GS_base=%016llX ", f->host_GS_base );
+	len += sprintf( buf+len, " IDTR_base=%016llX ", f->host_IDTR_base );
 	len += sprintf( buf+len, "\n" );
-	len += sprintf( buf+len, " CR4=%016llX ", host_CR4 );
-	len += sprintf( buf+len, " TR_base=%016llX ", host_TR_base );
-	len += sprintf( buf+len, " SYSENTER_CS=%08X ", host_SYSENTER_CS );
-	len += sprintf( buf+len, " TR=%04X ", host_TR_selector );
+	len += sprintf( buf+len, " CR4=%016llX ", f->host_CR4 );
+	len += sprintf( buf+len, " TR_base=%016llX ", f->host_TR_base );
+	len += sprintf( buf+len, " SYSENTER_CS=%08X ", f->host_SYSENTER_CS );
+	len += sprintf( buf+len, " TR=%04X ", f->host_TR_selector );
 	len += sprintf( buf+len, "\n" );
 
-	len += sprintf( buf+len, " RSP=%016llX ", host_RSP );
-	len += sprintf( buf+len, " SS=%04X ", host_SS_selector );
-	len += sprintf( buf+len, " DS=%04X ", host_DS_selector );
-	len += sprintf( buf+len, "FS=%04X ", host_FS_selector );
-	len += sprintf( buf+len, " SYSENTER_ESP=%016llX ", host_SYSENTER_ESP );
+	len += sprintf( buf+len, " RSP=%016llX ", f->host_RSP );
+	len += sprintf( buf+len, " SS=%04X ", f->host_SS_selector );
+	len += sprintf( buf+len, " DS=%04X ", f->host_DS_selector );
+	len += sprintf( buf+len, "FS=%04X ", f->host_FS_selector );
+	len += sprintf( buf+len, " SYSENTER_ESP=%016llX ", f->host_SYSENTER_ESP );
 	len += sprintf( buf+len, "\n" );
-	len += sprintf( buf+len, " RIP=%016llX ", host_RIP );
-	len += sprintf( buf+len, " CS=%04X ", host_CS_selector );
-	len += sprintf( buf+len, " ES=%04X ", host_ES_selector );
-	len += sprintf( buf+len, "GS=%04X ", host_GS_selector );
-	len += sprintf( buf+len, " SYSENTER_EIP=%016llX ", host_SYSENTER_EIP );
+	len += sprintf( buf+len, " RIP=%016llX ", f->host_RIP );
+	len += sprintf( buf+len, " CS=%04X ", f->host_CS_selector );
+	len += sprintf( buf+len, " ES=%04X ", f->host_ES_selector );
+	len += sprintf( buf+len, "GS=%04X ", f->host_GS_selector );
+	len += sprintf( buf+len, " SYSENTER_EIP=%016llX ", f->host_SYSENTER_EIP );
 	len += sprintf( buf+len, "\n" );
 
 	len += sprintf( buf+len, "\n\n" );
 	len += sprintf( buf+len, " control_VM_exit_MSR_load_count =" );
-	len += sprintf( buf+len, " %d \n\n", control_VM_exit_MSR_load_count );
-
-	msr_index = MSR_STAR;
-	asm(	" mov	msr_index, %%rcx	\n"\
-	 	" rdmsr				\n"\
-		" mov	%%eax, msr_value+0	\n"\
-		" mov	%%edx, msr_value+4	\n"\
-		::: "ax", "cx", "dx" );
-	len += sprintf( buf+len, "    %016lX = MSR_STAR \n", msr_value ); 
-
-	msr_index = MSR_CSTAR;
-	asm(	" mov	msr_index, %%rcx	\n"\
-	 	" rdmsr				\n"\
-		" mov	%%eax, msr_value+0	\n"\
-		" mov	%%edx, msr_value+4	\n"\
-		::: "ax", "cx", "dx" );
-	len += sprintf( buf+len, "    %016lX = MSR_CSTAR \n", msr_value ); 
-
-	msr_index = MSR_LSTAR;
-	asm(	" mov	msr_index, %%rcx	\n"\
-	 	" rdmsr				\n"\
-		" mov	%%eax, msr_value+0	\n"\
-		" mov	%%edx, msr_value+4	\n"\
-		::: "ax", "cx", "dx" );
-	len += sprintf( buf+len, "    %016lX = MSR_LSTAR \n", msr_value ); 
-
-	msr_index = MSR_SYSCALL_MASK;
-	asm(	" mov	msr_index, %%rcx	\n"\
-	 	" rdmsr				\n"\
-		" mov	%%eax, msr_value+0	\n"\
-		" mov	%%edx, msr_value+4	\n"\
-		::: "ax", "cx", "dx" );
-	len += sprintf( buf+len, "    %016lX = MSR_SYSCALL_MASK \n", 
-								msr_value ); 
-	msr_index = MSR_KERNEL_GS_BASE;
-	asm(	" mov	msr_index, %%rcx	\n"\
-	 	" rdmsr				\n"\
-		" mov	%%eax, msr_value+0	\n"\
-		" mov	%%edx, msr_value+4	\n"\
-		::: "ax", "cx", "dx" );
-	len += sprintf( buf+len, "    %016lX = MSR_KERNEL_GS_BASE \n", 
-								msr_value ); 
+	len += sprintf( buf+len, " %d \n\n", f->control_VM_exit_MSR_load_count );
+
+	// (these are the MSR values for the cpu we're running on)
+	len += sprintf( buf+len, "    %016llX = MSR_STAR \n", 
+							read_msr( MSR_STAR ) ); 
+	len += sprintf( buf+len, "    %016llX = MSR_CSTAR \n", 
+							read_msr( MSR_CSTAR ) ); 
+	len += sprintf( buf+len, "    %016llX = MSR_LSTAR \n", 
+							read_msr( MSR_LSTAR ) ); 
+	len += sprintf( buf+len, "    %016llX = MSR_SYSCALL_MASK \n", 
+						read_msr( MSR_SYSCALL_MASK ) ); 
+	len += sprintf( buf+len, "    %016llX = MSR_KERNEL_GS_BASE \n", 
+						read_msr( MSR_KERNEL_GS_BASE ) ); 
 	len += sprintf( buf+len, "\n\n\n" );
+	mutex_unlock( &vmm_proc_lock );
 	return	len;
 }
 
 int my_info_task( char *buf, char **start, off_t off, int count, 
 							int *eof, void *data )
 {
+	struct vmm_context	*ctx;
+	VMCS_FIELDS		*f;
 	int	len = 0;
 
+	if ( !( ctx = proc_context() ) ) return proc_no_context( buf );
+	f = &ctx->vmcs;
+
 	len += sprintf( buf+len, "\n\n VMX Guest State \n\n" );
 
-	len += sprintf( buf+len, " CR0=%016llX ", guest_CR0 );
-	len += sprintf( buf+len, " CR3=%016llX ", guest_CR3 );
-	len += sprintf( buf+len, " CR4=%016llX ", guest_CR4 );
+	len += sprintf( buf+len, " CR0=%016llX ", f->guest_CR0 );
+	len += sprintf( buf+len, " CR3=%016llX ", f->guest_CR3 );
+	len += sprintf( buf+len, " CR4=%016llX ", f->guest_CR4 );
 	len += sprintf( buf+len, "\n" );
 
 	len += sprintf( buf+len, "\n" );
-	len += sprintf( buf+len, " RSP=%016llX ", guest_RSP );
-	len += sprintf( buf+len, " SYSENTER_ESP=%016llX ", host_SYSENTER_ESP );
+	len += sprintf( buf+len, " RSP=%016llX ", f->guest_RSP );
+	len += sprintf( buf+len, " SYSENTER_ESP=%016llX ", f->host_SYSENTER_ESP );
 	len += sprintf( buf+len, "\n" );
-	len += sprintf( buf+len, " RIP=%016llX ", guest_RIP );
-	len += sprintf( buf+len, " SYSENTER_EIP=%016llX ", guest_SYSENTER_EIP );
+	len += sprintf( buf+len, " RIP=%016llX ", f->guest_RIP );
+	len += sprintf( buf+len, " SYSENTER_EIP=%016llX ", f->guest_SYSENTER_EIP );
 	len += sprintf( buf+len, "\n" );
 
-	len += sprintf( buf+len, " DR7=%016llX ", guest_DR7 );
-	len += sprintf( buf+len, " SYSENTER_CS=%08X ", guest_SYSENTER_CS );
-	len += sprintf( buf+len, " RFLAGS=%016llX ", guest_RFLAGS );
+	len += sprintf( buf+len, " DR7=%016llX ", f->guest_DR7 );
+	len += sprintf( buf+len, " SYSENTER_CS=%08X ", f->guest_SYSENTER_CS );
+	len += sprintf( buf+len, " RFLAGS=%016llX ", f->guest_RFLAGS );
 	len += sprintf( buf+len, "\n" );
 
-	len += sprintf( buf+len, "\n   ES=%04X ", guest_ES_selector );
-	len += sprintf( buf+len, " [ base=%016llX", guest_ES_base );
-	len += sprintf( buf+len, " limit=%08X", guest_ES_limit );
-	len += sprintf( buf+len, " rights=%08X ] ", guest_ES_access_rights );
-
-	len += sprintf( buf+len, "\n   CS=%04X ", guest_CS_selector );
-	len += sprintf( buf+len, " [ base=%016llX", guest_CS_base );
-	len += sprintf( buf+len, " limit=%08X", guest_CS_limit );
-	len += sprintf( buf+len, " rights=%08X ] ", guest_CS_access_rights );
-
-	len += sprintf( buf+len, "\n   SS=%04X ", guest_SS_selector );
-	len += sprintf( buf+len, " [ base=%016llX", guest_SS_base );
-	len += sprintf( buf+len, " limit=%08X", guest_SS_limit );
-	len += sprintf( buf+len, " rights=%08X ] ", guest_SS_access_rights );
-
-	len += sprintf( buf+len, "\n   DS=%04X ", guest_DS_selector );
-	len += sprintf( buf+len, " [ base=%016llX", guest_DS_base );
-	len += sprintf( buf+len, " limit=%08X", guest_DS_limit );
-	len += sprintf( buf+len, " rights=%08X ] ", guest_DS_access_rights );
-
-	len += sprintf( buf+len, "\n   FS=%04X ", guest_FS_selector );
-	len += sprintf( buf+len, " [ base=%016llX", guest_FS_base );
-	len += sprintf( buf+len, " limit=%08X", guest_FS_limit );
-	len += sprintf( buf+len, " rights=%08X ] ", guest_FS_access_rights );
-
-	len += sprintf( buf+len, "\n   GS=%04X ", guest_GS_selector );
-	len += sprintf( buf+len, " [ base=%016llX", guest_GS_base );
-	len += sprintf( buf+len, " limit=%08X", guest_GS_limit );
-	len += sprintf( buf+len, " rights=%08X ] ", guest_GS_access_rights );
-
-	len += sprintf( buf+len, "\n LDTR=%04X ", guest_LDTR_selector );
-	len += sprintf( buf+len, " [ base=%016llX", guest_LDTR_base );
-	len += sprintf( buf+len, " limit=%08X", guest_LDTR_limit );
-	len += sprintf( buf+len, " rights=%08X ] ", guest_LDTR_access_rights );
-
-	len += sprintf( buf+len, "\n   TR=%04X ", guest_TR_selector );
-	len += sprintf( buf+len, " [ base=%016llX", guest_TR_base );
-	len += sprintf( buf+len, " limit=%08X", guest_TR_limit );
-	len += sprintf( buf+len, " rights=%08X ] ", guest_TR_access_rights );
+	len += sprintf( buf+len, "\n   ES=%04X ", f->guest_ES_selector );
+	len += sprintf( buf+len, " [ base=%016llX", f->guest_ES_base );
+	len += sprintf( buf+len, " limit=%08X", f->guest_ES_limit );
+	len += sprintf( buf+len, " rights=%08X ] ", f->guest_ES_access_rights );
+
+	len += sprintf( buf+len, "\n   CS=%04X ", f->guest_CS_selector );
+	len += sprintf( buf+len, " [ base=%016llX", f->guest_CS_base );
+	len += sprintf( buf+len, " limit=%08X", f->guest_CS_limit );
+	len += sprintf( buf+len, " rights=%08X ] ", f->guest_CS_access_rights );
+
+	len += sprintf( buf+len, "\n   SS=%04X ", f->guest_SS_selector );
+	len += sprintf( buf+len, " [ base=%016llX", f->guest_SS_base );
+	len += sprintf( buf+len, " limit=%08X", f->guest_SS_limit );
+	len += sprintf( buf+len, " rights=%08X ] ", f->guest_SS_access_rights );
+
+	len += sprintf( buf+len, "\n   DS=%04X ", f->guest_DS_selector );
+	len += sprintf( buf+len, " [ base=%016llX", f->guest_DS_base );
+	len += sprintf( buf+len, " limit=%08X", f->guest_DS_limit );
+	len += sprintf( buf+len, " rights=%08X ] ", f->guest_DS_access_rights );
+
+	len += sprintf( buf+len, "\n   FS=%04X ", f->guest_FS_selector );
+	len += sprintf( buf+len, " [ base=%016llX", f->guest_FS_base );
+	len += sprintf( buf+len, " limit=%08X", f->guest_FS_limit );
+	len += sprintf( buf+len, " rights=%08X ] ", f->guest_FS_access_rights );
+
+	len += sprintf( buf+len, "\n   GS=%04X ", f->guest_GS_selector );
+	len += sprintf( buf+len, " [ base=%016llX", f->guest_GS_base );
+	len += sprintf( buf+len, " limit=%08X", f->guest_GS_limit );
+	len += sprintf( buf+len, " rights=%08X ] ", f->guest_GS_access_rights );
+
+	len += sprintf( buf+len, "\n LDTR=%04X ", f->guest_LDTR_selector );
+	len += sprintf( buf+len, " [ base=%016llX", f->guest_LDTR_base );
+	len += sprintf( buf+len, " limit=%08X", f->guest_LDTR_limit );
+	len += sprintf( buf+len, " rights=%08X ] ", f->guest_LDTR_access_rights );
+
+	len += sprintf( buf+len, "\n   TR=%04X ", f->guest_TR_selector );
+	len += sprintf( buf+len, " [ base=%016llX", f->guest_TR_base );
+	len += sprintf( buf+len, " limit=%08X", f->guest_TR_limit );
+	len += sprintf( buf+len, " rights=%08X ] ", f->guest_TR_access_rights );
 
 	len += sprintf( buf+len, "\n      GDTR " );
-	len += sprintf( buf+len, " [ base=%016llX", guest_GDTR_base );
-	len += sprintf( buf+len, " limit=%08X ] ", guest_GDTR_limit );
+	len += sprintf( buf+len, " [ base=%016llX", f->guest_GDTR_base );
+	len += sprintf( buf+len, " limit=%08X ] ", f->guest_GDTR_limit );
 
 	len += sprintf( buf+len, "\n      IDTR " );
-	len += sprintf( buf+len, " [ base=%016llX", guest_IDTR_base );
-	len += sprintf( buf+len, " limit=%08X ] ", guest_IDTR_limit );
+	len += sprintf( buf+len, " [ base=%016llX", f->guest_IDTR_base );
+	len += sprintf( buf+len, " limit=%08X ] ", f->guest_IDTR_limit );
 	len += sprintf( buf+len, "\n" );
 	
 	len += sprintf( buf+len, "\n" );
-	len += sprintf( buf+len, " EAX=%08lX ", guest_RAX );
-	len += sprintf( buf+len, " ECX=%08lX ", guest_RCX );
-	len += sprintf( buf+len, " ESI=%08lX ", guest_RSI );
-	len += sprintf( buf+len, " ESP=%08llX ", guest_RSP );
-	len += sprintf( buf+len, "  extints=%d ", extints );
+	len += sprintf( buf+len, " EAX=%08lX ", ctx->gpr[ GPR_RAX ] );
+	len += sprintf( buf+len, " ECX=%08lX ", ctx->gpr[ GPR_RCX ] );
+	len += sprintf( buf+len, " ESI=%08lX ", ctx->gpr[ GPR_RSI ] );
+	len += sprintf( buf+len, " ESP=%08llX ", f->guest_RSP );
+	len += sprintf( buf+len, "  extints=%d ", ctx->extints );
 	len += sprintf( buf+len, "\n" );
-	len += sprintf( buf+len, " EBX=%08lX ", guest_RBX );
-	len += sprintf( buf+len, " EDX=%08lX ", guest_RDX );
-	len += sprintf( buf+len, " EDI=%08lX ", guest_RDI );
-	len += sprintf( buf+len, " EBP=%08lX ", guest_RBP );
-	len += sprintf( buf+len, "  nmiints=%d ", nmiints );
+	len += sprintf( buf+len, " EBX=%08lX ", ctx->gpr[ GPR_RBX ] );
+	len += sprintf( buf+len, " EDX=%08lX ", ctx->gpr[ GPR_RDX ] );
+	len += sprintf( buf+len, " EDI=%08lX ", ctx->gpr[ GPR_RDI ] );
+	len += sprintf( buf+len, " EBP=%08lX ", ctx->gpr[ GPR_RBP ] );
+	len += sprintf( buf+len, "  nmiints=%d ", ctx->nmiints );
 	len += sprintf( buf+len, "\n" );
 
 	len += sprintf( buf+len, "\n" );
+	mutex_unlock( &vmm_proc_lock );
 	return	len;
 }
 
@@ -572,782 +1000,3111 @@ char *exit_reason[] = {	"Exception or Non-Maskable Interrupt",	// 0
 			"VM-entry failure - machine check",	// 41
 			"---",					// 42
 			"TPR below threshold",			// 43
+			"APIC access",				// 44
+			"---",					// 45
+			"GDTR or IDTR access",			// 46
+			"LDTR or TR access",			// 47
+			"EPT violation",			// 48
+			"EPT misconfiguration",			// 49
+			"INVEPT-instruction encountered",	// 50
+			"RDTSCP-instruction encountered",	// 51
+			"VMX-preemption timer expired",		// 52
+			};
+
+#define N_EXIT_NAMES	( sizeof( exit_reason ) / sizeof( char * ) )
+#define N_ERROR_NAMES	( sizeof( error_cause ) / sizeof( char * ) )
+
+//----------------------------------------------------------------
+// Bitmaps of the 'results[]' entries (see 'machine.h') that need
+// to be read right after a VM exit, according to its exit-reason;
+// other entries are fetched only if someone later asks for them
+//----------------------------------------------------------------
+#define RD_GUEST	0x000007FF	// RSP, RIP, RFLAGS, selectors
+#define RD_ERROR	0x00000800	// VM-instruction error
+#define RD_REASON	0x00001000	// VM-exit reason
+#define RD_INTR		0x00002000	// VM-exit interruption info
+#define RD_INTR_ERR	0x00004000	// VM-exit interruption error
+#define RD_IDT_VEC	0x00018000	// IDT-vectoring info and error
+#define RD_INSN_LEN	0x00020000	// VM-exit instruction length
+#define RD_INSN_INFO	0x00040000	// VMX instruction information
+#define RD_QUAL		0x00080000	// exit qualification
+#define RD_IO		0x00F00000	// I/O RCX, RSI, RDI and RIP
+#define RD_LINEAR	0x01000000	// guest linear address
+#define RD_EXIT_ALL	0x01FFF800	// all of the read-only fields
+#define RD_ALL		0x01FFFFFF	// every entry in 'results[]'
+
+#define RD_VMXINSN	( RD_QUAL | RD_INSN_LEN | RD_INSN_INFO )
+
+unsigned int exit_read_mask[] = {
+			RD_INTR | RD_INTR_ERR | RD_IDT_VEC | RD_QUAL,	// 0
+			RD_INTR,					// 1
+			RD_IDT_VEC,					// 2
+			0,						// 3
+			RD_QUAL,					// 4
+			RD_QUAL,					// 5
+			0,						// 6
+			0,						// 7
+			0,						// 8
+			RD_QUAL | RD_IDT_VEC | RD_INSN_LEN,		// 9
+			RD_INSN_LEN,					// 10
+			RD_EXIT_ALL,					// 11
+			RD_INSN_LEN,					// 12
+			RD_INSN_LEN,					// 13
+			RD_QUAL | RD_INSN_LEN,				// 14
+			RD_INSN_LEN,					// 15
+			RD_INSN_LEN,					// 16
+			RD_INSN_LEN,					// 17
+			RD_INSN_LEN,					// 18
+			RD_VMXINSN,					// 19
+			RD_VMXINSN,					// 20
+			RD_VMXINSN,					// 21
+			RD_VMXINSN,					// 22
+			RD_VMXINSN,					// 23
+			RD_VMXINSN,					// 24
+			RD_VMXINSN,					// 25
+			RD_VMXINSN,					// 26
+			RD_VMXINSN,					// 27
+			RD_QUAL | RD_INSN_LEN,				// 28
+			RD_QUAL | RD_INSN_LEN,				// 29
+			RD_QUAL | RD_INSN_LEN | RD_IO | RD_LINEAR,	// 30
+			RD_INSN_LEN,					// 31
+			RD_INSN_LEN,					// 32
+			RD_QUAL,					// 33
+			RD_QUAL,					// 34
+			RD_EXIT_ALL,					// 35
+			RD_INSN_LEN,					// 36
+			RD_EXIT_ALL,					// 37
+			RD_EXIT_ALL,					// 38
+			RD_INSN_LEN,					// 39
+			RD_INSN_LEN,					// 40
+			RD_EXIT_ALL,					// 41
+			RD_EXIT_ALL,					// 42
+			0,						// 43
+			RD_EXIT_ALL,					// 44
+			RD_EXIT_ALL,					// 45
+			RD_EXIT_ALL,					// 46
+			RD_EXIT_ALL,					// 47
+			RD_EXIT_ALL,					// 48
+			RD_EXIT_ALL,					// 49
+			RD_EXIT_ALL,					// 50
+			RD_EXIT_ALL,					// 51
+			0,						// 52
 			};
 
+#define N_REASONS	( sizeof( exit_read_mask ) / sizeof( unsigned int ) )
+
+void vmcs_read_results( struct vmm_context *ctx, unsigned int mask )
+{
+	unsigned long	value;
+	int		i;
+
+	mask &= ~ctx->results_valid;
+	for (i = 0; i < rocount; i++)
+		{
+		if ( ( mask & (1 << i) ) == 0 ) continue;
+		asm volatile( " vmread %1, %0 " : "=rm" (value) 
+				: "r" ((unsigned long)results[ i ].encoding) 
+				: "cc" );
+		vmcs_store( &ctx->vmcs, &results[ i ], value );
+		}
+	ctx->results_valid |= mask;
+}
+
+//----------------------------------------------------------------
+// This is called after each VM exit (once the guest's general
+// registers are saved), with this context's VMCS current here
+//----------------------------------------------------------------
+void vmx_read_exit( struct vmm_context *ctx )
+{
+	unsigned short	reason;
+
+	ctx->results_valid = 0;
+	vmcs_read_results( ctx, RD_REASON );
+	reason = (unsigned short)ctx->vmcs.info_vmexit_reason;
+	if ( reason < N_REASONS ) 
+		vmcs_read_results( ctx, exit_read_mask[ reason ] );
+	else	vmcs_read_results( ctx, RD_EXIT_ALL );
+}
+
+void vmx_fetch_results( void *info )
+{
+	struct vmm_context	*ctx = info;
+
+	if ( vmx_current[ smp_processor_id() ] == ctx ) 
+		vmcs_read_results( ctx, RD_ALL );
+}
+
+//----------------------------------------------------------------
+// Fetch any 'results[]' entries that our exit-code skipped, from
+// the cpu where this VMCS is current (a VMCS that is no longer
+// current had all its entries read when it was displaced)
+//----------------------------------------------------------------
+void vmx_fetch_lazy( struct vmm_context *ctx )
+{
+	int	cpu = get_cpu();
+
+	if ( ctx->cpu == cpu ) vmx_fetch_results( ctx );
+	else if ( ctx->cpu >= 0 )
+		smp_call_function_single( ctx->cpu, vmx_fetch_results, ctx, 1, 1 );
+	put_cpu();
+}
+
 
 int my_info_read( char *buf, char **start, off_t off, int count,
 						int *eof, void *data )
 {
+	struct vmm_context	*ctx;
+	VMCS_FIELDS		*f;
 	int	len = 0;
 
+	if ( !( ctx = proc_context() ) ) return proc_no_context( buf );
+	f = &ctx->vmcs;
+
+	// (unless that VM is busy running)
+	if ( mutex_trylock( &ctx->lock ) )
+		{
+		vmx_fetch_lazy( ctx );
+		mutex_unlock( &ctx->lock );
+		}
+
 	len += sprintf( buf+len, "\n\n VMX Read-Only Fields \n\n" );
 
 	len += sprintf( buf+len, "        " );
-	len += sprintf( buf+len, " 0x%08X ", info_vminstr_error );
+	len += sprintf( buf+len, " 0x%08X ", f->info_vminstr_error );
 	len += sprintf( buf+len, "= VM_instruction_error \n" );
 
 	len += sprintf( buf+len, "        " );
-	len += sprintf( buf+len, " 0x%08X ", info_vmexit_reason );
+	len += sprintf( buf+len, " 0x%08X ", f->info_vmexit_reason );
 	len += sprintf( buf+len, "= VM_Exit_Reason \n" );
 
 	len += sprintf( buf+len, "\n" );
 
-	if ( info_vminstr_error )
+	if ( f->info_vminstr_error >= N_ERROR_NAMES )
+		len += sprintf( buf+len, "     unknown error %d  ",
+					f->info_vminstr_error );
+	else if ( f->info_vminstr_error )
 		len += sprintf( buf+len, "     %s  ",
-			error_cause[ (unsigned short)info_vminstr_error ] );	
+			error_cause[ (unsigned short)f->info_vminstr_error ] );	
 	else
 	{
-	if ( info_vmexit_reason & (1<<31) )
+	if ( f->info_vmexit_reason & (1<<31) )
 		len += sprintf( buf+len, "VM-Entry Failure " );
-	if ( info_vmexit_reason & (1<<29) )
+	if ( f->info_vmexit_reason & (1<<29) )
 		len += sprintf( buf+len, "VM-Exit from VMX root operation " );
-	len += sprintf( buf+len, " %s  ", 
-			exit_reason[ (unsigned short)info_vmexit_reason ] );	
+	if ( (unsigned short)f->info_vmexit_reason < N_EXIT_NAMES )
+		len += sprintf( buf+len, " %s  ", 
+			exit_reason[ (unsigned short)f->info_vmexit_reason ] );	
+	else	len += sprintf( buf+len, " unknown reason %d  ",
+				(unsigned short)f->info_vmexit_reason );
 	}
 	len += sprintf( buf+len, "\n\n" );
 	
 
 	len += sprintf( buf+len, "\n" );
 	len += sprintf( buf+len, "        " );
-	len += sprintf( buf+len, " 0x%08X ", info_vmexit_interrupt_information);
+	len += sprintf( buf+len, " 0x%08X ", f->info_vmexit_interrupt_information);
 	len += sprintf( buf+len, "= VM_Exit_Interrupt_Information \n" );
 
 	len += sprintf( buf+len, "        " );
-	len += sprintf( buf+len, " 0x%08X ", info_vmexit_interrupt_error_code);
+	len += sprintf( buf+len, " 0x%08X ", f->info_vmexit_interrupt_error_code);
 	len += sprintf( buf+len, "= VM_Exit_Interrupt_Error_Code \n" );
 
 	len += sprintf( buf+len, "        " );
-	len += sprintf( buf+len, " 0x%08X ", info_IDT_vectoring_information );
+	len += sprintf( buf+len, " 0x%08X ", f->info_IDT_vectoring_information );
 	len += sprintf( buf+len, "= VM_IDT_vectoring_information \n" );
 
 	len += sprintf( buf+len, "        " );
-	len += sprintf( buf+len, " 0x%08X ", info_IDT_vectoring_error_code  );
+	len += sprintf( buf+len, " 0x%08X ", f->info_IDT_vectoring_error_code  );
 	len += sprintf( buf+len, "= VM_IDT_vectoring_error_code \n" );
 
 	len += sprintf( buf+len, "        " );
-	len += sprintf( buf+len, " 0x%08X ", info_vmexit_instruction_length );
+	len += sprintf( buf+len, " 0x%08X ", f->info_vmexit_instruction_length );
 	len += sprintf( buf+len, "= VM_Exit_instruction_length \n" );
 
 	len += sprintf( buf+len, "        " );
-	len += sprintf( buf+len, " 0x%08X ", info_vmx_instruction_information);
+	len += sprintf( buf+len, " 0x%08X ", f->info_vmx_instruction_information);
 	len += sprintf( buf+len, "= VMX_instruction_information \n" );
 
 	len += sprintf( buf+len, "\n" );
 
-	len += sprintf( buf+len, " 0x%016llX ", info_exit_qualification );
+	len += sprintf( buf+len, " 0x%016llX ", f->info_exit_qualification );
 	len += sprintf( buf+len, "= Exit_Qualification \n" );
 
-	len += sprintf( buf+len, " 0x%016llX ", info_IO_RCX );
+	len += sprintf( buf+len, " 0x%016llX ", f->info_IO_RCX );
 	len += sprintf( buf+len, "= IO_RCX \n" );
 
-	len += sprintf( buf+len, " 0x%016llX ", info_IO_RSI );
+	len += sprintf( buf+len, " 0x%016llX ", f->info_IO_RSI );
 	len += sprintf( buf+len, "= IO_RSI \n" );
 
-	len += sprintf( buf+len, " 0x%016llX ", info_IO_RDI );
+	len += sprintf( buf+len, " 0x%016llX ", f->info_IO_RDI );
 	len += sprintf( buf+len, "= IO_RDI \n" );
 
-	len += sprintf( buf+len, " 0x%016llX ", info_IO_RIP );
+	len += sprintf( buf+len, " 0x%016llX ", f->info_IO_RIP );
 	len += sprintf( buf+len, "= IO_RIP \n" );
 
-	len += sprintf( buf+len, " 0x%016llX ", info_guest_linear_address );
+	len += sprintf( buf+len, " 0x%016llX ", f->info_guest_linear_address );
 	len += sprintf( buf+len, "= Guest_linear_address \n" );
 
 	len += sprintf( buf+len, "\n" );
+	mutex_unlock( &vmm_proc_lock );
 	return	len;
 }
 
 
-void set_CR4_vmxe( void *dummy )
-{
-	asm(	" mov  %%cr4, %%rax	\n"\
-		" bts  $13, %%rax	\n"\
-		" mov  %%rax, %%cr4	" ::: "ax" );
-}
-		
-void clear_CR4_vmxe( void *dummy )
+int my_info_stat( char *buf, char **start, off_t off, int count,
+						int *eof, void *data )
 {
-	asm(	" mov  %%cr4, %%rax	\n"\
-		" btr  $13, %%rax	\n"\
-		" mov  %%rax, %%cr4	" ::: "ax" );
-}
+	struct vmm_context	*ctx;
+	unsigned long	avg = 0;
+	int		len = 0;
 
+	if ( !( ctx = proc_context() ) ) return proc_no_context( buf );
+	if ( ctx->entries ) avg = ( ctx->writes_total * 100 ) / ctx->entries;
 
-static int __init newvmm32_init( void )
-{
+	len += sprintf( buf+len, "\n\n VMX Entry Statistics \n\n" );
 
-	// confirm module installation and show device-major number
-	printk( "<1>\nInstalling \'%s\' module ", modname );
-	printk( "(major=%d) \n", my_major );
+	len += sprintf( buf+len, " %12lu ", ctx->entries );
+	len += sprintf( buf+len, "= VM entries (launch or resume) \n" );
 
-	// verify cpu support for Intel Virtualization Technology
-	asm(	" xor	%%eax, %%eax		\n"\
-		" cpuid				\n"\
-		" mov	%%ebx, cpu_oem+0	\n"\
-		" mov	%%edx, cpu_oem+4	\n"\
-		" mov	%%ecx, cpu_oem+8	\n"\
-		::: "ax", "bx", "cx", "dx" );
-	printk( " processor is \'%s\' \n", cpu_oem );
+	len += sprintf( buf+len, " %12lu ", ctx->writes_total );
+	len += sprintf( buf+len, "= VMWRITEs issued since this VM was opened \n" );
 
-	if ( strncmp( cpu_oem, "GenuineIntel", 12 ) == 0 )
-		asm(	" mov	$1, %%eax		\n"\
-			" cpuid				\n"\
-			" mov	%%ecx, cpu_features	\n"\
-			::: "ax", "bx", "cx", "dx" );
-	if ( ( cpu_features & (1<<5) ) == 0 )
-		{
-		printk( " Virtualization Technology is unsupported \n" );
-		return	-ENODEV;
-		}
-	else	printk( " Virtualization Technology is supported \n" );
+	len += sprintf( buf+len, " %12lu ", ctx->writes_latest );
+	len += sprintf( buf+len, "= VMWRITEs before latest ioctl's entry \n" );
 
-	// read contents of the VMX-Capability Model-Specific Registers
-	asm(	" xor	%%rbx, %%rbx			\n"\
-		" mov	%0, %%rcx			\n"\
-		"nxcap:					\n"\
-		" rdmsr					\n"\
-		" mov	%%eax, msr0x480+0(, %%rbx, 8 )	\n"\
-		" mov	%%edx, msr0x480+4(, %%rbx, 8 )	\n"\
-		" inc	%%rcx				\n"\
-		" inc	%%rbx				\n"\
-		" cmp	$11, %%rbx			\n"\
-		" jb	nxcap				\n"\
-		:: "i" (MSR_VMX_CAPS) : "ax", "bx", "cx", "dx" );
+	len += sprintf( buf+len, " %9lu.%02lu ", avg / 100, avg % 100 );
+	len += sprintf( buf+len, "= VMWRITEs per VM entry \n" );
 
-	// preserve original contents of Control Registers CR0, CR4
-	asm(" mov %%cr0, %%rax \n mov %%rax, original_CR0 " ::: "ax" );
-	asm(" mov %%cr4, %%rax \n mov %%rax, original_CR4 " ::: "ax" );
+	len += sprintf( buf+len, "\n" );
+	if ( ctx->budget )
+		{
+		len += sprintf( buf+len, " budget of %llu cycles per call ", 
+								ctx->budget );
+		if ( vmx_ctls_may[ CTLS_PIN ] & (1<<6) )
+			len += sprintf( buf+len, "(VMX-preemption timer) \n" );
+		else	len += sprintf( buf+len, "(checked at VM exits) \n" );
+		}
+	else	len += sprintf( buf+len, " no budget per call \n" );
+	len += sprintf( buf+len, " %12lu ", ctx->expired );
+	len += sprintf( buf+len, "= calls stopped when their budget ran out \n" );
 
-	// preserve original contents of Extended Feature Control Register
-	asm(	" mov	%0, %%ecx			\n"\
-		" rdmsr					\n"\
-		" mov	%%eax, efcr+0			\n"\
-		" mov	%%edx, efcr+4			\n"\
-		:: "i" (EFCR_MSR) : "ax", "cx", "dx" );
+	len += sprintf( buf+len, "\n" );
+	len += sprintf( buf+len, " %12llu ", ctx->eventlog.delivered );
+	len += sprintf( buf+len, "= events injected " );
+	if ( ctx->eventlog.delivered )
+		len += sprintf( buf+len, "(average %llu, longest %llu cycles) ", 
+			ctx->event_cycles / ctx->eventlog.delivered, 
+			ctx->event_cycles_max );
+	len += sprintf( buf+len, "\n %12u = events still queued \n",
+				ctx->event_tail - ctx->event_head );
+	len += sprintf( buf+len, " %12lu = events dropped (guest's stack "
+				"couldn't take them) \n", ctx->events_dropped );
 
-	// preserve original contents of Extended Feature Enable Register
-	asm(	" mov	%0, %%ecx			\n"\
-		" rdmsr					\n"\
-		" mov	%%eax, efer+0			\n"\
-		" mov	%%edx, efer+4			\n"\
-		:: "i" (EFER_MSR) : "ax", "cx", "dx" );
+	len += sprintf( buf+len, "\n" );
+	if ( ctx->vpic_on )
+		{
+		len += sprintf( buf+len, " virtual timer: count %u, ",
+							ctx->vpic.reload );
+		len += sprintf( buf+len, "IRQ0 at vector 0x%02X%s \n",
+			ctx->vpic.base, ( ctx->vpic.imr & 1 ) ? " (masked)" : "" );
+		}
+	else	len += sprintf( buf+len, " no virtual timer \n" );
+	len += sprintf( buf+len, " %12llu ", ctx->vpic.ticks );
+	len += sprintf( buf+len, "= timer-ticks taken by the guest \n" );
+	len += sprintf( buf+len, " %12llu ", ctx->vpic.merged );
+	len += sprintf( buf+len, "= timer-ticks merged into another \n" );
+	len += sprintf( buf+len, " %12lu ", ctx->idles );
+	len += sprintf( buf+len, "= HLTs which idled the guest " );
+	if ( ctx->idles )
+		len += sprintf( buf+len, "(average %llu cycles asleep) ",
+					ctx->idle_cycles / ctx->idles );
+	len += sprintf( buf+len, "\n" );
 
+	len += sprintf( buf+len, "\n hypercalls: %lu done, %lu print ",
+		ctx->hypercalls[ VMM_HC_DONE ], ctx->hypercalls[ VMM_HC_PRINT ] );
+	len += sprintf( buf+len, "(%lu not logged), ", ctx->prints_dropped );
+	len += sprintf( buf+len, "%lu yield (%lu gave up the cpu), ",
+		ctx->hypercalls[ VMM_HC_YIELD ], ctx->yields );
+	len += sprintf( buf+len, "%lu time, %lu next \n",
+		ctx->hypercalls[ VMM_HC_TIME ], ctx->hypercalls[ VMM_HC_NEXT ] );
 
-	// allocate page-aligned non-pageable kernel memory
-////	kmem = kzalloc( KMEM_LENGTH, GFP_KERNEL );
-kmem = kzalloc( KMEM_LENGTH, GFP_KERNEL | GFP_DMA ); // <-- 04 AUG 2008
-	if ( !kmem ) return -ENOMEM;
-	lower_region = virt_to_phys( kmem );
-	himem_region = lower_region + LEGACY_VIDEO;
-	reach_region = himem_region + SEGMENT_SIZE;
-
-	vmxon_region = reach_region + VMXON_OFFSET;	
-	guest_region = reach_region + GUEST_OFFSET;	
-	pgdir_region = reach_region + PAGE_DIR_OFFSET;	
-	pgtbl_region = reach_region + PAGE_TBL_OFFSET;	
-	iomap_region = reach_region + IOBITMAP_OFFSET;	
-	g_IDT_region = reach_region + IDT_KERN_OFFSET;
-	g_GDT_region = reach_region + GDT_KERN_OFFSET;
-	g_LDT_region = reach_region + LDT_KERN_OFFSET;
-	g_TSS_region = reach_region + TSS_KERN_OFFSET;
-	g_SS0_region = reach_region + SS0_KERN_OFFSET;
-	g_ISR_region = reach_region + ISR_KERN_OFFSET;
-	h_MSR_region = reach_region + MSR_KERN_OFFSET;
+	len += sprintf( buf+len, "\n" );
+	if ( ctx->soft )
+		{
+		SOFT_CACHE	*sc = ctx->soft_cache;
+
+		len += sprintf( buf+len, " software backend (see vmsoft.h) \n" );
+		if ( sc )
+			{
+			len += sprintf( buf+len, " %12llu ", sc->insns );
+			len += sprintf( buf+len, "= instructions interpreted \n" );
+			len += sprintf( buf+len, " %12lu ", sc->hits );
+			len += sprintf( buf+len, "= blocks found in the cache \n" );
+			len += sprintf( buf+len, " %12lu ", sc->misses );
+			len += sprintf( buf+len, "= blocks decoded \n" );
+			len += sprintf( buf+len, " %12lu ", sc->flushes );
+			len += sprintf( buf+len, "= flushes of blocks in RAM \n" );
+			}
+		len += sprintf( buf+len, "\n" );
+		}
 
-	// enable virtual-machine extensions (bit 13 in CR4)
-	set_CR4_vmxe( NULL );
-	smp_call_function( set_CR4_vmxe, NULL, 1, 1 );
+	if ( ctx->pin_cpu >= 0 )
+		len += sprintf( buf+len, " pinned to cpu %d", ctx->pin_cpu );
+	else	len += sprintf( buf+len, " not pinned" );
+	len += sprintf( buf+len, " (VMCS last active on cpu %d) \n", ctx->cpu );
 
-	create_proc_read_entry( iname_mmap, 0, NULL, my_info_mmap, NULL );
-	create_proc_read_entry( iname_read, 0, NULL, my_info_read, NULL );
-	create_proc_read_entry( iname_task, 0, NULL, my_info_task, NULL );
-	create_proc_read_entry( iname_host, 0, NULL, my_info_host, NULL );
-	create_proc_read_entry( iname_ctls, 0, NULL, my_info_ctls, NULL );
-	create_proc_read_entry( iname_caps, 0, NULL, my_info_caps, NULL );
-	create_proc_read_entry( iname_help, 0, NULL, my_info_help, NULL );
-	return	register_chrdev( my_major, devname, &my_fops );
+	len += sprintf( buf+len, "\n" );
+	mutex_unlock( &vmm_proc_lock );
+	return	len;
 }
 
 
-static void __exit newvmm32_exit(void )
+int my_info_exit( char *buf, char **start, off_t off, int count,
+						int *eof, void *data )
 {
-	unregister_chrdev( my_major, devname );
-	remove_proc_entry( iname_caps, NULL );
-	remove_proc_entry( iname_ctls, NULL );
-	remove_proc_entry( iname_host, NULL );
-	remove_proc_entry( iname_task, NULL );
-	remove_proc_entry( iname_read, NULL );
-	remove_proc_entry( iname_mmap, NULL );
-	remove_proc_entry( iname_help, NULL );
+	struct vmm_context	*ctx;
+	exitstats_ia32		*st;
+	int			i, bin, n, len = 0;
 
-	// disable virtual-machine extensions (bit 13 in CR4)
-	smp_call_function( clear_CR4_vmxe, NULL, 1, 1 );
-	clear_CR4_vmxe( NULL );
+	if ( !( ctx = proc_context() ) ) return proc_no_context( buf );
+	st = &ctx->stats;
 
-	kfree( kmem );
+	len += sprintf( buf+len, "\n\n VM Exits by Reason \n\n" );
+	len += sprintf( buf+len, "      handled    forwarded \n" );
+	for (i = 0; i < VMM_REASONS; i++)
+		{
+		if ( !st->handled[ i ] && !st->forwarded[ i ] ) continue;
+		len += sprintf( buf+len, " %12llu ", st->handled[ i ] );
+		len += sprintf( buf+len, " %12llu ", st->forwarded[ i ] );
+		len += sprintf( buf+len, "= %s \n", exit_reason[ i ] );
+		}
 
-	printk( "<1>Removing \'%s\' module\n", modname );
+	len += sprintf( buf+len, "\n\n Cycles from VM Exit to Resume " );
+	len += sprintf( buf+len, "(count per power-of-two bin) \n" );
+	for (i = 0; i < VMM_REASONS; i++)
+		{
+		for (bin = 0, n = 0; bin < VMM_CYCLE_BINS; bin++)
+			{
+			if ( !st->cycles[ i ][ bin ] ) continue;
+			if ( len > PAGE_SIZE - 128 ) 
+				{
+				len += sprintf( buf+len, "\n (truncated) " );
+				i = VMM_REASONS;
+				break;
+				}
+			if ( n == 0 ) 
+				len += sprintf( buf+len, "\n %s ", exit_reason[ i ] );
+			if ( ( n++ % 4 ) == 0 ) len += sprintf( buf+len, "\n   " );
+			len += sprintf( buf+len, "  2^%-2d:%10llu ", 
+						bin, st->cycles[ i ][ bin ] );
+			}
+		if ( n ) len += sprintf( buf+len, "\n" );
+		}
+
+	len += sprintf( buf+len, "\n" );
+	mutex_unlock( &vmm_proc_lock );
+	return	len;
 }
 
-module_init( newvmm32_init );
-module_exit( newvmm32_exit );
-MODULE_LICENSE("GPL"); 
+//----------------------------------------------------------------
+// Any write to /proc/vmmexits resets those statistics; a VM that
+// is busy running is reset when its client next calls on it
+//----------------------------------------------------------------
+void exit_stats_reset( struct vmm_context *ctx )
+{
+	memset( &ctx->stats, 0, sizeof( ctx->stats ) );
+	ctx->timed_reason = -1;
+	ctx->stats_reset = 0;
+}
 
-int my_mmap( struct file *file, struct vm_area_struct *vma )
+int my_reset_exit( struct file *file, const char *buffer,
+					unsigned long count, void *data )
 {
-	unsigned long	user_virtaddr = vma->vm_start;
-	unsigned long	region_length = vma->vm_end - vma->vm_start;
-	unsigned long	physical_addr = virt_to_phys( kmem ), pfn;
-	pgprot_t	pgprot = vma->vm_page_prot;
+	struct vmm_context	*ctx;
 
-	// we require prescribed parameter-values from our client
-	if ( user_virtaddr != 0x00000000L ) return -EINVAL;
-	if ( region_length != LEGACY_REACH ) return -EINVAL;
+	if ( !( ctx = proc_context() ) ) return count;
 
-	// let the kernel know not to try swapping out this region
-	vma->vm_flags |= VM_RESERVED;
+	if ( mutex_trylock( &ctx->lock ) )
+		{
+		exit_stats_reset( ctx );
+		mutex_unlock( &ctx->lock );
+		}
+	else	ctx->stats_reset = 1;
 
-	//---------------------------------------------------------------
-	// ask the kernel to add page-table entries to 'map' these areas
-	//---------------------------------------------------------------
+	mutex_unlock( &vmm_proc_lock );
+	return	count;
+}
 
-	// map the 640KB lower region to address-range 0x00000-0x9FFFF
-	pfn = (physical_addr >> PAGE_SHIFT);
-	if ( remap_pfn_range( vma, user_virtaddr, pfn, 0xA0000, pgprot ) ) 
-		return -EAGAIN;
-	user_virtaddr += 0xA0000;
 
-	// map the 384KB video/rom-bios region to address-range 0xA0000-0xFFFFF
-	pfn = (LEGACY_VIDEO >> PAGE_SHIFT);
-	if ( remap_pfn_range( vma, user_virtaddr, pfn, 0x60000, pgprot ) ) 
-		return -EAGAIN;
-	user_virtaddr += 0x60000;
+int my_info_msrs( char *buf, char **start, off_t off, int count,
+						int *eof, void *data )
+{
+	struct vmm_context	*ctx;
+	int			i, len = 0;
 
-	// map the 64KB lower region to address-range 0x100000-0x10FFFF
-	physical_addr = lower_region;
-	pfn = (physical_addr >> PAGE_SHIFT);
-	if ( remap_pfn_range( vma, user_virtaddr, pfn, 0x10000, pgprot ) ) 
-		return -EAGAIN;
-	user_virtaddr += 0x10000;
+	if ( !( ctx = proc_context() ) ) return proc_no_context( buf );
 
-	// map the 64KB himem region to address-range 0x110000-0x11FFFF
-	physical_addr = reach_region;
-	pfn = (physical_addr >> PAGE_SHIFT);
-	if ( remap_pfn_range( vma, user_virtaddr, pfn, 0x10000, pgprot ) ) 
-		return -EAGAIN;
-	user_virtaddr += 0x10000;
+	len += sprintf( buf+len, "\n\n RDMSR/WRMSR Exits by MSR \n\n" );
+	len += sprintf( buf+len, "        reads       writes \n" );
+	for (i = 0; i < MAX_MSR_STATS; i++)
+		{
+		if ( !ctx->msr_exits[ i ].reads && !ctx->msr_exits[ i ].writes )
+			continue;
+		len += sprintf( buf+len, " %12lu ", ctx->msr_exits[ i ].reads );
+		len += sprintf( buf+len, " %12lu ", ctx->msr_exits[ i ].writes );
+		len += sprintf( buf+len, "= MSR 0x%08X \n", 
+						ctx->msr_exits[ i ].index );
+		}
+	len += sprintf( buf+len, " %12lu ", ctx->msr_exits_other );
+	len += sprintf( buf+len, "= exits for other MSRs \n" );
 
-	//---------------------------------------------------------------
-	// initialize some portions of the 640K conventional memory area
-	//---------------------------------------------------------------
+	len += sprintf( buf+len, "\n" );
+	mutex_unlock( &vmm_proc_lock );
+	return	len;
+}
 
-	// copy page-frame 0x000 to bottom of userspace (for IVT and BDA)
-	memcpy( kmem, phys_to_virt( 0x00000000 ), PAGE_SIZE );
+
+char *phase_name[] = {	"ioctl entry, copy_from_user",		// 0
+			"guest-state and control fields",	// 1
+			"host-state capture",			// 2
+			"host MSRs the guest can write",	// 3
+			"dirty-field scan",			// 4
+			"VMXON and VMPTRLD",			// 5
+			"VMWRITEs",				// 6
+			"in the guest (entry to exit)",		// 7
+			"descriptor-table restore",		// 8
+			"VMREADs of exit results",		// 9
+			"exits completed in our driver",	// 10
+			"copy_to_user, ioctl return",		// 11
+			};
+
+int my_info_phas( char *buf, char **start, off_t off, int count,
+						int *eof, void *data )
+{
+	struct vmm_context	*ctx;
+	unsigned long long	last = 0, total = 0, avg;
+	int			i, len = 0;
+
+	if ( !( ctx = proc_context() ) ) return proc_no_context( buf );
+	for (i = 0; i < N_PHASES; i++)
+		{
+		last += ctx->phase_last[ i ];
+		total += ctx->phase_total[ i ];
+		}
+
+	len += sprintf( buf+len, "\n\n TSC Cycles by Phase, for ioctls " );
+	len += sprintf( buf+len, "which ran the guest (%lu so far) \n\n", 
+							ctx->phase_calls );
+	len += sprintf( buf+len, "   latest call    average call  share \n" );
+	for (i = 0; i < N_PHASES; i++)
+		{
+		avg = ctx->phase_calls ? ctx->phase_total[ i ] / ctx->phase_calls : 0;
+		len += sprintf( buf+len, " %14llu  %14llu ", 
+						ctx->phase_last[ i ], avg );
+		len += sprintf( buf+len, " %4llu%% ", total ? 
+				( ctx->phase_total[ i ] * 100 ) / total : 0 );
+		len += sprintf( buf+len, "= %s \n", phase_name[ i ] );
+		}
+	avg = ctx->phase_calls ? total / ctx->phase_calls : 0;
+	len += sprintf( buf+len, " %14llu  %14llu ", last, avg );
+	len += sprintf( buf+len, "       = total \n" );
+
+	len += sprintf( buf+len, "\n" );
+	mutex_unlock( &vmm_proc_lock );
+	return	len;
+}
+
+
+void set_CR4_vmxe( void *dummy )
+{
+	asm(	" mov  %%cr4, %%rax	\n"\
+		" bts  $13, %%rax	\n"\
+		" mov  %%rax, %%cr4	" ::: "ax" );
+}
+		
+void clear_CR4_vmxe( void *dummy )
+{
+	asm(	" mov  %%cr4, %%rax	\n"\
+		" btr  $13, %%rax	\n"\
+		" mov  %%rax, %%cr4	" ::: "ax" );
+}
+
+//----------------------------------------------------------------
+// Each cpu enters VMX root-operation (with its own VMXON region) 
+// the first time a virtual machine runs there, and stays in it 
+// until our module is removed.  A context's VMCS stays active on
+// the cpu where it last ran (so later calls use 'vmresume'), and
+// is cleared only if the context moves to another cpu or closes
+//----------------------------------------------------------------
+int do_vmxon( unsigned long long region )
+{
+	unsigned char	fail;
+
+	asm volatile( " vmxon %1 \n setbe %0 " : "=q" (fail) 
+			: "m" (region) : "cc", "memory" );
+	return	fail;
+}
+
+int do_vmclear( unsigned long long region )
+{
+	unsigned char	fail;
+
+	asm volatile( " vmclear %1 \n setbe %0 " : "=q" (fail) 
+			: "m" (region) : "cc", "memory" );
+	return	fail;
+}
+
+int do_vmptrld( unsigned long long region )
+{
+	unsigned char	fail;
+
+	asm volatile( " vmptrld %1 \n setbe %0 " : "=q" (fail) 
+			: "m" (region) : "cc", "memory" );
+	return	fail;
+}
+
+int do_vmwrite( unsigned long encoding, unsigned long value )
+{
+	unsigned char	fail;
+
+	asm volatile( " vmwrite %2, %1 \n setbe %0 " : "=q" (fail) 
+			: "r" (encoding), "rm" (value) : "cc" );
+	return	fail;
+}
+
+void vmx_cpu_off( void *dummy )
+{
+	int	cpu = smp_processor_id();
+
+	if ( !vmx_on[ cpu ] ) return;
+	asm volatile( " vmxoff " ::: "cc", "memory" );
+	vmx_current[ cpu ] = NULL;
+	vmx_on[ cpu ] = 0;
+}
+
+// runs on the cpu where 'ctx' is active
+void vmx_clear( void *info )
+{
+	struct vmm_context	*ctx = info;
+	int			cpu = smp_processor_id();
+
+	if ( vmx_current[ cpu ] == ctx )
+		{
+		vmcs_read_results( ctx, RD_ALL );
+		vmx_current[ cpu ] = NULL;
+		}
+	do_vmclear( ctx->guest_region );
+	if ( ctx->cpu == cpu ) --vmx_active[ cpu ];
+	ctx->cpu = -1;
+	ctx->launched = 0;
+}
+
+//----------------------------------------------------------------
+// A cpu which has gone offline (even if it is now back online) has
+// lost the VMCS of each context that was active there; a context
+// like that is cleared afresh on the next cpu that loads it, and
+// has all its fields rewritten (called with preemption disabled)
+//----------------------------------------------------------------
+void vmx_forget_lost( struct vmm_context *ctx )
+{
+	if (( ctx->cpu < 0 )||( ctx->cpu_epoch == vmx_epoch[ ctx->cpu ] ))
+		return;
+	memset( ctx->dirty, 0xFF, sizeof( ctx->dirty ) );
+	ctx->cpu = -1;
+	ctx->launched = 0;
+}
+
+void vmx_release( struct vmm_context *ctx )
+{
+	int	cpu = get_cpu();
+
+	vmx_forget_lost( ctx );
+	if ( ctx->cpu == cpu ) vmx_clear( ctx );
+	else if (( ctx->cpu >= 0 )&&( cpu_online( ctx->cpu ) ))
+		smp_call_function_single( ctx->cpu, vmx_clear, ctx, 1, 1 );
+	put_cpu();
+}
+
+//----------------------------------------------------------------
+// Make this context's VMCS the current one on this cpu (which the
+// caller keeps us on, with preemption disabled, until it is done)
+//----------------------------------------------------------------
+int vmx_load( struct vmm_context *ctx )
+{
+	int		cpu = smp_processor_id();
+	unsigned long	flags;
+	int		fail = 0;
+
+	if ( !vmx_on[ cpu ] )
+		{
+		set_CR4_vmxe( NULL );	// in case this cpu came online later
+		if ( do_vmxon( vmxon_region[ cpu ] ) ) return -EIO;
+		vmx_on[ cpu ] = 1;
+		}
+
+	vmx_forget_lost( ctx );
+	if ( ctx->cpu != cpu )
+		{
+		if (( ctx->cpu >= 0 )&&( cpu_online( ctx->cpu ) ))
+			smp_call_function_single( ctx->cpu, vmx_clear, ctx, 1, 1 );
+		else	{
+			// a VMCS whose cpu went offline gets all its fields
+			// rewritten (its memory image may be out of date)
+			if ( ctx->cpu >= 0 ) 
+				memset( ctx->dirty, 0xFF, sizeof( ctx->dirty ) );
+			if ( do_vmclear( ctx->guest_region ) ) return -EIO;
+			}
+		ctx->cpu = cpu;
+		ctx->cpu_epoch = vmx_epoch[ cpu ];
+		ctx->launched = 0;
+		++vmx_active[ cpu ];
+		}
+
+	if ( vmx_current[ cpu ] == ctx ) return 0;
+
+	// a displaced VMCS has its remaining results read first
+	local_irq_save( flags );
+	if ( vmx_current[ cpu ] ) 
+		vmcs_read_results( vmx_current[ cpu ], RD_ALL );
+	vmx_current[ cpu ] = NULL;
+	if ( do_vmptrld( ctx->guest_region ) ) fail = -EIO;
+	else	vmx_current[ cpu ] = ctx;
+	local_irq_restore( flags );
+
+	return	fail;
+}
+
+
+//----------------------------------------------------------------
+// The accessors our exit-handlers get (see 'vmexits.h'): a read
+// is served from 'results[]' where possible, and a write updates
+// our copy of the field (and its shadow) along with the VMCS
+//----------------------------------------------------------------
+unsigned long long vmx_exit_read( void *vmcs, int encoding )
+{
+	struct vmm_context	*ctx = vmcs;
+	unsigned long		value;
+	int			i;
+
+	for (i = 0; i < rocount; i++)
+		if ( results[ i ].encoding == encoding )
+			{
+			vmcs_read_results( ctx, 1 << i );
+			return	vmcs_setting( &ctx->vmcs, &results[ i ] );
+			}
+
+	asm volatile( " vmread %1, %0 " : "=rm" (value) 
+			: "r" ((unsigned long)encoding) : "cc" );
+	return	value;
+}
+
+void vmx_exit_write( void *vmcs, int encoding, unsigned long long value )
+{
+	struct vmm_context	*ctx = vmcs;
+	int			i;
+
+	do_vmwrite( encoding, value );
+
+	for (i = 0; i < rocount; i++)
+		if ( results[ i ].encoding == encoding )
+			{
+			vmcs_store( &ctx->vmcs, &results[ i ], value );
+			ctx->results_valid |= ( 1 << i );
+			}
+
+	for (i = 0; i < N_MACHINE; i++)
+		if ( machine[ i ].encoding == encoding )
+			{
+			vmcs_store( &ctx->vmcs, &machine[ i ], value );
+			ctx->shadow[ i ] = vmcs_setting( &ctx->vmcs, &machine[ i ] );
+			}
+}
+
+// the guest's IN or OUT, on a port one of our own devices may own
+int vmx_exit_ioport( void *vmcs, unsigned int port, int size, int in, 
+							unsigned int *data )
+{
+	struct vmm_context	*ctx = vmcs;
+
+	if (( !ctx->vpic_on )||( size != 1 )) return EXIT_FORWARD;
+	if ( vpic_io( &ctx->vpic, port, in, data, read_tsc() ) == 0 ) 
+		return	EXIT_RESUME;
+
+	// port 0x43 also programs the real 8254's other channels: those
+	// accesses go on to it, as they did before our timer took the
+	// port over (unless our client had asked for them to exit)
+	if (( port == 0x43 )&&( !( ctx->vpic_iomap[ 1 ] & ( 1 << 3 ) ) ))
+		{
+		if ( in ) *data = inb( port );
+		else	outb( *data, port );
+		return	EXIT_RESUME;
+		}
+	return	EXIT_FORWARD;
+}
+
+//----------------------------------------------------------------
+// The accessors our software backend's exit-handlers get instead:
+// its guest-state is in our 'regs_ia32' (the interpreter only runs
+// virtual-8086 code), and its instruction-length in our copy of
+// the exit-fields; other fields read as zero, and writes to them
+// are ignored
+//----------------------------------------------------------------
+unsigned long long soft_exit_read( void *vmcs, int encoding )
+{
+	struct vmm_context	*ctx = vmcs;
+	regs_ia32		*vm = &ctx->vm;
+
+	switch ( encoding )
+		{
+		case VMCS_GUEST_RIP:	return	vm->eip;
+		case VMCS_GUEST_RSP:	return	vm->esp;
+		case VMCS_GUEST_RFLAGS:	return	vm->eflags | (1<<17);
+		case VMCS_GUEST_ES:	return	vm->es;
+		case VMCS_GUEST_CS:	return	vm->cs;
+		case VMCS_GUEST_SS:	return	vm->ss;
+		case VMCS_GUEST_DS:	return	vm->ds;
+		case VMCS_GUEST_FS:	return	vm->fs;
+		case VMCS_GUEST_GS:	return	vm->gs;
+		case VMCS_EXIT_INSN_LENGTH:
+			return	ctx->vmcs.info_vmexit_instruction_length;
+		}
+	return	0;
+}
+
+void soft_exit_write( void *vmcs, int encoding, unsigned long long value )
+{
+	struct vmm_context	*ctx = vmcs;
+	regs_ia32		*vm = &ctx->vm;
+
+	switch ( encoding )
+		{
+		case VMCS_GUEST_RIP:	vm->eip = value; break;
+		case VMCS_GUEST_RSP:	vm->esp = value; break;
+		case VMCS_GUEST_RFLAGS:	vm->eflags = value; break;
+		}
+}
+
+// record a VM exit in this cpu's trace-ring (every one is recorded,
+// whether or not a handler completes it)
+void vmx_trace_exit( struct vmm_context *ctx )
+{
+	vmtrace_exit( ctx->vmcs.info_vmexit_reason,
+			vmx_exit_read( ctx, VMCS_EXIT_QUALIFICATION ),
+			vmx_exit_read( ctx, VMCS_EXIT_INTR_INFO ),
+			vmx_exit_read( ctx, VMCS_GUEST_CS ),
+			vmx_exit_read( ctx, VMCS_GUEST_RIP ), 0 );
+}
+
+void vmx_host_cpuid( unsigned int *regs )
+{
+	asm volatile( " cpuid " : "+a" (regs[0]), "=b" (regs[1]), 
+				"+c" (regs[2]), "=d" (regs[3]) );
+}
+
+void vmx_host_nmi( void )
+{
+	asm(" int $0x02 ");
+}
+
+
+//----------------------------------------------------------------
+// Our MSR-bitmap page holds four 1KB bitmaps: for reads of MSRs 
+// 0x00000000-0x00001FFF and 0xC0000000-0xC0001FFF, then for writes
+// of those same two ranges.  A set bit makes that access exit; an
+// MSR outside both ranges always exits.
+//----------------------------------------------------------------
+unsigned int	msr_allowed[] = {	0x00000010,	// TSC
+					0x000000FE,	// MTRRcap
+					};
+
+#define N_MSR_ALLOWED	( sizeof( msr_allowed ) / sizeof( unsigned int ) )
+
+int msr_set_policy( struct vmm_context *ctx, unsigned int index, int policy )
+{
+	unsigned char	*bitmap = phys_to_virt( ctx->msrbm_region );
+	unsigned int	bit = index & 0x1FFF;
+	int		i;
+
+	if ( ( index & ~0x1FFF ) == 0xC0000000 ) bitmap += 0x400;
+	else if ( ( index & ~0x1FFF ) != 0x00000000 ) return -EINVAL;
+
+	if ( policy & VMM_MSR_READ ) bitmap[ bit >> 3 ] &= ~( 1 << ( bit & 7 ) );
+	else	bitmap[ bit >> 3 ] |= ( 1 << ( bit & 7 ) );
+
+	bitmap += 0x800;
+	if ( policy & VMM_MSR_WRITE ) bitmap[ bit >> 3 ] &= ~( 1 << ( bit & 7 ) );
+	else	bitmap[ bit >> 3 ] |= ( 1 << ( bit & 7 ) );
+
+	// a host syscall MSR the guest can write must be restored
+	for (i = 0; i < N_HOST_MSRS; i++)
+		if ( host_msrs[ i ] == index )
+			{
+			if ( policy & VMM_MSR_WRITE ) ctx->msr_clobber |= ( 1 << i );
+			else	ctx->msr_clobber &= ~( 1 << i );
+			}
+	return	0;
+}
+
+void msr_exit_count( struct vmm_context *ctx, unsigned int index, int write )
+{
+	int	i;
+
+	for (i = 0; i < MAX_MSR_STATS; i++)
+		{
+		if (( ctx->msr_exits[ i ].index != index )
+			&&( ctx->msr_exits[ i ].reads || ctx->msr_exits[ i ].writes ))
+			continue;
+		ctx->msr_exits[ i ].index = index;
+		if ( write ) ++ctx->msr_exits[ i ].writes;
+		else	++ctx->msr_exits[ i ].reads;
+		return;
+		}
+	++ctx->msr_exits_other;
+}
+
+void free_vmxon_pages( void )
+{
+	int	cpu;
+
+	for_each_possible_cpu( cpu )
+		if ( vmxon_page[ cpu ] ) 
+			{
+			free_page( (unsigned long)vmxon_page[ cpu ] );
+			vmxon_page[ cpu ] = NULL;
+			}
+}
+
+//----------------------------------------------------------------
+// A cpu that comes online gets its host-state captured, and one
+// that goes offline has left VMX operation (its VMCSs with it)
+//----------------------------------------------------------------
+int __cpuinit host_cpu_notify( struct notifier_block *nb, 
+					unsigned long action, void *hcpu )
+{
+	int	cpu = (long)hcpu;
+
+	switch ( action )
+		{
+		case CPU_ONLINE:
+		case CPU_ONLINE_FROZEN:
+			smp_call_function_single( cpu, host_capture, NULL, 1, 1 );
+			break;
+
+		case CPU_DEAD:
+		case CPU_DEAD_FROZEN:
+			host_state[ cpu ].valid = 0;
+			vmx_on[ cpu ] = 0;
+			vmx_current[ cpu ] = NULL;
+			vmx_active[ cpu ] = 0;
+			++vmx_epoch[ cpu ];	// (see 'vmx_forget_lost()')
+			break;
+		}
+	return	NOTIFY_OK;
+}
+
+struct notifier_block __cpuinitdata host_cpu_notifier = {
+				notifier_call:	host_cpu_notify,
+				};
+
+
+//----------------------------------------------------------------
+// Prepare each cpu for VMX operation (on a cpu which supports it)
+//----------------------------------------------------------------
+int __init vmx_setup( void )
+{
+	int	cpu;
+
+	// read contents of the VMX-Capability Model-Specific Registers
+	asm(	" xor	%%rbx, %%rbx			\n"\
+		" mov	%0, %%rcx			\n"\
+		"nxcap:					\n"\
+		" rdmsr					\n"\
+		" mov	%%eax, msr0x480+0(, %%rbx, 8 )	\n"\
+		" mov	%%edx, msr0x480+4(, %%rbx, 8 )	\n"\
+		" inc	%%rcx				\n"\
+		" inc	%%rbx				\n"\
+		" cmp	$11, %%rbx			\n"\
+		" jb	nxcap				\n"\
+		:: "i" (MSR_VMX_CAPS) : "ax", "bx", "cx", "dx" );
+
+	// settle our controls (a cpu lacking any we need can't run VMs)
+	if ( vmx_negotiate() ) return -ENODEV;
+
+	// preserve original contents of Control Registers CR0, CR4
+	asm(" mov %%cr0, %%rax \n mov %%rax, original_CR0 " ::: "ax" );
+	asm(" mov %%cr4, %%rax \n mov %%rax, original_CR4 " ::: "ax" );
+
+	// preserve original contents of Extended Feature Control Register
+	asm(	" mov	%0, %%ecx			\n"\
+		" rdmsr					\n"\
+		" mov	%%eax, efcr+0			\n"\
+		" mov	%%edx, efcr+4			\n"\
+		:: "i" (EFCR_MSR) : "ax", "cx", "dx" );
+
+	// preserve original contents of Extended Feature Enable Register
+	asm(	" mov	%0, %%ecx			\n"\
+		" rdmsr					\n"\
+		" mov	%%eax, efer+0			\n"\
+		" mov	%%edx, efer+4			\n"\
+		:: "i" (EFER_MSR) : "ax", "cx", "dx" );
+
+	// allocate a VMXON region for each cpu that may be used, from
+	// memory that is local to that cpu's node
+	for_each_possible_cpu( cpu )
+		{
+		struct page	*page = alloc_pages_node( cpu_to_node( cpu ), 
+						GFP_KERNEL | __GFP_ZERO, 0 );
+
+		if ( !page ) { free_vmxon_pages(); return -ENOMEM; }
+		vmxon_page[ cpu ] = page_address( page );
+		memcpy( vmxon_page[ cpu ], msr0x480, 4 );
+		vmxon_region[ cpu ] = virt_to_phys( vmxon_page[ cpu ] );
+		}
+
+	// enable virtual-machine extensions (bit 13 in CR4)
+	set_CR4_vmxe( NULL );
+	smp_call_function( set_CR4_vmxe, NULL, 1, 1 );
+	return	0;
+}
+
+static int __init newvmm32_init( void )
+{
+	struct proc_dir_entry	*pde;
+	int	retval;
+
+	// confirm module installation and show device-major number
+	printk( "<1>\nInstalling \'%s\' module ", modname );
+	printk( "(major=%d) \n", my_major );
+
+	// verify cpu support for Intel Virtualization Technology
+	asm(	" xor	%%eax, %%eax		\n"\
+		" cpuid				\n"\
+		" mov	%%ebx, cpu_oem+0	\n"\
+		" mov	%%edx, cpu_oem+4	\n"\
+		" mov	%%ecx, cpu_oem+8	\n"\
+		::: "ax", "bx", "cx", "dx" );
+	printk( " processor is \'%s\' \n", cpu_oem );
+
+	if ( strncmp( cpu_oem, "GenuineIntel", 12 ) == 0 )
+		asm(	" mov	$1, %%eax		\n"\
+			" cpuid				\n"\
+			" mov	%%ecx, cpu_features	\n"\
+			::: "ax", "bx", "cx", "dx" );
+	if ( ( cpu_features & (1<<5) ) == 0 )
+		printk( " Virtualization Technology is unsupported \n" );
+	else	printk( " Virtualization Technology is supported \n" );
+	vmx_supported = ( cpu_features & (1<<5) ) != 0;
+
+	// allocate the trace-ring for each cpu
+	if ( vmtrace_alloc() ) return -ENOMEM;
+
+	if ( vmx_supported )
+		{
+		retval = vmx_setup();
+		if ( retval == -ENODEV ) vmx_supported = 0;
+		else if ( retval ) { vmtrace_free(); return retval; }
+		}
+
+	// without it, our VMs run in our interpreter (see 'vmsoft.h')
+	if ( !vmx_supported ) 
+		printk( " using our software backend \n" );
+
+	// capture each online cpu's host-state, and keep it current
+	// as cpus come and go
+	get_cpu();
+	host_capture( NULL );
+	smp_call_function( host_capture, NULL, 1, 1 );
+	put_cpu();
+	register_cpu_notifier( &host_cpu_notifier );
+
+	create_proc_read_entry( iname_mmap, 0, NULL, my_info_mmap, NULL );
+	create_proc_read_entry( iname_read, 0, NULL, my_info_read, NULL );
+	create_proc_read_entry( iname_task, 0, NULL, my_info_task, NULL );
+	create_proc_read_entry( iname_host, 0, NULL, my_info_host, NULL );
+	create_proc_read_entry( iname_ctls, 0, NULL, my_info_ctls, NULL );
+	create_proc_read_entry( iname_caps, 0, NULL, my_info_caps, NULL );
+	create_proc_read_entry( iname_stat, 0, NULL, my_info_stat, NULL );
+	pde = create_proc_entry( iname_exit, 0644, NULL );
+	if ( pde ) { pde->read_proc = my_info_exit; 
+			pde->write_proc = my_reset_exit; }
+	create_proc_read_entry( iname_msrs, 0, NULL, my_info_msrs, NULL );
+	create_proc_read_entry( iname_phas, 0, NULL, my_info_phas, NULL );
+	create_proc_read_entry( iname_help, 0, NULL, my_info_help, NULL );
+	return	register_chrdev( my_major, devname, &my_fops );
+}
+
+
+static void __exit newvmm32_exit(void )
+{
+	unregister_chrdev( my_major, devname );
+	unregister_cpu_notifier( &host_cpu_notifier );
+	remove_proc_entry( iname_caps, NULL );
+	remove_proc_entry( iname_ctls, NULL );
+	remove_proc_entry( iname_host, NULL );
+	remove_proc_entry( iname_task, NULL );
+	remove_proc_entry( iname_read, NULL );
+	remove_proc_entry( iname_mmap, NULL );
+	remove_proc_entry( iname_stat, NULL );
+	remove_proc_entry( iname_exit, NULL );
+	remove_proc_entry( iname_msrs, NULL );
+	remove_proc_entry( iname_phas, NULL );
+	remove_proc_entry( iname_help, NULL );
+
+	// leave VMX root-operation (on each cpu) before clearing CR4.VMXE
+	if ( vmx_supported )
+		{
+		smp_call_function( vmx_cpu_off, NULL, 1, 1 );
+		vmx_cpu_off( NULL );
+
+		// disable virtual-machine extensions (bit 13 in CR4)
+		smp_call_function( clear_CR4_vmxe, NULL, 1, 1 );
+		clear_CR4_vmxe( NULL );
+
+		free_vmxon_pages();
+		}
+	vmtrace_free();
+
+	printk( "<1>Removing \'%s\' module\n", modname );
+}
+
+module_init( newvmm32_init );
+module_exit( newvmm32_exit );
+MODULE_LICENSE("GPL"); 
+
+// map one of a VM's pages (its run page or its ring page)
+int mmap_page( struct vm_area_struct *vma, void *page )
+{
+	unsigned long	pfn = virt_to_phys( page ) >> PAGE_SHIFT;
+
+	if ( vma->vm_end - vma->vm_start != PAGE_SIZE ) return -EINVAL;
+	vma->vm_flags |= VM_RESERVED;
+	if ( remap_pfn_range( vma, vma->vm_start, pfn, PAGE_SIZE, 
+						vma->vm_page_prot ) )
+		return -EAGAIN;
+	return	0;
+}
+
+int my_mmap( struct file *file, struct vm_area_struct *vma )
+{
+	unsigned long	user_virtaddr = vma->vm_start;
+	unsigned long	region_length = vma->vm_end - vma->vm_start;
+	struct vmm_context	*ctx = file->private_data;
+	unsigned long	physical_addr = virt_to_phys( ctx->kmem ), pfn;
+	pgprot_t	pgprot = vma->vm_page_prot;
+
+	// our run page and ring page are mapped wherever the client likes
+	if ( vma->vm_pgoff == ( VMM_RUN_MMAP >> PAGE_SHIFT ) ) 
+		return	mmap_page( vma, ctx->runpage );
+	if ( vma->vm_pgoff == ( VMM_RING_MMAP >> PAGE_SHIFT ) ) 
+		return	mmap_page( vma, ctx->ring );
+
+	// and so is any cpu's trace-ring (see 'vmtrace.h')
+	if ( vma->vm_pgoff >= ( VMM_TRACE_MMAP( 0 ) >> PAGE_SHIFT ) )
+		return	vmtrace_mmap( vma );
+	if ( vma->vm_pgoff ) return -EINVAL;
+
+	// we require prescribed parameter-values from our client
+	if ( user_virtaddr != 0x00000000L ) return -EINVAL;
+	if ( region_length != LEGACY_REACH ) return -EINVAL;
+
+	// let the kernel know not to try swapping out this region
+	vma->vm_flags |= VM_RESERVED;
+
+	//---------------------------------------------------------------
+	// ask the kernel to add page-table entries to 'map' these areas
+	//---------------------------------------------------------------
+
+	// map the 640KB lower region to address-range 0x00000-0x9FFFF
+	pfn = (physical_addr >> PAGE_SHIFT);
+	if ( remap_pfn_range( vma, user_virtaddr, pfn, 0xA0000, pgprot ) ) 
+		return -EAGAIN;
+	user_virtaddr += 0xA0000;
+
+	// map the 384KB video/rom-bios region to address-range 0xA0000-0xFFFFF
+	pfn = (LEGACY_VIDEO >> PAGE_SHIFT);
+	if ( remap_pfn_range( vma, user_virtaddr, pfn, 0x60000, pgprot ) ) 
+		return -EAGAIN;
+	user_virtaddr += 0x60000;
+
+	// map the 64KB lower region to address-range 0x100000-0x10FFFF
+	physical_addr = ctx->lower_region;
+	pfn = (physical_addr >> PAGE_SHIFT);
+	if ( remap_pfn_range( vma, user_virtaddr, pfn, 0x10000, pgprot ) ) 
+		return -EAGAIN;
+	user_virtaddr += 0x10000;
+
+	// map the 64KB himem region to address-range 0x110000-0x11FFFF
+	physical_addr = ctx->reach_region;
+	pfn = (physical_addr >> PAGE_SHIFT);
+	if ( remap_pfn_range( vma, user_virtaddr, pfn, 0x10000, pgprot ) ) 
+		return -EAGAIN;
+	user_virtaddr += 0x10000;
+
+	//---------------------------------------------------------------
+	// initialize some portions of the 640K conventional memory area
+	//---------------------------------------------------------------
+
+	// copy page-frame 0x000 to bottom of userspace (for IVT and BDA)
+	memcpy( ctx->kmem, phys_to_virt( 0x00000000 ), PAGE_SIZE );
 
 	// copy page-frames 0x090 to 0x09F to arena 0x9 (for EBDA)
-	memcpy( kmem+0x90000, phys_to_virt( 0x00090000 ), 16 * PAGE_SIZE );
+	memcpy( ctx->kmem+0x90000, phys_to_virt( 0x00090000 ), 16 * PAGE_SIZE );
+
+	return	0;
+}
+
+void isr_gpfault( void );
+asm("	.type	isr_gpfault, @function		");
+asm("isr_gpfault:				");
+asm("	vmcall					");
+asm("	.rept	32				");
+asm("	nop					");
+asm("	.endr					");
+
+int my_open( struct inode *inode, struct file *file )
+{
+	struct vmm_context	*ctx;
+	unsigned long long	*g_idt, *g_gdt, *g_ldt, desc;
+	unsigned int		*pgdir, *pgtbl, *g_tss, i;
+
+	ctx = kzalloc( sizeof( struct vmm_context ), GFP_KERNEL );
+	if ( !ctx ) return -ENOMEM;
+	mutex_init( &ctx->lock );
+	ctx->cpu = -1;
+	ctx->pin_cpu = -1;
+	ctx->stale = VMCS_STALE;
+	ctx->timed_reason = -1;
+	ctx->guest_cpu = -1;
+	spin_lock_init( &ctx->event_lock );
+	ctx->exit.gpr = ctx->gpr;
+	ctx->exit.vmcs = ctx;
+	ctx->exit.vmread = vmx_exit_read;
+	ctx->exit.vmwrite = vmx_exit_write;
+	ctx->exit.cpuid = vmx_host_cpuid;
+	ctx->exit.nmi = vmx_host_nmi;
+	ctx->soft = ( soft )||( !vmx_supported );
+	ctx->exit.ioport = vmx_exit_ioport;
+	ctx->exit.hypercall = vmx_hypercall;
+	if ( ctx->soft )
+		{
+		ctx->exit.vmread = soft_exit_read;
+		ctx->exit.vmwrite = soft_exit_write;
+		}
+	vpic_reset( &ctx->vpic );
+
+	// allocate page-aligned non-pageable memory for this VM
+	ctx->kmem = kzalloc( KMEM_LENGTH, GFP_KERNEL | GFP_DMA );
+	if ( !ctx->kmem ) { kfree( ctx ); return -ENOMEM; }
+	ctx->runpage = (runpage_ia32*)get_zeroed_page( GFP_KERNEL );
+	if ( !ctx->runpage ) { kfree( ctx->kmem ); kfree( ctx ); return -ENOMEM; }
+	ctx->ring = (ring_ia32*)get_zeroed_page( GFP_KERNEL );
+	if ( !ctx->ring ) 
+		{ 
+		free_page( (unsigned long)ctx->runpage ); 
+		kfree( ctx->kmem ); 
+		kfree( ctx ); 
+		return -ENOMEM; 
+		}
+	init_waitqueue_head( &ctx->ring_work );
+	init_waitqueue_head( &ctx->ring_done );
+	init_waitqueue_head( &ctx->idle_wait );
+	ctx->lower_region = virt_to_phys( ctx->kmem );
+	ctx->himem_region = ctx->lower_region + LEGACY_VIDEO;
+	ctx->reach_region = ctx->himem_region + SEGMENT_SIZE;
+
+	ctx->guest_region = ctx->reach_region + GUEST_OFFSET;	
+	ctx->pgdir_region = ctx->reach_region + PAGE_DIR_OFFSET;	
+	ctx->pgtbl_region = ctx->reach_region + PAGE_TBL_OFFSET;	
+	ctx->iomap_region = ctx->reach_region + IOBITMAP_OFFSET;	
+	ctx->msrbm_region = ctx->reach_region + MSRBITMAP_OFFSET;	
+	ctx->g_IDT_region = ctx->reach_region + IDT_KERN_OFFSET;
+	ctx->g_GDT_region = ctx->reach_region + GDT_KERN_OFFSET;
+	ctx->g_LDT_region = ctx->reach_region + LDT_KERN_OFFSET;
+	ctx->g_TSS_region = ctx->reach_region + TSS_KERN_OFFSET;
+	ctx->g_SS0_region = ctx->reach_region + SS0_KERN_OFFSET;
+	ctx->g_ISR_region = ctx->reach_region + ISR_KERN_OFFSET;
+
+	// initialize the VMCS region
+	memcpy( phys_to_virt( ctx->guest_region ), msr0x480, 4  );		
+
+	// every MSR access exits, except those on our allow-list
+	memset( phys_to_virt( ctx->msrbm_region ), 0xFF, PAGE_SIZE );
+	for (i = 0; i < N_MSR_ALLOWED; i++)
+		msr_set_policy( ctx, msr_allowed[ i ], VMM_MSR_READ );
+
+	// initialize the Guest Page-Directory and Page-Table
+	pgdir = (unsigned int*)phys_to_virt( ctx->pgdir_region );
+	for (i = 0; i < 1024; i++)
+		pgdir[ i ] = ( i == 0 ) ? ctx->pgtbl_region | 0x007 : 0;
+
+	pgtbl = (unsigned int*)phys_to_virt( ctx->pgtbl_region );
+	for (i = 0; i < 0xA0; i++)
+		{
+		unsigned int	page_address = (i << PAGE_SHIFT); 
+		pgtbl[ i ] = (ctx->lower_region + page_address) | 0x007;
+		}
+	for (i = 0xA0; i < 0x100; i++)
+		{
+		unsigned int	page_address = (i << PAGE_SHIFT); 
+		pgtbl[ i ] = page_address | 0x007;
+		}
+	for (i = 0x100; i < 0x110; i++)
+		{
+		unsigned int	page_address = ((i - 0x100) << PAGE_SHIFT); 
+		pgtbl[ i ] = (ctx->lower_region + page_address) | 0x007;
+		}
+	for (i = 0x110; i < 0x120; i++)
+		{
+		unsigned int	page_address = ((i - 0x60) << PAGE_SHIFT); 
+		pgtbl[ i ] = (ctx->lower_region + page_address) | 0x007;
+		}
+	for (i = 0x120; i < 0x400; i++) pgtbl[ i ] = 0;
+
+
+	// initialize our Guest task's interrupt-handler region
+	memcpy( phys_to_virt( ctx->g_ISR_region ), isr_gpfault, 32 ); 
+
+	// initialize our Guest task's IDT
+	g_idt = (unsigned long long*)phys_to_virt( ctx->g_IDT_region );
+	desc = LEGACY_REACH + ISR_KERN_OFFSET; 	// offset for GPF handler
+	desc &= 0x00000000FFFFFFFFLL;
+	desc |= (desc << 32);
+	desc &= 0xFFFF00000000FFFFLL; 
+	desc |= (__SELECTOR_CODE << 16);
+	desc |= (0x8E00LL << 32);	// DPL=0, 386-INTR-gate
+	g_idt[ 13 ] = desc;		// General Protection Fault		
+
+	// initialize our Guest task's GDT
+	g_gdt = (unsigned long long*)phys_to_virt( ctx->g_GDT_region );
+
+	desc = LEGACY_REACH + TSS_KERN_OFFSET;
+	desc = ((desc & 0xFF000000)<<32)|((desc & 0x00FFFFFF)<<16);
+	desc |= ( 8328 ) | (0x008BLL << 40);
+	g_gdt[ __SELECTOR_TASK >> 3 ] = desc;
+
+	desc = LEGACY_REACH + LDT_KERN_OFFSET;
+	desc = ((desc & 0xFF000000)<<32)|((desc & 0x00FFFFFF)<<16);
+	desc |= ( 4 * 8 - 1) | (0x0082LL << 40);
+	g_gdt[ __SELECTOR_LDTR >> 3 ] = desc;
+
+	// initialize our Guest task's LDT
+	g_ldt = (unsigned long long*)phys_to_virt( ctx->g_LDT_region );
+
+	desc = 0x00CF9A000000FFFFLL;
+	g_ldt[ __SELECTOR_CODE >> 3 ] = desc;
+
+	desc = 0x00CF92000000FFFFLL;
+	g_ldt[ __SELECTOR_DATA >> 3 ] = desc; 
+
+	desc = 0x0000920B8000FFFFLL;
+	g_ldt[ __SELECTOR_VRAM >> 3 ] = desc;
+
+	desc = 0x00CF92000000FFFFLL;
+	g_ldt[ __SELECTOR_FLAT >> 3 ] = desc;
+
+	// initialize our Guest task's TSS
+	g_tss = (unsigned int*)phys_to_virt( ctx->g_TSS_region );
+	g_tss[0] = 0;			// back-link
+	g_tss[1] = LEGACY_REACH + ISR_KERN_OFFSET; // ESP0
+	g_tss[2] = __SELECTOR_FLAT;	           // SS0
+	g_tss[25] = 0x00880000;		// IOBITMAP offset
+	// number of bytes in TSS: 104 + 32 + 8192 = 8328
+	g_tss[ 8328 >> 2 ] = 0xFF;	// end of IOBITMAP
 
+	file->private_data = ctx;
 	return	0;
 }
 
-void isr_gpfault( void );
-asm("	.type	isr_gpfault, @function		");
-asm("isr_gpfault:				");
-asm("	vmcall					");
-asm("	.rept	32				");
-asm("	nop					");
-asm("	.endr					");
+int my_release( struct inode *inode, struct file *file )
+{
+	struct vmm_context	*ctx = file->private_data;
+
+	mutex_lock( &vmm_proc_lock );
+	if ( vmm_last == ctx ) vmm_last = NULL;
+	mutex_unlock( &vmm_proc_lock );
+
+	// our asynchronous calls are finished with (any still queued 
+	// are abandoned) before this VM goes away
+	if ( ctx->ring_task ) kthread_stop( ctx->ring_task );
+	if ( ctx->eventfd ) fput( ctx->eventfd );
+
+	// this VMCS must not stay active once its memory is freed
+	vmx_release( ctx );
+
+	free_page( (unsigned long)ctx->ring );
+	free_page( (unsigned long)ctx->runpage );
+	vfree( ctx->soft_cache );
+	kfree( ctx->kmem );
+	kfree( ctx );
+	return	0;
+}
+
+//----------------------------------------------------------------
+// Deliver all the VM-exit information fields to our client (the
+// ones our exit-code skipped are fetched from the VMCS just now)
+//----------------------------------------------------------------
+int my_exitinfo( struct vmm_context *ctx, unsigned long buf )
+{
+	VMCS_FIELDS	*f = &ctx->vmcs;
+	exit_ia32	info;
+
+	vmx_fetch_lazy( ctx );
+
+	info.vminstr_error = f->info_vminstr_error;
+	info.exit_reason = f->info_vmexit_reason;
+	info.interrupt_information = f->info_vmexit_interrupt_information;
+	info.interrupt_error_code = f->info_vmexit_interrupt_error_code;
+	info.IDT_vectoring_information = f->info_IDT_vectoring_information;
+	info.IDT_vectoring_error_code = f->info_IDT_vectoring_error_code;
+	info.instruction_length = f->info_vmexit_instruction_length;
+	info.instruction_information = f->info_vmx_instruction_information;
+	info.exit_qualification = f->info_exit_qualification;
+	info.IO_RCX = f->info_IO_RCX;
+	info.IO_RSI = f->info_IO_RSI;
+	info.IO_RDI = f->info_IO_RDI;
+	info.IO_RIP = f->info_IO_RIP;
+	info.guest_linear_address = f->info_guest_linear_address;
+	if ( copy_to_user( (void*)buf, &info, sizeof( info ) ) ) return -EFAULT;
+
+	return	0;
+}
+
+//----------------------------------------------------------------
+// Mark this context's dirty fields (those differing from what we
+// last wrote into its VMCS); 'host_RSP' isn't known until we are
+// inside 'vmx_enter', which always writes it (and 'host_RIP' is
+// always the address of 'vmx_exit')
+//----------------------------------------------------------------
+int vmx_scan( struct vmm_context *ctx )
+{
+	int	i, count;
+
+	count = vmcs_mark_dirty( &ctx->vmcs, ctx->shadow, ctx->dirty, 
+								ctx->stale );
+	ctx->stale = VMCS_RAN;	// the guest is about to run
+
+	for (i = 0; i < N_MACHINE; i++)
+		if ( machine[ i ].setting == VMCS_FIELD( host_RSP ) ) 
+			{
+			if ( ctx->dirty[ i / 64 ] & ( 1UL << ( i % 64 ) ) ) 
+				--count;
+			ctx->dirty[ i / 64 ] &= ~( 1UL << ( i % 64 ) );
+			}
+	++count;	// for the write of 'host_RSP' in 'vmx_enter'
+
+	ctx->writes_latest = count;
+	ctx->writes_total += count;
+	return	count;
+}
+
+int vmx_write_dirty( struct vmm_context *ctx )
+{
+	int	i;
+
+	for (i = 0; i < N_MACHINE; i++)
+		{
+		if ( !( ctx->dirty[ i / 64 ] & ( 1UL << ( i % 64 ) ) ) ) continue;
+
+		// skip the MSR-bitmap address on cpus which can't use it
+		if (( ( machine[ i ].encoding & ~1 ) == 0x2004 )
+			&&( !( vmx_ctls[ CTLS_CPU ] & (1<<28) ) )) continue;
+		if ( do_vmwrite( machine[ i ].encoding, ctx->shadow[ i ] ) ) 
+			return	-EIO;
+		}
+	return	0;
+}
+
+//----------------------------------------------------------------
+// int vmx_enter( unsigned long *gpr, int launched );
+//
+// Enters the guest whose VMCS is current (by 'vmlaunch' or else
+// by 'vmresume'), with its general registers taken from 'gpr[]'.
+// The guest's VM exit arrives at 'vmx_exit' on our saved stack, 
+// where we store the guest's registers back into 'gpr[]' and 
+// return 0; if the VM entry itself fails, we return 1 for a 
+// VMfailInvalid or 2 for a VMfailValid.  Our saved RFLAGS are 
+// restored on return, so an external interrupt that caused the
+// VM exit gets delivered to the host's handler right then. 
+//----------------------------------------------------------------
+int vmx_enter( unsigned long *gpr, int launched );
+void vmx_exit( void );
+asm("	.text					");
+asm("	.type	vmx_enter, @function		");
+asm("vmx_enter:					");
+asm("	pushfq					");
+asm("	push	%rbx				");
+asm("	push	%rbp				");
+asm("	push	%r12				");
+asm("	push	%r13				");
+asm("	push	%r14				");
+asm("	push	%r15				");
+asm("	push	%rdi				");
+asm("	mov	$0x6C14, %rax			");	// host_RSP
+asm("	vmwrite	%rsp, %rax			");
+asm("	jbe	vmx_fail			");
+asm("	test	%esi, %esi			");
+asm("	mov	0x08(%rdi), %rcx		");
+asm("	mov	0x10(%rdi), %rdx		");
+asm("	mov	0x18(%rdi), %rbx		");
+asm("	mov	0x28(%rdi), %rbp		");
+asm("	mov	0x30(%rdi), %rsi		");
+asm("	mov	0x00(%rdi), %rax		");
+asm("	mov	0x38(%rdi), %rdi		");
+asm("	jne	1f				");
+asm("	vmlaunch				");
+asm("	jmp	vmx_fail			");
+asm("1:	vmresume				");
+asm("vmx_fail:					");
+asm("	mov	$1, %eax			");
+asm("	jc	vmx_done			");
+asm("	mov	$2, %eax			");
+asm("	jmp	vmx_done			");
+asm("	.type	vmx_exit, @function		");
+asm("vmx_exit:					");
+asm("	push	%rdi				");
+asm("	mov	0x08(%rsp), %rdi		");
+asm("	mov	%rax, 0x00(%rdi)		");
+asm("	mov	%rcx, 0x08(%rdi)		");
+asm("	mov	%rdx, 0x10(%rdi)		");
+asm("	mov	%rbx, 0x18(%rdi)		");
+asm("	mov	%rbp, 0x28(%rdi)		");
+asm("	mov	%rsi, 0x30(%rdi)		");
+asm("	pop	%rax				");
+asm("	mov	%rax, 0x38(%rdi)		");
+asm("	xor	%eax, %eax			");
+asm("vmx_done:					");
+asm("	pop	%rdi				");
+asm("	pop	%r15				");
+asm("	pop	%r14				");
+asm("	pop	%r13				");
+asm("	pop	%r12				");
+asm("	pop	%rbp				");
+asm("	pop	%rbx				");
+asm("	popfq					");
+asm("	ret					");
+
+//----------------------------------------------------------------
+// Pin this VM to one cpu (or unpin it, if the cpu-number is -1):
+// its VMCS then never has to be cleared and reloaded elsewhere,
+// and its guest's working-set stays in that processor's caches.
+// The pinning task's own affinity is saved when it first pins the
+// VM, and is given back to it when it unpins the VM.
+//----------------------------------------------------------------
+int my_pin( struct vmm_context *ctx, unsigned long buf )
+{
+	int	cpu, retval = 0;
+
+	if ( copy_from_user( &cpu, (void*)buf, sizeof( cpu ) ) ) return -EFAULT;
+
+	if ( cpu < 0 ) 
+		{
+		if (( ctx->pin_cpu >= 0 )&&( ctx->pin_task == current ))
+			retval = set_cpus_allowed( current, ctx->pin_saved );
+		ctx->pin_cpu = -1;
+		ctx->pin_task = NULL;
+		return	retval;
+		}
+	if (( cpu >= NR_CPUS )||( !cpu_online( cpu ) )) return -EINVAL;
+
+	if (( ctx->pin_cpu < 0 )||( ctx->pin_task != current ))
+		{
+		ctx->pin_task = current;
+		ctx->pin_saved = current->cpus_allowed;
+		}
+	ctx->pin_cpu = cpu;
+	return	set_cpus_allowed( current, cpumask_of_cpu( cpu ) );
+}
+
+// a pinned VM is run only on its own cpu: our ring-thread is moved
+// there, but any other task must already be running there itself
+int stay_pinned( struct vmm_context *ctx )
+{
+	if (( ctx->pin_cpu < 0 )||( raw_smp_processor_id() == ctx->pin_cpu )) 
+		return	0;
+	if (( ctx->ring_task )&&( current == ctx->ring_task ))
+		return	set_cpus_allowed( current, cpumask_of_cpu( ctx->pin_cpu ) );
+	return	-EINVAL;
+}
+
+//----------------------------------------------------------------
+// Count the cycles since our guest's latest VM exit in the log2
+// bin for that exit's reason (a forwarded exit is timed until our
+// client runs this guest again, so it includes the client's work)
+//----------------------------------------------------------------
+void exit_latency( struct vmm_context *ctx )
+{
+	unsigned long long	cycles = read_tsc() - ctx->exit_tsc;
+	int			bin;
+
+	for (bin = 0; ( cycles >>= 1 )&&( bin < VMM_CYCLE_BINS - 1 ); bin++);
+	++ctx->stats.cycles[ ctx->timed_reason ][ bin ];
+	ctx->timed_reason = -1;
+}
+
+//----------------------------------------------------------------
+// Each ioctl starts the clock; every 'phase_mark' then charges the
+// cycles since the previous mark to the phase that just ended.  An
+// ioctl which ran our guest has its phases kept as the latest ones,
+// and added to the totals, when it returns.
+//----------------------------------------------------------------
+void phase_start( struct vmm_context *ctx )
+{
+	memset( ctx->phase_now, 0, sizeof( ctx->phase_now ) );
+	ctx->phase_ran = 0;
+	ctx->phase_tsc = read_tsc();
+}
+
+void phase_mark( struct vmm_context *ctx, int phase )
+{
+	unsigned long long	tsc = read_tsc();
+
+	ctx->phase_now[ phase ] += tsc - ctx->phase_tsc;
+	ctx->phase_tsc = tsc;
+}
+
+void phase_end( struct vmm_context *ctx )
+{
+	int	i;
+
+	phase_mark( ctx, PHASE_COPY_OUT );
+	if ( !ctx->phase_ran ) return;
+	for (i = 0; i < N_PHASES; i++)
+		{
+		ctx->phase_last[ i ] = ctx->phase_now[ i ];
+		ctx->phase_total[ i ] += ctx->phase_now[ i ];
+		}
+	++ctx->phase_calls;
+}
+
+//----------------------------------------------------------------
+// Here we setup our Virtual Machine (and its Manager): the fields
+// for the client's guest-state, our host-state and VMX controls,
+// of which those that changed get marked as dirty.  Our host-state
+// belongs to this cpu, so the caller must stay on it until done.
+//----------------------------------------------------------------
+void vmx_prepare( struct vmm_context *ctx )
+{
+	VMCS_FIELDS	*f = &ctx->vmcs;
+	regs_ia32	*vm = &ctx->vm;
+	struct host_state	*hs = &host_state[ smp_processor_id() ];
+	unsigned long 	value;	
+
+	phase_mark( ctx, PHASE_COPY_IN );
+
+	//----------------------------------------------------
+	// install the client's virtual-machine register-values
+	//---------------------------------------------------- 
+	f->guest_ES_selector = vm->es;
+	f->guest_CS_selector = vm->cs;
+	f->guest_SS_selector = vm->ss;
+	f->guest_DS_selector = vm->ds;
+	f->guest_FS_selector = vm->fs;
+	f->guest_GS_selector = vm->gs;
+	ctx->gpr[ GPR_RAX ] = vm->eax;
+	ctx->gpr[ GPR_RBX ] = vm->ebx;
+	ctx->gpr[ GPR_RCX ] = vm->ecx;
+	ctx->gpr[ GPR_RDX ] = vm->edx;
+	ctx->gpr[ GPR_RBP ] = vm->ebp;
+	ctx->gpr[ GPR_RSI ] = vm->esi;
+	ctx->gpr[ GPR_RDI ] = vm->edi;
+	f->guest_RSP = vm->esp;
+	f->guest_RIP = vm->eip;
+	f->guest_RFLAGS = vm->eflags; 
+
+	// insure the reserved RFLAGS-bits have their required values
+	f->guest_RFLAGS &= ~((1<<3)|(1<<5)|(1<<15));	// reserved 0-bits
+	f->guest_RFLAGS |= (1<<1);				// reserved 1-bits
+
+	// NOTE: Here we impose some othr RFLAGS settings
+	f->guest_RFLAGS |= (1<<17);	// for Virtual-8086 mode
+	f->guest_RFLAGS |= (3<<12);	// for IO-privilege-level 
+	f->guest_RFLAGS &= ~(1<<14);	// for NT (Nested Task)
+
+	// setup the other Guest-state fields (for Virtual-8086 mode)
+	f->guest_ES_base = (f->guest_ES_selector << 4);
+	f->guest_CS_base = (f->guest_CS_selector << 4);
+	f->guest_SS_base = (f->guest_SS_selector << 4);
+	f->guest_DS_base = (f->guest_DS_selector << 4);
+	f->guest_FS_base = (f->guest_FS_selector << 4);
+	f->guest_GS_base = (f->guest_GS_selector << 4);
+	f->guest_ES_limit = 0xFFFF;
+	f->guest_CS_limit = 0xFFFF;
+	f->guest_SS_limit = 0xFFFF;
+	f->guest_DS_limit = 0xFFFF;
+	f->guest_FS_limit = 0xFFFF;
+	f->guest_GS_limit = 0xFFFF;
+	f->guest_ES_access_rights = 0xF3;
+	f->guest_CS_access_rights = 0xF3;
+	f->guest_SS_access_rights = 0xF3;
+	f->guest_DS_access_rights = 0xF3;
+	f->guest_FS_access_rights = 0xF3;
+	f->guest_GS_access_rights = 0xF3;
+
+	f->guest_CR0 = 0x80000031;
+	f->guest_CR4 = 0x00002001;
+	f->guest_CR3 = ctx->pgdir_region;
+	f->guest_VMCS_link_pointer_full = ~0L;
+	f->guest_VMCS_link_pointer_high = ~0L;
+
+	f->guest_IDTR_base = LEGACY_REACH + IDT_KERN_OFFSET;
+	f->guest_GDTR_base = LEGACY_REACH + GDT_KERN_OFFSET;
+	f->guest_LDTR_base = LEGACY_REACH + LDT_KERN_OFFSET;
+	f->guest_TR_base   = LEGACY_REACH + TSS_KERN_OFFSET;
+
+	f->guest_IDTR_limit = (256 * 8) - 1;	// 256 descriptors
+	f->guest_GDTR_limit = (3 * 8) - 1;		// 3 descriptors
+	f->guest_LDTR_limit = (4 * 8) - 1;		// 4 descriptors
+	f->guest_TR_limit   = (26 * 4) + 0x20 + 0x2000;
+	f->guest_LDTR_access_rights = 0x82;
+	f->guest_TR_access_rights   = 0x8B;
+	f->guest_LDTR_selector = __SELECTOR_LDTR;
+	f->guest_TR_selector   = __SELECTOR_TASK;
+	phase_mark( ctx, PHASE_FIELDS );
+
+	//------------------------------------------------------
+	// initialize this context's fields for our Host's state:
+	// what belongs to this cpu comes from 'host_state', so we
+	// only read what belongs to the calling task
+	//------------------------------------------------------
+	if ( !hs->valid ) host_capture( NULL );	// (cpu just came online)
+	asm(" mov %%cr0, %0 " : "=r" (value));	f->host_CR0 = value;
+	asm(" mov %%cr4, %0 " : "=r" (value));	f->host_CR4 = value;
+	asm(" mov %%cr3, %0 " : "=r" (value));	f->host_CR3 = value;
+	asm(" mov %%es, %0 " : "=r" (f->host_ES_selector));
+	asm(" mov %%ds, %0 " : "=r" (f->host_DS_selector));
+	asm(" mov %%fs, %0 " : "=r" (f->host_FS_selector));
+	asm(" mov %%gs, %0 " : "=r" (f->host_GS_selector));
+	f->host_CS_selector = hs->cs;
+	f->host_SS_selector = hs->ss;
+	f->host_GDTR_base = hs->gdtr.address;
+	f->host_IDTR_base = hs->idtr.address;
+	f->host_TR_selector = hs->tr;
+	f->host_TR_base = hs->tr_base;
+
+	f->host_SYSENTER_CS  = hs->sysenter_cs;
+	f->host_SYSENTER_ESP = hs->sysenter_esp;
+	f->host_SYSENTER_EIP = hs->sysenter_eip;
+	
+	// the FS base is the calling task's (its thread-local storage)
+	f->host_FS_base = read_msr( 0xC0000100 );
+	f->host_GS_base = hs->gs_base;
+
+	// our VM exits arrive at 'vmx_exit' (see 'vmx_enter' above)
+	f->host_RIP = (unsigned long)vmx_exit;
+	phase_mark( ctx, PHASE_HOST );
+
+	//------------------------------------------------------
+	// initialize this context's fields for our VMX controls 
+	//------------------------------------------------------
+
+	// (from our profile, see 'vmx_negotiate')
+	f->control_VMX_pin_based = vmx_ctls[ CTLS_PIN ];
+	if (( ctx->deadline || ctx->ticking )
+		&&( vmx_ctls_may[ CTLS_PIN ] & (1<<6) ))
+		f->control_VMX_pin_based |= (1<<6);	// preemption timer
+
+	f->control_VMX_cpu_based = vmx_ctls[ CTLS_CPU ];
+	f->control_MSR_Bitmaps_address_full = ( ctx->msrbm_region >>  0 );
+	f->control_MSR_Bitmaps_address_high = ( ctx->msrbm_region >> 32 );
+
+	// ports 0x0000-0x7FFF in bitmap A, ports 0x8000-0xFFFF in B
+	f->control_IO_BitmapA_address_full = ( ctx->iomap_region >>  0 );
+	f->control_IO_BitmapA_address_high = ( ctx->iomap_region >> 32 );
+	f->control_IO_BitmapB_address_full = ( ctx->iomap_region + 0x1000 );
+	f->control_IO_BitmapB_address_high = ( ctx->iomap_region + 0x1000 ) >> 32;
+
+	f->control_VM_exit_controls = vmx_ctls[ CTLS_EXIT ];
+	f->control_VM_entry_controls = vmx_ctls[ CTLS_ENTRY ];
+	f->control_VM_entry_interruption_information = 0;  // see 'event_inject'
+
+	f->control_CR0_mask   = 0x80000021;
+ 	f->control_CR0_shadow = 0x80000021;
+
+	f->control_CR4_mask   = 0x00002001;
+ 	f->control_CR4_shadow = 0x00002001;
+	
+	f->control_CR3_target_count = 2;
+	f->control_CR3_target0 = f->guest_CR3;
+	f->control_CR3_target1 = f->host_CR3;
+	f->control_pagefault_errorcode_mask  = 0x00000000;
+	f->control_pagefault_errorcode_match = 0xFFFFFFFF;
+	phase_mark( ctx, PHASE_FIELDS );
+
+	//-------------------------------------------------------
+	// our VM exits load no MSRs: the syscall MSRs our guest
+	// could write are put back by 'host_msrs_restore' (from
+	// 'host_state', once the calling task's KERNEL_GS_BASE is
+	// in there) when we're done running the guest
+	//-------------------------------------------------------
+	f->control_VM_exit_MSR_load_count = 0;
+	if ( ctx->msr_clobber & 1 ) 
+		hs->msrs[ 0 ] = read_msr( MSR_KERNEL_GS_BASE );
+	phase_mark( ctx, PHASE_HOST_MSRS );
+
+	// mark the VMCS fields whose values differ from our shadows
+	vmx_scan( ctx );
+	phase_mark( ctx, PHASE_SCAN );
+}
+
+//----------------------------------------------------------------
+// The VMX-preemption timer counts down at the TSC's rate divided
+// by 2^N (N is in bits 4:0 of IA32_VMX_MISC), and causes a VM exit
+// when it reaches zero; here we convert what remains of a budget
+//----------------------------------------------------------------
+unsigned long preempt_ticks( struct vmm_context *ctx )
+{
+	unsigned long long	now = read_tsc(), ticks = 0;
+	unsigned long long	wake = ctx->deadline;
+
+	// (the guest also exits when its next timer-tick falls due)
+	if (( ctx->ticking )&&(( !wake )||( ctx->vpic.next < wake )))
+		wake = ctx->vpic.next;
+	if ( wake > now ) 
+		ticks = ( wake - now ) >> ( msr0x480[ 5 ] & 0x1F );
+	return	( ticks > 0xFFFFFFFF ) ? 0xFFFFFFFF : ticks;
+}
+
+int my_budget( struct vmm_context *ctx, unsigned long buf )
+{
+	budget_ia32	budget;
+
+	if ( copy_from_user( &budget, (void*)buf, sizeof( budget ) ) ) 
+		return -EFAULT;
+	ctx->budget = budget.cycles;
+	if ( !ctx->budget ) 
+		ctx->budget = (unsigned long long)budget.microseconds * tsc_khz / 1000;
+	return	0;
+}
+
+//----------------------------------------------------------------
+// Give a guest its own virtual timer and PIC (see 'vmpic.h'): its
+// accesses to their ports are made to exit, and are completed by
+// our driver, so its ROM-BIOS timer code works as on a real 8086
+//----------------------------------------------------------------
+int my_vtimer( struct vmm_context *ctx, unsigned long buf )
+{
+	unsigned char	*iomap = phys_to_virt( ctx->iomap_region );
+	vtimer_ia32	vt;
+	unsigned int	reload;
+
+	if ( copy_from_user( &vt, (void*)buf, sizeof( vt ) ) ) return -EFAULT;
+	if ( vt.hz > VPIT_HZ ) return -EINVAL;
+
+	if (( vt.hz )&&( !ctx->vpic_on ))
+		{
+		vpic_reset( &ctx->vpic );
+		ctx->vpic_iomap[ 0 ] = iomap[ 0x20 >> 3 ] & VPIC_PORTS_20;
+		ctx->vpic_iomap[ 1 ] = iomap[ 0x40 >> 3 ] & VPIC_PORTS_40;
+		iomap[ 0x20 >> 3 ] |= VPIC_PORTS_20;
+		iomap[ 0x40 >> 3 ] |= VPIC_PORTS_40;
+		ctx->vpic_on = 1;
+		}
+	else if (( !vt.hz )&&( ctx->vpic_on ))
+		{
+		iomap[ 0x20 >> 3 ] &= ~VPIC_PORTS_20;
+		iomap[ 0x40 >> 3 ] &= ~VPIC_PORTS_40;
+		iomap[ 0x20 >> 3 ] |= ctx->vpic_iomap[ 0 ];
+		iomap[ 0x40 >> 3 ] |= ctx->vpic_iomap[ 1 ];
+		ctx->vpic.period = 0;
+		ctx->vpic.irr = ctx->vpic.isr = 0;
+		ctx->vpic_on = 0;
+		}
+
+	// (the slowest rate an 8254 can give is with its count of 0)
+	if ( vt.hz )
+		{
+		reload = VPIT_HZ / vt.hz;
+		vpit_program( &ctx->vpic, ( reload > 0xFFFF ) ? 0 : reload,
+								read_tsc() );
+		}
+
+	vt.reload = ctx->vpic.reload;
+	vt.ticks = ctx->vpic.ticks;
+	vt.merged = ctx->vpic.merged;
+	if ( copy_to_user( (void*)buf, &vt, sizeof( vt ) ) ) return -EFAULT;
+	return	0;
+}
+
+//----------------------------------------------------------------
+// Queue an event for our guest (see 'event_ia32' in 'myvmx.h'):
+// this is done without taking the VM's 'lock', so that an event
+// can reach a guest whose call is already running 
+//----------------------------------------------------------------
+void event_kick( void *info )
+{
+	// (the interrupt which brought us here made the guest exit)
+}
+
+int my_event( struct vmm_context *ctx, unsigned long buf )
+{
+	event_ia32	ev;
+	unsigned long	flags;
+	int		cpu, retval = 0;
+
+	if ( copy_from_user( &ev, (void*)buf, sizeof( ev ) ) ) return -EFAULT;
+	if ( ev.vector > 255 ) return -EINVAL;
+	if (( ev.type == VMM_EVENT_NMI )&&( ev.vector != 2 )) return -EINVAL;
+	if (( ev.type == VMM_EVENT_EXCEPTION )&&( ev.vector > 31 )) 
+		return -EINVAL;
+	if (( ev.type != VMM_EVENT_EXTINT )&&( ev.type != VMM_EVENT_NMI )
+		&&( ev.type != VMM_EVENT_EXCEPTION )) return -EINVAL;
+
+	spin_lock_irqsave( &ctx->event_lock, flags );
+	if ( ctx->event_tail - ctx->event_head >= MAX_EVENTS ) retval = -EAGAIN;
+	else	{
+		ctx->events[ ctx->event_tail % MAX_EVENTS ].event = ev;
+		ctx->events[ ctx->event_tail % MAX_EVENTS ].queued = read_tsc();
+		++ctx->event_tail;
+		}
+	cpu = ctx->guest_cpu;
+	spin_unlock_irqrestore( &ctx->event_lock, flags );
+
+	// a guest that is running now gets made to exit, so its event
+	// can be injected at once (rather than at its next call), and
+	// one which has halted is woken up
+	if (( retval == 0 )&&( cpu >= 0 ))
+		smp_call_function_single( cpu, event_kick, NULL, 0, 0 );
+	if ( retval == 0 ) wake_up_interruptible( &ctx->idle_wait );
+	return	retval;
+}
+
+int my_eventlog( struct vmm_context *ctx, unsigned long buf )
+{
+	eventlog_ia32	log;
+	unsigned long	flags;
+
+	spin_lock_irqsave( &ctx->event_lock, flags );
+	log = ctx->eventlog;
+	log.pending = ctx->event_tail - ctx->event_head;
+	ctx->eventlog.count = 0;
+	spin_unlock_irqrestore( &ctx->event_lock, flags );
+
+	if ( copy_to_user( (void*)buf, &log, sizeof( log ) ) ) return -EFAULT;
+	return	0;
+}
+
+void event_delivered( struct vmm_context *ctx, event_ia32 *ev, 
+					unsigned long long cycles )
+{
+	eventlog_ia32	*log = &ctx->eventlog;
+
+	if ( log->count == VMM_DELIVERIES ) 
+		{
+		memmove( log->recent, log->recent + 1, 
+			( VMM_DELIVERIES - 1 ) * sizeof( delivery_ia32 ) );
+		--log->count;
+		}
+	log->recent[ log->count ].id = ev->id;
+	log->recent[ log->count ].vector = ev->vector;
+	log->recent[ log->count ].cycles = cycles;
+	++log->count;
+	++log->delivered;
+
+	ctx->event_cycles += cycles;
+	if ( cycles > ctx->event_cycles_max ) ctx->event_cycles_max = cycles;
+}
+
+//----------------------------------------------------------------
+// A guest in virtual-8086 mode takes each event -- an interrupt,
+// an NMI or an exception -- through its real-mode vector-table, as
+// an 8086 would (the IDT it runs with has only our #GP handler, so
+// nothing is ever injected there); we push FLAGS, CS and IP on its
+// stack, and clear IF and TF, just as its processor would have done
+//----------------------------------------------------------------
+int vm86_reflect( struct vmm_context *ctx, unsigned int vector, 
+					unsigned long long rflags )
+{
+	unsigned long long	rsp;
+	unsigned short	*stack, ss, sp, cs, ip;
+	unsigned int	*ivt = phys_to_virt( ctx->lower_region );
+
+	ss = vmx_exit_read( ctx, VMCS_GUEST_SS );
+	rsp = vmx_exit_read( ctx, VMCS_GUEST_RSP );
+	cs = vmx_exit_read( ctx, VMCS_GUEST_CS );
+	ip = vmx_exit_read( ctx, VMCS_GUEST_RIP );
+
+	// (a stack that wraps, or isn't in conventional memory, can't be)
+	sp = (unsigned short)( rsp - 6 );
+	if (( sp > 0xFFFA )||( ( ss << 4 ) + sp + 6 > LEGACY_VIDEO )) return -1;
+
+	stack = phys_to_virt( ctx->lower_region + ( ss << 4 ) + sp );
+	stack[ 0 ] = ip;
+	stack[ 1 ] = cs;
+	stack[ 2 ] = (unsigned short)rflags;
+
+	vmx_exit_write( ctx, VMCS_GUEST_RSP, ( rsp & ~0xFFFFULL ) | sp );
+	vmx_exit_write( ctx, VMCS_GUEST_CS, ivt[ vector ] >> 16 );
+	vmx_exit_write( ctx, VMCS_GUEST_CS_BASE, ( ivt[ vector ] >> 16 ) << 4 );
+	vmx_exit_write( ctx, VMCS_GUEST_RIP, ivt[ vector ] & 0xFFFF );
+	vmx_exit_write( ctx, VMCS_GUEST_RFLAGS, rflags & ~( (1<<9) | (1<<8) ) );
+	return	0;
+}
+
+//----------------------------------------------------------------
+// Before each VM entry: deliver our oldest queued event (or else an
+// interrupt from our virtual PIC) if the guest can take it now, and
+// ask for an interrupt-window exit while any more are waiting (that
+// comes as soon as the guest sets IF=1, or at once if IF=1 already).
+// Nothing is delivered outside virtual-8086 mode (while our guest's
+// #GP handler runs), and an event whose reflection fails is dropped.
+//----------------------------------------------------------------
+void event_inject( struct vmm_context *ctx )
+{
+	VMCS_FIELDS	*f = &ctx->vmcs;
+	event_ia32	*ev;
+	unsigned long long	rflags = 0, blocking = 0;
+	unsigned long	flags;
+	unsigned int	window = 0, queued;
+	int		vm86, ready, irq = -1;
+
+	// our virtual timer raises IRQ0 whenever a tick falls due
+	if ( ctx->vpic_on ) 
+		{
+		vpic_tick( &ctx->vpic, read_tsc() );
+		irq = vpic_pending( &ctx->vpic );
+		}
+
+	// (nearly always there are no events, and no window-exiting)
+	if (( ctx->event_head == ctx->event_tail )&&( irq < 0 )
+		&&( !( f->control_VMX_cpu_based & (1<<2) ) )) return;
+
+	spin_lock_irqsave( &ctx->event_lock, flags );
+	queued = ( ctx->event_head != ctx->event_tail );
+	if (( queued )||( irq >= 0 ))
+		{
+		rflags = vmx_exit_read( ctx, VMCS_GUEST_RFLAGS );
+		blocking = vmx_exit_read( ctx, VMCS_GUEST_INTERRUPTIBILITY );
+		}
+	vm86 = ( rflags & (1<<17) ) != 0;
+	ready = ( vm86 )&&( rflags & (1<<9) )&&( !( blocking & 3 ) );
+
+	if ( queued )
+		{
+		ev = &ctx->events[ ctx->event_head % MAX_EVENTS ].event;
+		if (( vm86 )&&(( ev->type == VMM_EVENT_EXCEPTION )
+			||(( ev->type == VMM_EVENT_NMI )&&( !( blocking & 0xB ) ))
+			||(( ev->type == VMM_EVENT_EXTINT )&&( ready ))))
+			{
+			if ( vm86_reflect( ctx, ev->vector, rflags ) == 0 )
+				event_delivered( ctx, ev, read_tsc() - 
+				ctx->events[ ctx->event_head % MAX_EVENTS ].queued );
+			else	++ctx->events_dropped;
+			++ctx->event_head;
+			}
+		}
+	else if (( irq >= 0 )&&( ready ))
+		{
+		if ( vm86_reflect( ctx, vpic_ack( &ctx->vpic ), rflags ) )
+			++ctx->events_dropped;
+		}
+
+	window = ( ctx->event_head != ctx->event_tail );
+	spin_unlock_irqrestore( &ctx->event_lock, flags );
+	if (( ctx->vpic_on )&&( vpic_pending( &ctx->vpic ) >= 0 )) window = 1;
+
+	if ( ( ( f->control_VMX_cpu_based >> 2 ) & 1 ) != window )
+		vmx_exit_write( ctx, VMCS_CPU_BASED, 
+				f->control_VMX_cpu_based ^ (1<<2) );
+}
+
+//----------------------------------------------------------------
+// Is there an event our halted guest (which has IF=1) could take?
+//----------------------------------------------------------------
+int event_wakeup( struct vmm_context *ctx )
+{
+	if ( ctx->event_head != ctx->event_tail ) return 1;
+	if ( !ctx->vpic_on ) return 0;
+	vpic_tick( &ctx->vpic, read_tsc() );
+	return	( vpic_pending( &ctx->vpic ) >= 0 );
+}
+
+//----------------------------------------------------------------
+// A guest which has halted sleeps here, off its cpu, until it has
+// an event: one queued by VMM_EVENT (which wakes us), or its next
+// virtual timer-tick (which we wait for); the call ends instead if
+// its budget runs out, or if our client's process gets a signal
+//----------------------------------------------------------------
+int vmx_idle( struct vmm_context *ctx )
+{
+	unsigned long long	start = read_tsc(), now, wake;
+	long			timeout;
+	int			retval = 0;
+
+	++ctx->idles;
+	while ( !event_wakeup( ctx ) )
+		{
+		now = read_tsc();
+		if (( ctx->deadline )&&( now >= ctx->deadline ))
+			{ ++ctx->expired; retval = -ETIMEDOUT; break; }
+		if ( kthread_should_stop() ) { retval = -EINTR; break; }
+
+		wake = ctx->deadline;
+		if (( ctx->ticking )&&(( !wake )||( ctx->vpic.next < wake )))
+			wake = ctx->vpic.next;
+		timeout = MAX_SCHEDULE_TIMEOUT;
+		if (( wake > now )&&( tsc_khz ))
+			timeout = usecs_to_jiffies( ( wake - now ) * 1000 / tsc_khz ) + 1;
+		else if ( wake ) timeout = 1;
+
+		if ( wait_event_interruptible_timeout( ctx->idle_wait,
+			( ctx->event_head != ctx->event_tail )
+			||( kthread_should_stop() ), timeout ) < 0 )
+			{ retval = -EINTR; break; }
+		}
+	ctx->idle_cycles += read_tsc() - start;
+	return	retval;
+}
 
-int my_open( struct inode *inode, struct file *file )
+// a guest which made the VMM_HC_YIELD hypercall lets others run
+int vmx_yield( struct vmm_context *ctx )
 {
-	unsigned long long	*g_idt, *g_gdt, *g_ldt, desc;
-	unsigned int		*pgdir, *pgtbl, *g_tss, i;
+	++ctx->yields;
+	yield();
+	if (( signal_pending( current ) )||( kthread_should_stop() )) 
+		return	-EINTR;
+	if (( ctx->deadline )&&( read_tsc() >= ctx->deadline ))
+		{
+		++ctx->expired;
+		return	-ETIMEDOUT;
+		}
+	return	0;
+}
 
-	// reinitialize the VMCS regions
-	memset( phys_to_virt( vmxon_region ), 0x00, 0x1000 );		
-	memcpy( phys_to_virt( vmxon_region ), msr0x480, 4  );		
-	memset( phys_to_virt( guest_region ), 0x00, 0x1000 );		
-	memcpy( phys_to_virt( guest_region ), msr0x480, 4  );		
+//----------------------------------------------------------------
+// Here we launch our Virtual Machine (and its Manager): the guest
+// runs in slices, each ending when it halts with nothing pending
+// (it then sleeps, in 'vmx_idle', until it has an event to take)
+//----------------------------------------------------------------
+int vmx_run( struct vmm_context *ctx )
+{
+	VMCS_FIELDS	*f = &ctx->vmcs;
+	regs_ia32	*vm = &ctx->vm;
+	struct host_state	*hs;
+	unsigned short	host_ldtr, reason;
+	unsigned long	flags;
+	int		status, handled = EXIT_FORWARD, expired = 0, retval = 0;
+
+	ctx->idle = 0;
+
+	//------------------------------------------------------------
+	// stay on this cpu while our VMCS is current, then write the
+	// fields which changed, and launch (or resume) the Guest task
+	//------------------------------------------------------------
+	hs = &host_state[ get_cpu() ];
+	ctx->phase_ran = 1;
+	vmx_prepare( ctx );
+	asm(" sldt %0 " : "=m" (host_ldtr) );
+	phase_mark( ctx, PHASE_HOST );
+	if ( vmx_load( ctx ) ) status = -EIO;
+	else	{
+		phase_mark( ctx, PHASE_VMX_LOAD );
+		status = vmx_write_dirty( ctx );
+		phase_mark( ctx, PHASE_VMWRITES );
+		}
+	if ( status )
+		{
+		ctx->stale = VMCS_STALE;
+		put_cpu();
+		return	-EIO;
+		}
 
-	// initialize the Guest Page-Directory and Page-Table
-	pgdir = (unsigned int*)phys_to_virt( pgdir_region );
-	for (i = 0; i < 1024; i++)
-		pgdir[ i ] = ( i == 0 ) ? pgtbl_region | 0x007 : 0;
+	// events queued from now on get our cpu to make the guest exit
+	spin_lock_irqsave( &ctx->event_lock, flags );
+	ctx->guest_cpu = smp_processor_id();
+	spin_unlock_irqrestore( &ctx->event_lock, flags );
 
-	pgtbl = (unsigned int*)phys_to_virt( pgtbl_region );
-	for (i = 0; i < 0xA0; i++)
+	for (;;)
 		{
-		unsigned int	page_address = (i << PAGE_SHIFT); 
-		pgtbl[ i ] = (lower_region + page_address) | 0x007;
+		// time the guest's previous exit, which ends right here
+		if ( ctx->timed_reason >= 0 ) exit_latency( ctx );
+
+		// inject a queued event, if the guest can take one now
+		event_inject( ctx );
+
+		// the timer gets whatever remains of this call's budget
+		if ( f->control_VMX_pin_based & (1<<6) )
+			do_vmwrite( PREEMPT_TIMER, preempt_ticks( ctx ) );
+
+		++ctx->entries;
+		phase_mark( ctx, PHASE_HANDLERS );
+		status = vmx_enter( ctx->gpr, ctx->launched );
+		ctx->exit_tsc = read_tsc();
+		phase_mark( ctx, PHASE_GUEST );
+
+		//-------------------------------------------------------
+		// restore some system-registers that VMX left corrupted
+		//-------------------------------------------------------
+		asm(" lgdt %0 \n lidt %1 " :: "m" (hs->gdtr), "m" (hs->idtr));
+		asm(" lldt %0 " :: "m" (host_ldtr));
+		phase_mark( ctx, PHASE_TABLES );
+
+		if ( status ) break;
+		ctx->launched = 1;
+		vmx_read_exit( ctx );
+		vmx_trace_exit( ctx );
+		phase_mark( ctx, PHASE_RESULTS );
+
+		// resume the guest if a handler completes this VM exit 
+		reason = (unsigned short)f->info_vmexit_reason;
+		handled = exit_dispatch( &ctx->exit, f->info_vmexit_reason );
+		if ( reason < VMM_REASONS )
+			{
+			if ( handled != EXIT_FORWARD ) ++ctx->stats.handled[ reason ];
+			else	++ctx->stats.forwarded[ reason ];
+			ctx->timed_reason = reason;
+			}
+		if (( reason == 31 )||( reason == 32 )) 
+			msr_exit_count( ctx, ctx->gpr[ GPR_RCX ], reason == 32 );
+
+		// a guest which has used up its budget is stopped here (a
+		// host without the preemption timer checks at each exit,
+		// and our exit on external interrupts bounds the delay;
+		// the timer may instead have woken us for a timer-tick)
+		if (( handled != EXIT_FORWARD )
+			&&( ctx->deadline )&&( ctx->exit_tsc >= ctx->deadline ))
+			{
+			expired = 1;
+			break;
+			}
+
+		// a halted guest resumes at once if it has an event to take
+		if (( handled == EXIT_IDLE )&&( event_wakeup( ctx ) )) 
+			handled = EXIT_RESUME;
+		if ( handled != EXIT_RESUME ) break;
+
+		if ( reason == 0 ) ++ctx->nmiints;
+		if ( reason == 1 ) ++ctx->extints;
 		}
-	for (i = 0xA0; i < 0x100; i++)
+
+	spin_lock_irqsave( &ctx->event_lock, flags );
+	ctx->guest_cpu = -1;
+	spin_unlock_irqrestore( &ctx->event_lock, flags );
+	ctx->idle = 0;
+	if (( status == 0 )&&( !expired )&&( handled != EXIT_FORWARD ))
+		ctx->idle = handled;	// (EXIT_IDLE or EXIT_YIELD)
+
+	// now read the guest-state our client expects to get back
+	phase_mark( ctx, PHASE_HANDLERS );
+	host_msrs_restore( ctx, hs );
+	if ( status == 0 ) 
 		{
-		unsigned int	page_address = (i << PAGE_SHIFT); 
-		pgtbl[ i ] = page_address | 0x007;
+		vmcs_read_results( ctx, RD_GUEST | RD_ERROR | ctx->read_extra );
+		retval = f->info_vminstr_error;
+		if ( expired ) { ++ctx->expired; retval = -ETIMEDOUT; }
+		phase_mark( ctx, PHASE_RESULTS );
 		}
-	for (i = 0x100; i < 0x110; i++)
-		{
-		unsigned int	page_address = ((i - 0x100) << PAGE_SHIFT); 
-		pgtbl[ i ] = (lower_region + page_address) | 0x007;
+	else	{
+		// VMfailValid (ZF=1) leaves an error-number in the VMCS
+		if ( status == 2 ) 
+			{
+			vmcs_read_results( ctx, RD_ERROR );
+			retval = f->info_vminstr_error;
+			}
+		else	retval = -EIO;
+
+		// a failed entry means we rewrite (and relaunch) next time
+		vmx_clear( ctx );
+		ctx->stale = VMCS_STALE;
 		}
-	for (i = 0x110; i < 0x120; i++)
+	put_cpu();
+
+	// ----------------------------------------------------
+	// update the client's virtual-machine register-values
+	// ----------------------------------------------------
+	vm->eax = ctx->gpr[ GPR_RAX ];
+	vm->ebx = ctx->gpr[ GPR_RBX ];
+	vm->ecx = ctx->gpr[ GPR_RCX ];
+	vm->edx = ctx->gpr[ GPR_RDX ];
+	vm->ebp = ctx->gpr[ GPR_RBP ];
+	vm->esi = ctx->gpr[ GPR_RSI ];
+	vm->edi = ctx->gpr[ GPR_RDI ];
+	vm->eip = f->guest_RIP;
+	vm->esp = f->guest_RSP;
+	vm->eflags = f->guest_RFLAGS;
+	vm->es  = f->guest_ES_selector;
+	vm->cs  = f->guest_CS_selector;
+	vm->ss  = f->guest_SS_selector;
+	vm->ds  = f->guest_DS_selector;
+	vm->fs  = f->guest_FS_selector;
+	vm->gs  = f->guest_GS_selector;
+
+	// the pseudo-files now report on this virtual machine
+	mutex_lock( &vmm_proc_lock );
+	vmm_last = ctx;
+	mutex_unlock( &vmm_proc_lock );
+
+	return	retval;
+}
+
+//----------------------------------------------------------------
+// Our software backend's counterpart to 'event_inject': the vector
+// (if any) which our interpreter should deliver through the guest's
+// IVT before its next block, from our queue or our virtual PIC
+//----------------------------------------------------------------
+int soft_irq( void *dev, int ready )
+{
+	struct vmm_context	*ctx = dev;
+	event_ia32		*ev;
+	unsigned long		flags;
+	int			vector = -1;
+
+	if ( ctx->vpic_on ) vpic_tick( &ctx->vpic, read_tsc() );
+	if (( ctx->event_head == ctx->event_tail )
+		&&(( !ready )||( !ctx->vpic_on )
+		||( vpic_pending( &ctx->vpic ) < 0 ))) return -1;
+
+	spin_lock_irqsave( &ctx->event_lock, flags );
+	if ( ctx->event_head != ctx->event_tail )
 		{
-		unsigned int	page_address = ((i - 0x60) << PAGE_SHIFT); 
-		pgtbl[ i ] = (lower_region + page_address) | 0x007;
+		ev = &ctx->events[ ctx->event_head % MAX_EVENTS ].event;
+		if (( ev->type != VMM_EVENT_EXTINT )||( ready ))
+			{
+			vector = ev->vector;
+			event_delivered( ctx, ev, read_tsc() - 
+				ctx->events[ ctx->event_head % MAX_EVENTS ].queued );
+			++ctx->event_head;
+			}
 		}
-	for (i = 0x120; i < 0x400; i++) pgtbl[ i ] = 0;
-
+	else if ( ready ) vector = vpic_ack( &ctx->vpic );
+	spin_unlock_irqrestore( &ctx->event_lock, flags );
+	return	vector;
+}
 
-	// initialize our Guest task's interrupt-handler region
-	memcpy( phys_to_virt( g_ISR_region ), isr_gpfault, 32 ); 
+// our interpreter's VMCALL goes to the same handler a VM exit would
+int soft_hypercall( void *dev, unsigned int insn_len )
+{
+	struct vmm_context	*ctx = dev;
+	regs_ia32		*vm = &ctx->vm;
+	int			handled;
+
+	ctx->gpr[ GPR_RAX ] = vm->eax;
+	ctx->gpr[ GPR_RBX ] = vm->ebx;
+	ctx->gpr[ GPR_RCX ] = vm->ecx;
+	ctx->gpr[ GPR_RDX ] = vm->edx;
+	ctx->gpr[ GPR_RBP ] = vm->ebp;
+	ctx->gpr[ GPR_RSI ] = vm->esi;
+	ctx->gpr[ GPR_RDI ] = vm->edi;
+	ctx->vmcs.info_vmexit_instruction_length = insn_len;
+
+	handled = exit_vmcall( &ctx->exit );
+	if ( handled == EXIT_FORWARD ) return EXIT_FORWARD;
+	++ctx->stats.handled[ EXIT_VMCALL ];
+
+	vm->eax = ctx->gpr[ GPR_RAX ];
+	vm->ebx = ctx->gpr[ GPR_RBX ];
+	vm->ecx = ctx->gpr[ GPR_RCX ];
+	vm->edx = ctx->gpr[ GPR_RDX ];
+	vm->ebp = ctx->gpr[ GPR_RBP ];
+	vm->esi = ctx->gpr[ GPR_RSI ];
+	vm->edi = ctx->gpr[ GPR_RDI ];
+	return	handled;
+}
 
-	// initialize our Guest task's IDT
-	g_idt = (unsigned long long*)phys_to_virt( g_IDT_region );
-	desc = LEGACY_REACH + ISR_KERN_OFFSET; 	// offset for GPF handler
-	desc &= 0x00000000FFFFFFFFLL;
-	desc |= (desc << 32);
-	desc &= 0xFFFF00000000FFFFLL; 
-	desc |= (__SELECTOR_CODE << 16);
-	desc |= (0x8E00LL << 32);	// DPL=0, 386-INTR-gate
-	g_idt[ 13 ] = desc;		// General Protection Fault		
+//----------------------------------------------------------------
+// Run our guest in our interpreter (see 'vmsoft.h'), a slice of
+// instructions at a time, until it makes a VM exit of its own; we
+// fill in the exit-fields our callers expect (as if we had read
+// them from a VMCS), and check this call's budget between slices
+//----------------------------------------------------------------
+int soft_run( struct vmm_context *ctx )
+{
+	VMCS_FIELDS	*f = &ctx->vmcs;
+	regs_ia32	*vm = &ctx->vm;
+	SOFT_CPU	cpu;
+	int		retval = 0;
 
-	// initialize our Guest task's GDT
-	g_gdt = (unsigned long long*)phys_to_virt( g_GDT_region );
+	ctx->idle = 0;
+	if ( !ctx->soft_cache )
+		{
+		ctx->soft_cache = vmalloc( sizeof( SOFT_CACHE ) );
+		if ( !ctx->soft_cache ) return -ENOMEM;
+		soft_cache_init( ctx->soft_cache );
+		}
 
-	desc = LEGACY_REACH + TSS_KERN_OFFSET;
-	desc = ((desc & 0xFF000000)<<32)|((desc & 0x00FFFFFF)<<16);
-	desc |= ( 8328 ) | (0x008BLL << 40);
-	g_gdt[ __SELECTOR_TASK >> 3 ] = desc;
+	// our client may have rewritten any code in RAM since last time
+	soft_flush( ctx->soft_cache, 0 );
+
+	memset( &cpu, 0, sizeof( cpu ) );
+	cpu.regs = vm;
+	cpu.low = phys_to_virt( ctx->lower_region );
+	cpu.high = phys_to_virt( 0 );
+	cpu.iomap = phys_to_virt( ctx->iomap_region );
+	cpu.cache = ctx->soft_cache;
+	cpu.dev = ctx;
+	cpu.ioport = vmx_exit_ioport;
+	cpu.irq = soft_irq;
+	cpu.hypercall = soft_hypercall;
+
+	ctx->phase_ran = 1;
+	++ctx->entries;
+	for (;;)
+		{
+		soft_exec( &cpu, 0x10000 );
+		if (( cpu.idle )&&( cpu.reason == EXIT_HLT )) 
+			++ctx->stats.handled[ EXIT_HLT ];
+
+		// a halted guest carries on at once if it has an event to take
+		if (( cpu.idle == EXIT_IDLE )&&( event_wakeup( ctx ) ))
+			cpu.stop = cpu.idle = 0;
+		if ( cpu.stop ) break;
+		if (( ctx->deadline )&&( read_tsc() >= ctx->deadline ))
+			{ ++ctx->expired; retval = -ETIMEDOUT; break; }
+		if (( signal_pending( current ) )||( kthread_should_stop() ))
+			{ retval = -EINTR; break; }
+		cond_resched();
+		}
+	phase_mark( ctx, PHASE_GUEST );
+
+	// the exit-fields, as a VM exit would have left them
+	f->info_vmexit_reason = cpu.reason;
+	f->info_vmexit_interrupt_information = cpu.intr_info;
+	f->info_vmexit_interrupt_error_code = 0;
+	f->info_vmexit_instruction_length = cpu.insn_len;
+	f->info_exit_qualification = cpu.qual;
+	f->info_IO_RCX = cpu.io_rcx;
+	f->info_guest_linear_address = cpu.linear;
+	f->info_vminstr_error = 0;
+	f->guest_RIP = vm->eip;
+	f->guest_RSP = vm->esp;
+	f->guest_RFLAGS = vm->eflags;
+	f->guest_ES_selector = vm->es;
+	f->guest_CS_selector = vm->cs;
+	f->guest_SS_selector = vm->ss;
+	f->guest_DS_selector = vm->ds;
+	f->guest_FS_selector = vm->fs;
+	f->guest_GS_selector = vm->gs;
+	ctx->results_valid = RD_ALL;
+	if (( cpu.stop )&&( !cpu.idle )&&( cpu.reason < VMM_REASONS ))
+		++ctx->stats.forwarded[ cpu.reason ];
+	if ( retval == 0 ) ctx->idle = cpu.idle;  // (EXIT_IDLE or EXIT_YIELD)
+	phase_mark( ctx, PHASE_RESULTS );
+
+	// the pseudo-files now report on this virtual machine
+	mutex_lock( &vmm_proc_lock );
+	vmm_last = ctx;
+	mutex_unlock( &vmm_proc_lock );
 
-	desc = LEGACY_REACH + LDT_KERN_OFFSET;
-	desc = ((desc & 0xFF000000)<<32)|((desc & 0x00FFFFFF)<<16);
-	desc |= ( 4 * 8 - 1) | (0x0082LL << 40);
-	g_gdt[ __SELECTOR_LDTR >> 3 ] = desc;
+	return	retval;
+}
 
-	// initialize our Guest task's LDT
-	g_ldt = (unsigned long long*)phys_to_virt( g_LDT_region );
+int my_vmrun( struct vmm_context *ctx )
+{
+	int	retval;
 
-	desc = 0x00CF9A000000FFFFLL;
-	g_ldt[ __SELECTOR_CODE >> 3 ] = desc;
+	// any I/O exit still pending is abandoned by this call
+	ctx->io_pending = 0;
 
-	desc = 0x00CF92000000FFFFLL;
-	g_ldt[ __SELECTOR_DATA >> 3 ] = desc; 
+	// a reset that was asked for while we were busy is done now
+	if ( ctx->stats_reset ) exit_stats_reset( ctx );
 
-	desc = 0x0000920B8000FFFFLL;
-	g_ldt[ __SELECTOR_VRAM >> 3 ] = desc;
+	// initialize our event counters
+ 	ctx->extints = 0;
+	ctx->nmiints = 0;
 
-	desc = 0x00CF92000000FFFFLL;
-	g_ldt[ __SELECTOR_FLAT >> 3 ] = desc;
+	// a pinned VM runs only on its own cpu
+	if ( stay_pinned( ctx ) ) return -EINVAL;
 
-	// initialize our Guest task's TSS
-	g_tss = (unsigned int*)phys_to_virt( g_TSS_region );
-	g_tss[0] = 0;			// back-link
-	g_tss[1] = LEGACY_REACH + ISR_KERN_OFFSET; // ESP0
-	g_tss[2] = __SELECTOR_FLAT;	           // SS0
-	g_tss[25] = 0x00880000;		// IOBITMAP offset
-	// number of bytes in TSS: 104 + 32 + 8192 = 8328
-	g_tss[ 8328 >> 2 ] = 0xFF;	// end of IOBITMAP
+	// this call's budget (if any) is counted from now
+	ctx->deadline = ( ctx->budget ) ? read_tsc() + ctx->budget : 0;
+	ctx->ticking = ( ctx->vpic_on )&&( ctx->vpic.period );
 
-	return	0;
+	for (;;)
+		{
+		retval = ( ctx->soft ) ? soft_run( ctx ) : vmx_run( ctx );
+		if ( !ctx->idle ) break;
+		if ( ctx->idle == EXIT_YIELD ) retval = vmx_yield( ctx );
+		else	retval = vmx_idle( ctx );
+		if ( retval ) break;
+		}
+	return	retval;
 }
 
 //----------------------------------------------------------------
-// Here we setup and launch our Virtual Machine (and its Manager)   
+// Run a batch of guest calls, with all the client's requests and
+// their results transferred by just one copy in each direction.
+// Chained batches repeat the first request, passing along EBX from
+// each result (as ROM-BIOS enumeration services expect) and moving
+// EDI ahead so that each call stores its output in a fresh place.
 //----------------------------------------------------------------
+int my_batch( struct vmm_context *ctx, unsigned long buf )
+{
+	batch_ia32	batch;
+	regs_ia32	*regs;
+	unsigned char	keep[ MAX_KEEP ];
+	unsigned int	ebx = 0;
+	int		i, nbytes, status = 0;
+
+	if ( copy_from_user( &batch, (void*)buf, sizeof( batch ) ) ) 
+		return -EFAULT;
+	if (( batch.count == 0 )||( batch.count > MAX_BATCH )) return -EINVAL;
+	if ( batch.keep_size > MAX_KEEP ) return -EINVAL;
+	if (( batch.keep_base > LEGACY_VIDEO )
+		||( batch.keep_size > LEGACY_VIDEO - batch.keep_base ))
+		return -EINVAL;
+
+	nbytes = batch.count * sizeof( regs_ia32 );
+	regs = kmalloc( nbytes, GFP_KERNEL );
+	if ( !regs ) return -ENOMEM;
+	if ( copy_from_user( regs, batch.regs, nbytes ) ) 
+		{ kfree( regs ); return -EFAULT; }
+
+	// snapshot the guest memory the client wants preserved
+	memcpy( keep, ctx->kmem + batch.keep_base, batch.keep_size );
+
+	for (i = 0; i < batch.count; i++)
+		{
+		if ( batch.flags & VMM_CHAIN_EBX )
+			{
+			if (( i > 0 )&&( ctx->vm.ebx == 0 )) break;
+			if (( i > 0 )&&( batch.flags & VMM_CHAIN_CF )
+				&&( ctx->vm.eflags & 1 )) break;
+			ebx = ctx->vm.ebx;
+			ctx->vm = regs[ 0 ];
+			if ( i > 0 ) ctx->vm.ebx = ebx;
+			ctx->vm.edi += i * batch.edi_step;
+			}
+		else	ctx->vm = regs[ i ];
+
+		memcpy( ctx->kmem + batch.keep_base, keep, batch.keep_size );
+		status = my_vmrun( ctx );
+		regs[ i ] = ctx->vm;
+		if ( status != 0 ) break;	// (or a VM-instruction error)
+		}
+	batch.done = i;
+	
+	if ( copy_to_user( batch.regs, regs, i * sizeof( regs_ia32 ) ) ) 
+		status = -EFAULT;
+	else if ( copy_to_user( (void*)buf, &batch, sizeof( batch ) ) )
+		status = -EFAULT;
+	kfree( regs );
+
+	return	status;
+}
 
-int my_ioctl( struct inode *inode, struct file *file, 
-				unsigned int len, unsigned long buf )
+int my_call( struct vmm_context *ctx, unsigned int len, unsigned long buf )
 {
-	unsigned long 	*host_gdt;	
-	signed long 	desc;
+	int	retval;
 
 	//--------------------------------------------------------
 	// sanity check: we require the client-process to pass an
 	// exact amount of data representing CPU's register-state
 	//--------------------------------------------------------
-	retval = -EINVAL;
-	if ( len != sizeof( regs_ia32 ) ) return retval;
+	if ( len != sizeof( regs_ia32 ) ) return -EINVAL;
 
 	//----------------------------------------------------
 	// fetch the client's virtual-machine register-values
 	//---------------------------------------------------- 
-	if ( copy_from_user( &vm, (void*)buf, len ) ) return -EFAULT;
-	guest_ES_selector = vm.es;
-	guest_CS_selector = vm.cs;
-	guest_SS_selector = vm.ss;
-	guest_DS_selector = vm.ds;
-	guest_FS_selector = vm.fs;
-	guest_GS_selector = vm.gs;
-	guest_RAX = vm.eax;
-	guest_RBX = vm.ebx;
-	guest_RCX = vm.ecx;
-	guest_RDX = vm.edx;
-	guest_RBP = vm.ebp;
-	guest_RSI = vm.esi;
-	guest_RDI = vm.edi;
-	guest_RSP = vm.esp;
-	guest_RIP = vm.eip;
-	guest_RFLAGS = vm.eflags; 
+	if ( copy_from_user( &ctx->vm, (void*)buf, len ) ) return -EFAULT;
 
-	// insure the reserved RFLAGS-bits have their required values
-	guest_RFLAGS &= ~((1<<3)|(1<<5)|(1<<15));	// reserved 0-bits
-	guest_RFLAGS |= (1<<1);				// reserved 1-bits
+	retval = my_vmrun( ctx );
 
-	// NOTE: Here we impose some othr RFLAGS settings
-	guest_RFLAGS |= (1<<17);	// for Virtual-8086 mode
-	guest_RFLAGS |= (3<<12);	// for IO-privilege-level 
-	guest_RFLAGS &= ~(1<<14);	// for NT (Nested Task)
+	// -----------------------------------------------------
+	// deliver the client's virtual-machine register-values
+	// -----------------------------------------------------
+	if ( copy_to_user( (void*)buf, &ctx->vm, len ) ) return -EFAULT;
 
-	// setup the other Guest-state fields (for Virtual-8086 mode)
-	guest_ES_base = (guest_ES_selector << 4);
-	guest_CS_base = (guest_CS_selector << 4);
-	guest_SS_base = (guest_SS_selector << 4);
-	guest_DS_base = (guest_DS_selector << 4);
-	guest_FS_base = (guest_FS_selector << 4);
-	guest_GS_base = (guest_GS_selector << 4);
-	guest_ES_limit = 0xFFFF;
-	guest_CS_limit = 0xFFFF;
-	guest_SS_limit = 0xFFFF;
-	guest_DS_limit = 0xFFFF;
-	guest_FS_limit = 0xFFFF;
-	guest_GS_limit = 0xFFFF;
-	guest_ES_access_rights = 0xF3;
-	guest_CS_access_rights = 0xF3;
-	guest_SS_access_rights = 0xF3;
-	guest_DS_access_rights = 0xF3;
-	guest_FS_access_rights = 0xF3;
-	guest_GS_access_rights = 0xF3;
-
-	guest_CR0 = 0x80000031;
-	guest_CR4 = 0x00002001;
-	guest_CR3 = pgdir_region;
-	guest_VMCS_link_pointer_full = ~0L;
-	guest_VMCS_link_pointer_high = ~0L;
-
-	guest_IDTR_base = LEGACY_REACH + IDT_KERN_OFFSET;
-	guest_GDTR_base = LEGACY_REACH + GDT_KERN_OFFSET;
-	guest_LDTR_base = LEGACY_REACH + LDT_KERN_OFFSET;
-	guest_TR_base   = LEGACY_REACH + TSS_KERN_OFFSET;
-
-	guest_IDTR_limit = (256 * 8) - 1;	// 256 descriptors
-	guest_GDTR_limit = (3 * 8) - 1;		// 3 descriptors
-	guest_LDTR_limit = (4 * 8) - 1;		// 4 descriptors
-	guest_TR_limit   = (26 * 4) + 0x20 + 0x2000;
-	guest_LDTR_access_rights = 0x82;
-	guest_TR_access_rights   = 0x8B;
-	guest_LDTR_selector = __SELECTOR_LDTR;
-	guest_TR_selector   = __SELECTOR_TASK;
+	return	retval;
+}
 
-	//------------------------------------------------------
-	// initialize the global variables for our Host's state 
-	//------------------------------------------------------
-	asm(" mov %%cr0, %%rax \n mov %%rax, host_CR0 " ::: "ax" );	
-	asm(" mov %%cr4, %%rax \n mov %%rax, host_CR4 " ::: "ax" );	
-	asm(" mov %%cr3, %%rax \n mov %%rax, host_CR3 " ::: "ax" );	
-	asm(" mov %es, host_ES_selector ");
-	asm(" mov %cs, host_CS_selector ");
-	asm(" mov %ss, host_SS_selector ");
-	asm(" mov %ds, host_DS_selector ");
-	asm(" mov %fs, host_FS_selector ");
-	asm(" mov %gs, host_GS_selector ");
-	asm(" sgdt host_gdtr \n sidt host_idtr \n sldt host_ldtr ");
-	host_GDTR_base = *(unsigned long*)(host_gdtr+1);
-	host_IDTR_base = *(unsigned long*)(host_idtr+1);
-
-	asm(" str host_TR_selector ");
-	host_gdt = (unsigned long*)host_GDTR_base;
-	desc = host_gdt[ (host_TR_selector >> 3) + 0 ]; 
-	host_TR_base = ((desc >> 32)&0xFF000000)|((desc >> 16)&0x00FFFFFF);
-	desc = host_gdt[ (host_TR_selector >> 3) + 1 ]; 
-	desc <<= 48;	// maneuver to insure 'canonical' addressing
-	host_TR_base |= (desc >> 16)&0xFFFFFFFF00000000;
+//----------------------------------------------------------------
+// Time each VMX primitive 'samples' times, with RDTSC, on the cpu
+// we are running on (our client pins itself to each cpu in turn).
+// The guest it gives us must be at an instruction which always
+// exits (such as CPUID), since we resume it without emulating it,
+// so that each VMLAUNCH or VMRESUME makes just one round trip.
+//----------------------------------------------------------------
+int bench_compare( const void *a, const void *b )
+{
+	unsigned long long	x = *(unsigned long long*)a;
+	unsigned long long	y = *(unsigned long long*)b;
 
-	// access the SYSENTER Model-Specific Registers	
-	asm(	" mov	$0x174, %%ecx			\n"\
-		" rdmsr					\n"\
-		" mov	%%eax, host_SYSENTER_CS		\n"\
-		" inc	%%ecx				\n"\
-		" rdmsr					\n"\
-		" mov	%%eax, host_SYSENTER_ESP+0	\n"\
-		" mov	%%edx, host_SYSENTER_ESP+4	\n"\
-		" inc	%%ecx				\n"\
-		" rdmsr					\n"\
-		" mov	%%eax, host_SYSENTER_EIP+0	\n"\
-		" mov	%%edx, host_SYSENTER_EIP+4	\n"\
-		::: "ax", "cx", "dx" );
-	
-	// access the base-address MSRs for FS and GS
-	asm(	" mov	$0xC0000100, %%ecx		\n"\
-		" rdmsr					\n"\
-		" mov	%%eax, host_FS_base+0		\n"\
-		" mov	%%edx, host_FS_base+4		\n"\
-		" inc	%%ecx				\n"\
-		" rdmsr					\n"\
-		" mov	%%eax, host_GS_base+0		\n"\
-		" mov	%%edx, host_GS_base+4		\n"\
-		::: "ax", "cx", "dx" );
+	return	( x > y ) - ( x < y );
+}
 
-	//------------------------------------------------------
-	// initialize the global variables for our VMX controls 
-	//------------------------------------------------------
+void bench_report( bench_ia32 *bench, int op, unsigned long long *t, int n )
+{
+	if ( n == 0 ) return;
+	sort( t, n, sizeof( *t ), bench_compare, NULL );
+	bench->op[ op ].count = n;
+	bench->op[ op ].min = t[ 0 ];
+	bench->op[ op ].median = t[ n / 2 ];
+	bench->op[ op ].p99 = t[ ( n * 99 ) / 100 ];
+}
+
+int my_bench( struct vmm_context *ctx, unsigned long buf )
+{
+	bench_ia32		bench;
+	unsigned long long	*t, *t2, t0, t1;
+	unsigned long		flags, value = 0;
+	struct host_state	*hs;
+	unsigned short		host_ldtr;
+	int			cpu, i, n, launched, status = 0;
+
+	// (there are no VMX primitives in our software backend)
+	if ( ctx->soft ) return -ENODEV;
+
+	if ( copy_from_user( &bench, (void*)buf, sizeof( bench ) ) ) 
+		return -EFAULT;
+	n = bench.samples;
+	if (( n == 0 )||( n > MAX_SAMPLES )) return -EINVAL;
+	memset( bench.op, 0, sizeof( bench.op ) );
+
+	t = kmalloc( 2 * n * sizeof( *t ), GFP_KERNEL );
+	if ( !t ) return -ENOMEM;
+	t2 = t + n;
+
+	ctx->vm = bench.regs;
+	ctx->io_pending = 0;
+	ctx->deadline = 0;	// (our timings run without any budget,
+	ctx->ticking = 0;	//   and without our virtual timer)
+	if ( stay_pinned( ctx ) ) { kfree( t ); return -EINVAL; }
+
+	cpu = get_cpu();
+	bench.cpu = cpu;
+	hs = &host_state[ cpu ];
+	vmx_prepare( ctx );
+	asm(" sldt %0 " : "=m" (host_ldtr) );
+	if (( vmx_load( ctx ) )||( vmx_write_dirty( ctx ) ))
+		{
+		ctx->stale = VMCS_STALE;
+		put_cpu();
+		kfree( t );
+		return	-EIO;
+		}
+
+	// the overhead of our timing itself
+	for (i = 0; i < n; i++)
+		{
+		local_irq_save( flags );
+		t0 = read_tsc();
+		t[ i ] = read_tsc() - t0;
+		local_irq_restore( flags );
+		}
+	bench_report( &bench, VMM_BENCH_RDTSC, t, n );
 
-	control_VMX_pin_based = msr0x480[ 1 ];
-	control_VMX_pin_based |= (1<<0);	// exit on interrupts
-	control_VMX_pin_based |= (1<<3);	// NMI-exiting 
+	// VMREAD of the exit-reason, and VMWRITE of 'host_RSP' (which
+	// 'vmx_enter' always rewrites)
+	for (i = 0; i < n; i++)
+		{
+		local_irq_save( flags );
+		t0 = read_tsc();
+		asm volatile( " vmread %1, %0 " : "=rm" (value) 
+				: "r" (0x4402UL) : "cc" );
+		t1 = read_tsc();
+		do_vmwrite( 0x6C14, value );
+		t2[ i ] = read_tsc() - t1;
+		t[ i ] = t1 - t0;
+		local_irq_restore( flags );
+		}
+	bench_report( &bench, VMM_BENCH_VMREAD, t, n );
+	bench_report( &bench, VMM_BENCH_VMWRITE, t2, n );
 
-	control_VMX_cpu_based = msr0x480[ 2 ];
-	control_VMX_cpu_based |= (1<<7);	// HLT-exiting
+	// VMCLEAR, then VMPTRLD to make our VMCS current once more
+	for (i = 0; i < n; i++)
+		{
+		local_irq_save( flags );
+		t0 = read_tsc();
+		do_vmclear( ctx->guest_region );
+		t1 = read_tsc();
+		do_vmptrld( ctx->guest_region );
+		t2[ i ] = read_tsc() - t1;
+		t[ i ] = t1 - t0;
+		local_irq_restore( flags );
+		}
+	ctx->launched = 0;
+	bench_report( &bench, VMM_BENCH_VMCLEAR, t, n );
+	bench_report( &bench, VMM_BENCH_VMPTRLD, t2, n );
 
-	control_VM_exit_controls = msr0x480[ 3 ];
-	control_VM_exit_controls |= (1<<9);	// exit to 64-bit host
+	// VMLAUNCH round trips (each one needs a clear VMCS), and then
+	// VMRESUME round trips
+	for (launched = 0; ( launched < 2 )&&( status == 0 ); launched++)
+		{
+		for (i = 0; i < n; i++)
+			{
+			local_irq_save( flags );
+			if ( !launched ) 
+				{
+				do_vmclear( ctx->guest_region );
+				do_vmptrld( ctx->guest_region );
+				}
+			++ctx->entries;
+			t0 = read_tsc();
+			status = vmx_enter( ctx->gpr, launched );
+			t[ i ] = read_tsc() - t0;
+			asm(" lgdt %0 \n lidt %1 " 
+				:: "m" (hs->gdtr), "m" (hs->idtr));
+			asm(" lldt %0 " :: "m" (host_ldtr));
+			local_irq_restore( flags );
+			if ( status ) break;
+			}
+		if ( status ) break;
+		ctx->launched = 1;
+		bench_report( &bench, launched ? VMM_BENCH_VMRESUME 
+						: VMM_BENCH_VMLAUNCH, t, n );
+		}
 
-	control_VM_entry_controls = msr0x480[ 4 ];
+	host_msrs_restore( ctx, hs );
+	if ( status )
+		{
+		// a failed entry means we rewrite (and relaunch) next time
+		vmx_clear( ctx );
+		ctx->stale = VMCS_STALE;
+		put_cpu();
+		kfree( t );
+		return	-EIO;
+		}
+	vmx_read_exit( ctx );
+	bench.reason = ctx->vmcs.info_vmexit_reason;
 
-	control_CR0_mask   = 0x80000021;
- 	control_CR0_shadow = 0x80000021;
+	// VMXOFF and VMXON, unless some other VM's VMCS is active here
+	// (VMXOFF would lose whatever the cpu has cached of its state)
+	vmx_clear( ctx );
+	if ( vmx_active[ cpu ] == 0 )
+		{
+		for (i = 0; i < n; i++)
+			{
+			local_irq_save( flags );
+			t0 = read_tsc();
+			asm volatile( " vmxoff " ::: "cc", "memory" );
+			t1 = read_tsc();
+			status = do_vmxon( vmxon_region[ cpu ] );
+			t2[ i ] = read_tsc() - t1;
+			t[ i ] = t1 - t0;
+			local_irq_restore( flags );
+			if ( status ) { vmx_on[ cpu ] = 0; break; }
+			}
+		bench_report( &bench, VMM_BENCH_VMXOFF, t, i );
+		bench_report( &bench, VMM_BENCH_VMXON, t2, i );
+		}
+	put_cpu();
+	kfree( t );
 
-	control_CR4_mask   = 0x00002001;
- 	control_CR4_shadow = 0x00002001;
-	
-	control_CR3_target_count = 2;
-	control_CR3_target0 = guest_CR3;
-	control_CR3_target1 = host_CR3;
-	control_pagefault_errorcode_mask  = 0x00000000;
-	control_pagefault_errorcode_match = 0xFFFFFFFF;
-
-	//-----------------------------
-	// setup our host's MSR region
-	//-----------------------------
-	control_VM_exit_MSR_load_address_full = (h_MSR_region >>  0);
-	control_VM_exit_MSR_load_address_high = (h_MSR_region >> 32);
-	control_VM_exit_MSR_load_count = 0;
-
-	msr_index = MSR_KERNEL_GS_BASE;
-	asm(	" mov	msr_index, %%rcx	\n"\
-		" rdmsr				\n"\
-		" mov	%%eax, msr_value+0	\n"\
-		" mov	%%edx, msr_value+4	\n"\
-		::: "ax", "cx", "dx" );
-	memcpy( next_host_MSR_entry + 0, &msr_index, 4 );
-	memcpy( next_host_MSR_entry + 8, &msr_value, 8 );
-	control_VM_exit_MSR_load_count += 1;
-	next_host_MSR_entry += 16;
-
-	msr_index = MSR_STAR;
-	asm(	" mov	msr_index, %%rcx	\n"\
-		" rdmsr				\n"\
-		" mov	%%eax, msr_value+0	\n"\
-		" mov	%%edx, msr_value+4	\n"\
-		::: "ax", "cx", "dx" );
-	memcpy( next_host_MSR_entry + 0, &msr_index, 4 );
-	memcpy( next_host_MSR_entry + 8, &msr_value, 8 );
-	control_VM_exit_MSR_load_count += 1;
-	next_host_MSR_entry += 16;
-
-	msr_index = MSR_LSTAR;
-	asm(	" mov	msr_index, %%rcx	\n"\
-		" rdmsr				\n"\
-		" mov	%%eax, msr_value+0	\n"\
-		" mov	%%edx, msr_value+4	\n"\
-		::: "ax", "cx", "dx" );
-	memcpy( next_host_MSR_entry + 0, &msr_index, 4 );
-	memcpy( next_host_MSR_entry + 8, &msr_value, 8 );
-	control_VM_exit_MSR_load_count += 1;
-	next_host_MSR_entry += 16;
-
-	msr_index = MSR_CSTAR;
-	asm(	" mov	msr_index, %%rcx	\n"\
-		" rdmsr				\n"\
-		" mov	%%eax, msr_value+0	\n"\
-		" mov	%%edx, msr_value+4	\n"\
-		::: "ax", "cx", "dx" );
-	memcpy( next_host_MSR_entry + 0, &msr_index, 4 );
-	memcpy( next_host_MSR_entry + 8, &msr_value, 8 );
-	control_VM_exit_MSR_load_count += 1;
-	next_host_MSR_entry += 16;
-
-	msr_index = MSR_SYSCALL_MASK;
-	asm(	" mov	msr_index, %%rcx	\n"\
-		" rdmsr				\n"\
-		" mov	%%eax, msr_value+0	\n"\
-		" mov	%%edx, msr_value+4	\n"\
-		::: "ax", "cx", "dx" );
-	memcpy( next_host_MSR_entry + 0, &msr_index, 4 );
-	memcpy( next_host_MSR_entry + 8, &msr_value, 8 );
-	control_VM_exit_MSR_load_count += 1;
-	next_host_MSR_entry += 16;
+	if ( status ) return -EIO;
+	if ( copy_to_user( (void*)buf, &bench, sizeof( bench ) ) ) return -EFAULT;
+	return	0;
+}
 
-	// initialize our event counters
- 	extints = 0;
-	nmiints = 0;
-
-	//-----------------------
-	// launch the Guest task
-	//----------------------
-	asm volatile("	.type	my_vmm, @function	\n"\
-		" pushfq				\n"\
-		" push	%rax				\n"\
-		" push	%rbx				\n"\
-		" push	%rcx				\n"\
-		" push	%rdx				\n"\
-		" push	%rbp				\n"\
-		" push	%rsi				\n"\
-		" push	%rdi				\n"\
-		" push	%r8 				\n"\
-		" push	%r9 				\n"\
-		" push	%r10				\n"\
-		" push	%r11				\n"\
-		" push	%r12				\n"\
-		" push	%r13				\n"\
-		" push	%r14				\n"\
-		" push	%r15				\n"\
-		"					\n"\
-		" lea	my_vmm, %rax			\n"\
-		" mov	%rax, host_RIP			\n"\
-		" mov	%rsp, host_RSP			\n"\
-		"					\n"\
-		" vmxon	vmxon_region			\n"\
-		" jbe	vmfail				\n"\
-		"					\n"\
-		" vmclear guest_region			\n"\
-		" jbe	vmfail				\n"\
-		"					\n"\
-		" vmptrld guest_region			\n"\
-		" jbe	vmfail				\n"\
-		"					\n"\
-		"  xor	%rdx, %rdx			\n"\
-		"  mov	elements, %rcx			\n"\
-		"nxwr:					\n"\
-		"  mov	machine+0(%rdx), %rax		\n"\
-		"  mov	machine+8(%rdx), %rbx		\n"\
-		"  vmwrite (%rbx), %rax			\n"\
-		"  jbe	vmfail				\n"\
-		"  add	$16, %rdx			\n"\
-		"  loop	nxwr				\n"\
-		" 					\n"\
-		" mov  guest_RAX, %rax			\n"\
-		" mov  guest_RBX, %rbx			\n"\
-		" mov  guest_RCX, %rcx			\n"\
-		" mov  guest_RDX, %rdx			\n"\
-		" mov  guest_RBP, %rbp			\n"\
-		" mov  guest_RSI, %rsi			\n"\
-		" mov  guest_RDI, %rdi			\n"\
-		" vmlaunch				\n"\
-		" jmp  vmfail				\n"\
-		"					\n"\
-		"my_vmm:				\n"\
-		" movl	$0, retval			\n"\
-		" mov  %rax, guest_RAX			\n"\
-		" mov  %rbx, guest_RBX			\n"\
-		" mov  %rcx, guest_RCX			\n"\
-		" mov  %rdx, guest_RDX			\n"\
-		" mov  %rbp, guest_RBP			\n"\
-		" mov  %rsi, guest_RSI			\n"\
-		" mov  %rdi, guest_RDI			\n"\
-		"					\n"\
-		"read:					\n"\
-		"  xor  %rdx, %rdx			\n"\
-		"  mov  rocount, %rcx			\n"\
-		"nxrd:					\n"\
-		"  mov  results+0(%rdx), %rax		\n"\
-		"  mov  results+8(%rdx), %rbx		\n"\
-		"  vmread  %rax, (%rbx)			\n"\
-		"  jbe	vmfail				\n"\
-		"  add  $16, %rdx			\n"\
-		"  loop nxrd				\n"\
-		"					\n"\
-		" mov  info_vmexit_reason, %eax		\n"\
-		" mov  %eax, retval			\n"\
-		"					\n"\
-		" cmpl	$0, info_vmexit_reason		\n"\
-		" je  was_exception_or_nmi		\n"\
-		"					\n"\
-		" cmpl  $1, info_vmexit_reason		\n"\
-		" je  was_extint			\n"\
-		"					\n"\
-		" jmp  gameover				\n"\
-		"					\n"\
-		"was_exception_or_nmi:			\n"\
-		" btl  $31, info_vmexit_interrupt_information	\n"\
-		" jnc  was_nmi					\n"\
-		" jmp  gameover					\n"\
-		"					\n"\
-		"was_nmi:				\n"\
-		" incl  nmiints				\n"\
-		" int  $0x02				\n"\
-		" jmp  resume_guest			\n"\
-		"					\n"\
-		"was_extint:				\n"\
-		" sti					\n"\
-		" movl  $8, retval			\n"\
-		" incl  extints				\n"\
-		" jmp  resume_guest			\n"\
-		"					\n"\
-		"resume_guest:				\n"\
-		"  mov  guest_RAX, %rax			\n"\
-		"  mov  guest_RBX, %rbx			\n"\
-		"  mov  guest_RCX, %rcx			\n"\
-		"  mov  guest_RDX, %rdx			\n"\
-		"  mov  guest_RBP, %rbp			\n"\
-		"  mov  guest_RSI, %rsi			\n"\
-		"  mov  guest_RDI, %rdi			\n"\
-		"  vmresume				\n"\
-		"					\n"\
-		"vmfail:				\n"\
-		"  jc	failInvalid			\n"\
-		"failValid:				\n"\
-		"  mov $0x4400, %rax			\n"\
-		"  lea info_vminstr_error, %rbx		\n"\
-		"  vmread  %rax, (%rbx)			\n"\
-		"gameover:				\n"\
-		"  mov	info_vminstr_error, %eax	\n"\
-		"  mov	%eax, retval			\n"\
-		"  vmxoff				\n"\
-		"failInvalid:				\n"\
-		" pop	%r15				\n"\
-		" pop	%r14				\n"\
-		" pop	%r13				\n"\
-		" pop	%r12				\n"\
-		" pop	%r11				\n"\
-		" pop	%r10				\n"\
-		" pop	%r9 				\n"\
-		" pop	%r8 				\n"\
-		" pop	%rdi				\n"\
-		" pop	%rsi				\n"\
-		" pop	%rbp				\n"\
-		" pop	%rdx				\n"\
-		" pop	%rcx				\n"\
-		" pop	%rbx				\n"\
-		" pop	%rax				\n"\
-		" popfq					\n"\
-		);
+//----------------------------------------------------------------
+// Set the policy for a range of I/O ports: a port whose bit is
+// set in our I/O bitmaps causes a VM exit (which VMM_RUN hands to
+// our client), while the others are accessed by the guest itself.
+// Every port starts out as pass-through (our bitmaps are zeroed).
+//----------------------------------------------------------------
+int my_ioports( struct vmm_context *ctx, unsigned long buf )
+{
+	unsigned char	*iomap = phys_to_virt( ctx->iomap_region );
+	ports_ia32	ports;
+	unsigned int	port;
 
-	//-------------------------------------------------------
-	// restore some system-registers that VMX left corrupted
-	//-------------------------------------------------------
-	asm(" lgdt host_gdtr \n lidt host_idtr ");
-	asm(" lldt host_ldtr ");
+	if ( copy_from_user( &ports, (void*)buf, sizeof( ports ) ) ) 
+		return -EFAULT;
+	if (( ports.first > 0xFFFF )||( ports.count > 0x10000 - ports.first ))
+		return -EINVAL;
 
-	// -----------------------------------------------------
-	// deliver the client's virtual-machine register-values
-	// -----------------------------------------------------
-	vm.eax = guest_RAX;
-	vm.ebx = guest_RBX;
-	vm.ecx = guest_RCX;
-	vm.edx = guest_RDX;
-	vm.ebp = guest_RBP;
-	vm.esi = guest_RSI;
-	vm.edi = guest_RDI;
-	vm.eip = guest_RIP;
-	vm.esp = guest_RSP;
-	vm.eflags = guest_RFLAGS;
-	vm.es  = guest_ES_selector;
-	vm.cs  = guest_CS_selector;
-	vm.ss  = guest_SS_selector;
-	vm.ds  = guest_DS_selector;
-	vm.fs  = guest_FS_selector;
-	vm.gs  = guest_GS_selector;
-	if ( copy_to_user( (void*)buf, &vm, len ) ) return -EFAULT;
+	for (port = ports.first; port < ports.first + ports.count; port++)
+		if ( ports.policy == VMM_PORT_EXIT ) 
+			iomap[ port >> 3 ] |= ( 1 << ( port & 7 ) );
+		else	iomap[ port >> 3 ] &= ~( 1 << ( port & 7 ) );
+
+	return	0;
+}
+
+// deliver a snapshot of this VM's exit-counts and latencies
+int my_exitstats( struct vmm_context *ctx, unsigned long buf )
+{
+	if ( ctx->stats_reset ) exit_stats_reset( ctx );
+	if ( copy_to_user( (void*)buf, &ctx->stats, sizeof( ctx->stats ) ) ) 
+		return -EFAULT;
+	return	0;
+}
+
+// add an MSR to (or remove it from) this VM's allow-list
+int my_msrs( struct vmm_context *ctx, unsigned long buf )
+{
+	msrs_ia32	msr;
+
+	if ( copy_from_user( &msr, (void*)buf, sizeof( msr ) ) ) return -EFAULT;
+	return	msr_set_policy( ctx, msr.index, msr.policy );
+}
+
+//----------------------------------------------------------------
+// Like 'my_call()', but a run that ends with an I/O-instruction 
+// exit returns a decoded record of it; our client emulates that 
+// port and hands us the result in its next VMM_RUN, which then 
+// completes the instruction and resumes the very same guest
+//----------------------------------------------------------------
+void io_complete( struct vmm_context *ctx, run_ia32 *run )
+{
+	regs_ia32	*vm = &ctx->vm;
+	unsigned int	mask = ~0;
+
+	if ( ctx->io.size < 4 ) mask = ( 1 << ( ctx->io.size * 8 ) ) - 1;
+	if (( ctx->io.flags & VMM_IO_IN )&&( !( ctx->io.flags & VMM_IO_STRING )))
+		vm->eax = ( vm->eax & ~mask ) | ( run->data & mask );
+
+	// step past the IN or OUT (unless our client moved the guest)
+	if ( vm->eip == ctx->io.regs.eip ) 
+		vm->eip = (unsigned short)( vm->eip + ctx->io_length );
+}
+
+void io_decode( struct vmm_context *ctx, run_ia32 *run )
+{
+	VMCS_FIELDS		*f = &ctx->vmcs;
+	unsigned long long	qual;
+
+	// (these fields were all read at the exit, see 'exit_read_mask')
+	qual = f->info_exit_qualification;
+	run->port = ( qual >> 16 ) & 0xFFFF;
+	run->size = ( qual & 7 ) + 1;
+	run->flags = 0;
+	if ( qual & (1<<3) ) run->flags |= VMM_IO_IN;
+	if ( qual & (1<<4) ) run->flags |= VMM_IO_STRING;
+	if ( qual & (1<<5) ) run->flags |= VMM_IO_REP;
+	run->data = ( run->flags & VMM_IO_IN ) ? 0 : run->regs.eax;
+	if ( run->size < 4 ) run->data &= ( 1 << ( run->size * 8 ) ) - 1;
+	run->count = ( run->flags & VMM_IO_REP ) ? (unsigned short)f->info_IO_RCX : 1;
+	run->linear = f->info_guest_linear_address;
+
+	ctx->io = *run;
+	ctx->io_length = f->info_vmexit_instruction_length;
+	ctx->io_pending = 1;
+}
+
+int my_run( struct vmm_context *ctx, unsigned long buf )
+{
+	run_ia32	run;
+	int		retval;
+
+	if ( copy_from_user( &run, (void*)buf, sizeof( run ) ) ) return -EFAULT;
+
+	ctx->vm = run.regs;
+	if ( ctx->io_pending ) io_complete( ctx, &run );
+
+	retval = my_vmrun( ctx );
+
+	memset( &run, 0, sizeof( run ) );
+	run.regs = ctx->vm;
+	if ( retval == 0 )
+		{
+		run.reason = ctx->vmcs.info_vmexit_reason;
+		if ( run.reason == VMM_EXIT_IO ) io_decode( ctx, &run );
+		}
+
+	if ( copy_to_user( (void*)buf, &run, sizeof( run ) ) ) return -EFAULT;
+	return	retval;
+}
+
+//----------------------------------------------------------------
+// VMM_RUN_SHARED works as VMM_RUN does, but using our client's run
+// page (so no data is copied either way); the exit information it
+// will want is read along with the guest-state, while we're still
+// on the cpu where the guest ran
+//----------------------------------------------------------------
+int my_run_shared( struct vmm_context *ctx )
+{
+	runpage_ia32	*page = ctx->runpage;
+	VMCS_FIELDS	*f = &ctx->vmcs;
+	int		retval;
+
+	ctx->vm = page->run.regs;
+	if ( ctx->io_pending ) io_complete( ctx, &page->run );
+
+	ctx->read_extra = RD_QUAL | RD_INTR | RD_INSN_LEN;
+	retval = my_vmrun( ctx );
+	ctx->read_extra = 0;
+
+	memset( page, 0, sizeof( runpage_ia32 ) );
+	page->run.regs = ctx->vm;
+	if ( retval == 0 )
+		{
+		page->run.reason = f->info_vmexit_reason;
+		page->exit_qualification = f->info_exit_qualification;
+		page->interrupt_information = f->info_vmexit_interrupt_information;
+		page->instruction_length = f->info_vmexit_instruction_length;
+		if ( page->run.reason == VMM_EXIT_IO ) io_decode( ctx, &page->run );
+		}
+	page->status = retval;
+	page->entries = ctx->entries;
+	return	retval;
+}
+
+//----------------------------------------------------------------
+// Our asynchronous calls (see 'ring_ia32' in 'myvmx.h') are run by
+// a kernel thread belonging to their VM, which takes the requests
+// from its 'sq[]' one at a time, each with the VM's 'lock' held 
+// (as any ioctl would), for as long as 'cq[]' has room for results.
+// (A pinned VM's thread moves to its cpu, as 'my_vmrun' requires.)
+//----------------------------------------------------------------
+int ring_ready( struct vmm_context *ctx )
+{
+	ring_ia32	*ring = ctx->ring;
+
+	return	( *(volatile unsigned int*)&ring->sq_tail != ctx->sq_head )
+		&&( ctx->cq_tail - *(volatile unsigned int*)&ring->cq_head 
+							< VMM_RING_SLOTS );
+}
+
+// post a result in 'cq[]' (its slot was free when the call was taken)
+void ring_post( struct vmm_context *ctx, regs_ia32 *regs, 
+		unsigned long long tag, int status, unsigned int reason )
+{
+	ring_ia32	*ring = ctx->ring;
+	ring_entry_ia32	*slot;
+
+	// the result is complete before our client can see it
+	slot = &ring->cq[ ctx->cq_tail % VMM_RING_SLOTS ];
+	slot->regs = *regs;
+	slot->tag = tag;
+	slot->status = status;
+	slot->reason = reason;
+	smp_wmb();
+	ring->cq_tail = ++ctx->cq_tail;
+
+	wake_up_interruptible( &ctx->ring_done );
+	if ( ctx->eventfd ) eventfd_signal( ctx->eventfd, 1 );
+}
+
+void ring_run_one( struct vmm_context *ctx )
+{
+	ring_ia32	*ring = ctx->ring;
+	ring_entry_ia32	*slot;
+	int		status;
+
+	// take the request, then give its slot back to our client 
+	smp_rmb();
+	slot = &ring->sq[ ctx->sq_head % VMM_RING_SLOTS ];
+	ctx->vm = slot->regs;
+	ctx->serving_tag = slot->tag;
+	ctx->serving = 1;
+	smp_mb();
+	ring->sq_head = ++ctx->sq_head;
+
+	// (the guest may serve more calls itself, with VMM_HC_NEXT)
+	ctx->ring_call = 1;
+	phase_start( ctx );
+	status = my_vmrun( ctx );
+	phase_end( ctx );
+	ctx->ring_call = 0;
+
+	if ( ctx->serving ) 
+		ring_post( ctx, &ctx->vm, ctx->serving_tag, status, 
+			( status == 0 ) ? ctx->vmcs.info_vmexit_reason : 0 );
+	ctx->serving = 0;
+}
+
+int ring_thread( void *data )
+{
+	struct vmm_context	*ctx = data;
+
+	while ( !kthread_should_stop() )
+		{
+		wait_event_interruptible( ctx->ring_work, 
+				kthread_should_stop() || ring_ready( ctx ) );
+
+		while ( !kthread_should_stop() && ring_ready( ctx ) ) 
+			{
+			mutex_lock( &ctx->lock );
+			ring_run_one( ctx );
+			mutex_unlock( &ctx->lock );
+			}
+		}
+	return	0;
+}
+
+//----------------------------------------------------------------
+// Our hypercalls (see VMM_HC_xxx in 'myvmx.h'), made by the guest
+// with VMCALL; it then resumes after the VMCALL, with CF=1 if the
+// function failed (VMM_HC_DONE is just counted: see 'exit_vmcall').
+// They see the guest through 'ctx->exit', so serve either backend.
+//----------------------------------------------------------------
+void vmx_guest_regs( struct vmm_context *ctx, regs_ia32 *regs )
+{
+	regs->eax = ctx->gpr[ GPR_RAX ];
+	regs->ebx = ctx->gpr[ GPR_RBX ];
+	regs->ecx = ctx->gpr[ GPR_RCX ];
+	regs->edx = ctx->gpr[ GPR_RDX ];
+	regs->ebp = ctx->gpr[ GPR_RBP ];
+	regs->esi = ctx->gpr[ GPR_RSI ];
+	regs->edi = ctx->gpr[ GPR_RDI ];
+	regs->eip = ctx->exit.vmread( ctx, VMCS_GUEST_RIP );
+	regs->esp = ctx->exit.vmread( ctx, VMCS_GUEST_RSP );
+	regs->eflags = ctx->exit.vmread( ctx, VMCS_GUEST_RFLAGS );
+	regs->es = ctx->exit.vmread( ctx, VMCS_GUEST_ES );
+	regs->cs = ctx->exit.vmread( ctx, VMCS_GUEST_CS );
+	regs->ss = ctx->exit.vmread( ctx, VMCS_GUEST_SS );
+	regs->ds = ctx->exit.vmread( ctx, VMCS_GUEST_DS );
+	regs->fs = ctx->exit.vmread( ctx, VMCS_GUEST_FS );
+	regs->gs = ctx->exit.vmread( ctx, VMCS_GUEST_GS );
+}
+
+// write ECX bytes from DS:SI (in conventional memory) to our log
+int hc_print( struct vmm_context *ctx )
+{
+	char		line[ 257 ];
+	unsigned int	ds, si, n, linear;
+
+	ds = ctx->exit.vmread( ctx, VMCS_GUEST_DS ) & 0xFFFF;
+	si = ctx->gpr[ GPR_RSI ] & 0xFFFF;
+	n = (unsigned int)ctx->gpr[ GPR_RCX ];
+	linear = ( ds << 4 ) + si;
+	if (( n > 256 )||( linear + n > LEGACY_VIDEO )) return -1;
+
+	// (a guest printing in a loop mustn't flood the kernel's log)
+	if ( !printk_ratelimit() ) { ++ctx->prints_dropped; return 0; }
+
+	memcpy( line, phys_to_virt( ctx->lower_region + linear ), n );
+	line[ n ] = 0;
+	printk( "<6>%s: %s \n", modname, line );
+	return	0;
+}
 
+// post the call being served, and take the next one (if any)
+int hc_next( struct vmm_context *ctx )
+{
+	ring_ia32	*ring = ctx->ring;
+	ring_entry_ia32	*slot;
+	regs_ia32	regs;
+
+	if ( !ctx->ring_call ) return -1;
+	if ( ctx->serving )
+		{
+		vmx_guest_regs( ctx, &regs );
+		ring_post( ctx, &regs, ctx->serving_tag, 0, EXIT_VMCALL );
+		ctx->serving = 0;
+		}
+	if ( !ring_ready( ctx ) ) return -1;
+
+	smp_rmb();
+	slot = &ring->sq[ ctx->sq_head % VMM_RING_SLOTS ];
+	ctx->gpr[ GPR_RAX ] = slot->regs.eax;
+	ctx->gpr[ GPR_RBX ] = slot->regs.ebx;
+	ctx->gpr[ GPR_RCX ] = slot->regs.ecx;
+	ctx->gpr[ GPR_RDX ] = slot->regs.edx;
+	ctx->gpr[ GPR_RBP ] = slot->regs.ebp;
+	ctx->gpr[ GPR_RSI ] = slot->regs.esi;
+	ctx->gpr[ GPR_RDI ] = slot->regs.edi;
+	ctx->serving_tag = slot->tag;
+	ctx->serving = 1;
+	smp_mb();
+	ring->sq_head = ++ctx->sq_head;
+	return	0;
+}
+
+int vmx_hypercall( void *vmcs, unsigned int function )
+{
+	struct vmm_context	*ctx = vmcs;
+	unsigned long long	rflags, tsc;
+	int			failed = 0;
+
+	if ( function < VMM_HC_COUNT ) ++ctx->hypercalls[ function ];
+	if ( function == VMM_HC_DONE ) return EXIT_FORWARD;
+	switch ( function )
+		{
+		case VMM_HC_PRINT:
+		failed = hc_print( ctx );
+		break;
+
+		case VMM_HC_YIELD:
+		break;
+
+		case VMM_HC_TIME:
+		tsc = read_tsc();
+		ctx->gpr[ GPR_RAX ] = (unsigned int)tsc;
+		ctx->gpr[ GPR_RDX ] = (unsigned int)( tsc >> 32 );
+		ctx->gpr[ GPR_RCX ] = tsc_khz;
+		break;
+
+		case VMM_HC_NEXT:
+		failed = hc_next( ctx );
+		break;
+
+		default:
+		failed = 1;
+		}
+
+	rflags = ctx->exit.vmread( ctx, VMCS_GUEST_RFLAGS );
+	ctx->exit.vmwrite( ctx, VMCS_GUEST_RFLAGS, 
+				( failed ) ? rflags | 1 : rflags & ~1ULL );
+	return	( function == VMM_HC_YIELD ) ? EXIT_YIELD : EXIT_RESUME;
+}
+
+// start the VM's thread, if need be, and have it look at 'sq[]'
+int my_submit( struct vmm_context *ctx )
+{
+	struct task_struct	*task;
+
+	if ( !ctx->ring_task )
+		{
+		task = kthread_run( ring_thread, ctx, "%s", devname );
+		if ( IS_ERR( task ) ) return PTR_ERR( task );
+		ctx->ring_task = task;
+		}
+	wake_up_interruptible( &ctx->ring_work );
+	return	0;
+}
+
+int my_eventfd( struct vmm_context *ctx, unsigned long buf )
+{
+	struct file	*efd = NULL;
+	int		fd;
+
+	if ( copy_from_user( &fd, (void*)buf, sizeof( fd ) ) ) return -EFAULT;
+	if ( fd >= 0 ) 
+		{
+		efd = eventfd_fget( fd );
+		if ( IS_ERR( efd ) ) return PTR_ERR( efd );
+		}
+	if ( ctx->eventfd ) fput( ctx->eventfd );
+	ctx->eventfd = efd;
+	return	0;
+}
+
+unsigned int my_poll( struct file *file, poll_table *wait )
+{
+	struct vmm_context	*ctx = file->private_data;
+	ring_ia32		*ring = ctx->ring;
+	unsigned int		mask = 0;
+
+	poll_wait( file, &ctx->ring_done, wait );
+	if ( ring->cq_head != ctx->cq_tail ) mask |= POLLIN | POLLRDNORM;
+	if ( ring->sq_tail - ctx->sq_head < VMM_RING_SLOTS ) 
+		mask |= POLLOUT | POLLWRNORM;
+	return	mask;
+}
+
+long my_ioctl( struct file *file, unsigned int len, unsigned long buf )
+{
+	struct vmm_context	*ctx = file->private_data;
+	long			retval;
+
+	// events can be queued while a call is running (see 'my_event')
+	if ( len == VMM_EVENT ) return my_event( ctx, buf );
+
+	// the trace-rings are shared by every virtual machine
+	if ( len == VMM_TRACE ) return vmtrace_control( buf );
+
+	// ioctls on the same virtual machine are taken one at a time
+	if ( mutex_lock_interruptible( &ctx->lock ) ) return -ERESTARTSYS;
+	phase_start( ctx );
+
+	if ( len == VMM_EXITINFO ) retval = my_exitinfo( ctx, buf );
+	else if ( len == VMM_PIN ) retval = my_pin( ctx, buf );
+	else if ( len == VMM_BATCH ) retval = my_batch( ctx, buf );
+	else if ( len == VMM_RUN ) retval = my_run( ctx, buf );
+	else if ( len == VMM_RUN_SHARED ) retval = my_run_shared( ctx );
+	else if ( len == VMM_SUBMIT ) retval = my_submit( ctx );
+	else if ( len == VMM_EVENTFD ) retval = my_eventfd( ctx, buf );
+	else if ( len == VMM_BUDGET ) retval = my_budget( ctx, buf );
+	else if ( len == VMM_EVENTLOG ) retval = my_eventlog( ctx, buf );
+	else if ( len == VMM_VTIMER ) retval = my_vtimer( ctx, buf );
+	else if ( len == VMM_IOPORTS ) retval = my_ioports( ctx, buf );
+	else if ( len == VMM_MSRS ) retval = my_msrs( ctx, buf );
+	else if ( len == VMM_EXITSTATS ) retval = my_exitstats( ctx, buf );
+	else if ( len == VMM_BENCH ) retval = my_bench( ctx, buf );
+	else	retval = my_call( ctx, len, buf );
+
+	phase_end( ctx );
+	mutex_unlock( &ctx->lock );
 	return	retval;
 }
 
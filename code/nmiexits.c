@@ -28,6 +28,7 @@
 //	revised on: 14 MAY 2007 -- sets 'interrupt-exiting' control
 //	revised on: 24 MAY 2007 -- sets the 'NMI-exiting' control
 //	revised on: 21 JUL 2008 -- for Linux kernel version 2.6.26.
+//	revised on: 17 OCT 2026 -- per-ioctl interrupt counts shown in /proc
 //-------------------------------------------------------------------
 
 #include <linux/module.h>	// for init_module() 
@@ -38,6 +39,7 @@
 #include <asm/uaccess.h>	// for copy_from_user()
 #include "machine.h"		// for our VMCS fields
 #include "myvmx.h"		// for 'regs_ia32'
+#include "vmtrace.h"		// for our exit trace-rings
 
 #define N_ARENAS	11	// number of 64KB memory allocations
 #define ARENA_LENGTH  (64<<10)	// size of each allocated memory-arena
@@ -77,6 +79,8 @@ unsigned long g_LDT_region;
 unsigned long g_TSS_region;
 unsigned long g_TOS_region;
 unsigned long g_ISR_region;
+int	nmiints = 0;		// interrupt-exits during latest ioctl
+int	extints = 0;
 
 
 int my_ioctl( struct inode *, struct file *, unsigned int, unsigned long );
@@ -88,6 +92,9 @@ int my_mmap( struct file *file, struct vm_area_struct *vma )
 	unsigned long	physical_addr, pfn;
 	int		i;
 
+	// a nonzero file-offset asks to map one cpu's trace-ring
+	if ( vma->vm_pgoff ) return vmtrace_mmap( vma );
+
 	// we require prescribed parameter-values from our client
 	if ( user_virtaddr != 0x00000000L ) return -EINVAL;
 	if ( region_length != LEGACY_REACH ) return -EINVAL;
@@ -148,6 +155,12 @@ my_info( char *buf, char **start, off_t off, int count, int *eof, void *data )
 	len += sprintf( buf+len, "\n\t\t\t" );
 	len += sprintf( buf+len, "vmxon_region=%016lX \n", vmxon_region );
 	len += sprintf( buf+len, "\n" );
+
+	// (these were formerly shown by printk, after each ioctl)
+	len += sprintf( buf+len, "\t%d external interrupts ", extints );
+	len += sprintf( buf+len, "and %d non-maskable interrupts ", nmiints );
+	len += sprintf( buf+len, "during latest ioctl \n" );
+	len += sprintf( buf+len, "\n" );
 	
 	return	len;
 }
@@ -231,6 +244,13 @@ int init_module( void )
 		else	memset( kmem[ i ], 0x00, ARENA_LENGTH );
 		}
 
+	// allocate the trace-ring for each cpu
+	if ( vmtrace_alloc() )
+		{
+		for (i = 0; i < N_ARENAS; i++) kfree( kmem[ i ] );
+		return	-ENOMEM;
+		}
+
 	// assign usages to allocated kernel memory areas
 	vmxon_region = virt_to_phys( kmem[ 10 ] + 0x0000 );
 	guest_region = virt_to_phys( kmem[ 10 ] + 0x1000 );
@@ -262,6 +282,7 @@ void cleanup_module( void )
 	unregister_chrdev( my_major, modname );
 	remove_proc_entry( modname, NULL );
 	for (i = 0; i < N_ARENAS; i++) kfree( kmem[ i ] );
+	vmtrace_free();
 
 	printk( "<1>Removing \'%s\' module\n", modname );
 }
@@ -272,11 +293,17 @@ unsigned short	_gdtr[ 5 ], _idtr[ 5 ];
 unsigned int	_eax, _ebx, _ecx, _edx, _esp, _ebp, _esi, _edi;
 int		retval = -1;
 
-int	nmiints = 0;
-int	extints = 0;
-
 regs_ia32	vm;
 
+// called from our VM-exit code, for the exits it resumes the guest
+// from (the one which ends our ioctl is recorded after it returns)
+void trace_resumed_exit( void )
+{
+	vmtrace_exit( info_vmexit_reason, info_exit_qualification,
+			info_vmexit_interrupt_information, 
+			guest_CS_selector, guest_RIP, info_vminstr_error );
+}
+
 int my_ioctl( struct inode *inode, struct file *file, 
 				unsigned int count, unsigned long buf )
 {
@@ -285,6 +312,9 @@ int my_ioctl( struct inode *inode, struct file *file,
 	signed long	desc = 0;
 	int		i, j;
 
+	// a request to empty (and set the mode of) our trace-rings
+	if ( count == VMM_TRACE ) return vmtrace_control( buf );
+
 	// sanity check: we require the client-process to pass an
 	// exact amount of data representing CPU's register-state
 	if ( count != sizeof( regs_ia32 ) ) return -EINVAL;
@@ -504,6 +534,9 @@ extints = 0;
 		" push	%rbp				\n"\
 		" push	%rsi				\n"\
 		" push	%rdi				\n"\
+		" push	%r8				\n"\
+		" push	%r9				\n"\
+		" push	%r10				\n"\
 		" push	%r11				\n"\
 		" lea	my_vmm, %rax			\n"\
 		" mov	%rax, host_RIP			\n"\
@@ -567,11 +600,13 @@ extints = 0;
 		" jmp	over				\n"\
 		"					\n"\
 		"was_nmi:				\n"\
+		" call	trace_resumed_exit		\n"\
 		" incl	nmiints				\n"\
 		" int	$0x02				\n"\
 		" jmp	resume_guest			\n"\
 		"					\n"\
 		"was_extint:				\n"\
+		" call	trace_resumed_exit		\n"\
 		" sti					\n"\
 		" movl	$6, retval			\n"\
 		" incl	extints				\n"\
@@ -591,6 +626,9 @@ extints = 0;
 		" vmxoff				\n"\
 		"fail:					\n"\
 		" pop	%r11				\n"\
+		" pop	%r10				\n"\
+		" pop	%r9				\n"\
+		" pop	%r8				\n"\
 		" pop	%rdi				\n"\
 		" pop	%rsi				\n"\
 		" pop	%rbp				\n"\
@@ -601,18 +639,10 @@ extints = 0;
 		" popfq					\n"\
 		);
 
-// show why the VMentry failed, or else why the VMexit occurred	
-printk( "\n VM-instruction error: %d  ", info_vminstr_error );
-printk( " Exit Reason: %d \n", info_vmexit_reason );
-printk( " VMexit-interruption-information: %08X \n",
-			info_vmexit_interrupt_information );
-printk( " VMexit-interruption-error-code:  %08X \n",
-			info_vmexit_interrupt_error_code  );
-
-// display the number of external interruption-exits
-printk( "\n" );
-printk( " number of external interrupts = %d \n", extints );
-printk( " number of non-maskable interrupts = %d \n", nmiints );
+	// record why the VMentry failed, or else why the VMexit occurred
+	vmtrace_exit( info_vmexit_reason, info_exit_qualification,
+			info_vmexit_interrupt_information, 
+			guest_CS_selector, guest_RIP, info_vminstr_error );
 
 	// copy the client's virtual-machine register-values
 	vm.eflags = (unsigned int)guest_RFLAGS;
@@ -0,0 +1,61 @@
+//-------------------------------------------------------------------
+//	showtrace.cpp
+//
+//	This application displays the VM exits recorded in one cpu's
+//	trace-ring by our 'newvmm64.c' (or 'linuxvmm.c', 'inject08.c'
+//	or 'nmiexits.c') Linux Kernel Module.  The ring is read through
+//	an mmap()'ed view, so no system-calls are needed after it has
+//	been mapped.  Records are consumed as they are shown, so running
+//	this again shows only those exits which have occurred since.
+//
+//		usage:  $ ./showtrace [cpu]
+//
+//	written on: 17 OCT 2026
+//-------------------------------------------------------------------
+
+#include <stdio.h>		// for printf(), perror()
+#include <fcntl.h>		// for open()
+#include <stdlib.h>		// for exit(), atoi()
+#include <sys/mman.h>		// for mmap()
+#include <sys/ioctl.h>		// for ioctl()
+#include "myvmx.h"		// for 'trace_ring_ia32'
+
+char devname[] = "/dev/vmm";
+
+int main( int argc, char **argv )
+{
+	int	cpu = ( argc > 1 ) ? atoi( argv[1] ) : 0;
+
+	int	fd = open( devname, O_RDWR );
+	if ( fd < 0 ) { perror( devname ); exit(1); }
+
+	void	*mm = mmap( NULL, VMM_TRACE_LENGTH, PROT_READ | PROT_WRITE,
+				MAP_SHARED, fd, VMM_TRACE_MMAP( cpu ) );
+	if ( mm == MAP_FAILED ) { perror( "mmap" ); exit(1); }
+
+	volatile trace_ring_ia32 *ring = (trace_ring_ia32*)mm;
+	trace_ia32	*slot = (trace_ia32*)( (char*)mm + 4096 );
+
+	unsigned long long	head = ring->head;
+	unsigned long long	tail = ring->tail;
+	if ( head - tail > ring->size ) tail = head - ring->size;
+	__sync_synchronize();	// read 'head' before any records
+
+	printf( "\n VM exits traced on cpu %d ", cpu );
+	printf( "(%s mode, %llu dropped) \n\n",
+		( ring->mode == VMM_TRACE_STOP ) ? "stop" : "overwrite",
+		ring->dropped );
+
+	for (; tail < head; tail++)
+		{
+		trace_ia32	rec = slot[ tail % ring->size ];
+		__sync_synchronize();
+		if ( ring->head >= tail + ring->size ) continue; // overwritten
+		printf( " %016llX  reason=%08X  qual=%016llX ",
+				rec.tsc, rec.reason, rec.qualification );
+		printf( " intr=%08X  CS:IP=%04X:%04X  error=%d \n",
+				rec.interrupt_info, rec.cs, rec.ip, rec.error );
+		}
+	ring->tail = tail;
+	printf( "\n" );
+}
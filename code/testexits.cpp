@@ -0,0 +1,258 @@
+//-------------------------------------------------------------------
+//	testexits.cpp
+//
+//	This program exercises the VM-exit handlers in 'vmexits.h'
+//	(which our 'newvmm64.c' Linux Kernel Module dispatches to)
+//	without any VT-x hardware: the handlers' VMCS accessors and
+//	CPUID are replaced here by a mock VMCS and a fake processor,
+//	and each case checks what 'exit_dispatch()' returns and what
+//	it has done to the guest's registers and VMCS fields.
+//
+//		compile using:  $ g++ testexits.cpp -o testexits
+//		execute using:  $ ./testexits
+//
+//	written on: 17 OCT 2026
+//-------------------------------------------------------------------
+
+#include <stdio.h>		// for printf()
+#include <string.h>		// for memset()
+#include "myvmx.h"		// for VMM_HC_xxx
+#include "vmexits.h"		// the handlers under test
+
+#define RFLAGS_IF	(1<<9)
+#define RFLAGS_VM	(1<<17)
+
+// our mock VMCS holds just the fields the handlers read or write
+typedef struct	{ int encoding; unsigned long long value; } FIELD;
+
+FIELD	mock[] = {	{ VMCS_GUEST_RIP, 0 },
+			{ VMCS_GUEST_RFLAGS, 0 },
+			{ VMCS_GUEST_INTERRUPTIBILITY, 0 },
+			{ VMCS_EXIT_INTR_INFO, 0 },
+			{ VMCS_EXIT_INSN_LENGTH, 0 },
+			{ VMCS_EXIT_QUALIFICATION, 0 },	};
+
+#define N_FIELDS	( sizeof( mock ) / sizeof( FIELD ) )
+
+unsigned long	gpr[ 8 ];
+int		nmi_count, hypercall_count, hypercall_function;
+int		hypercall_result;
+unsigned char	port_0x61;	// our fake device's only register
+int		failures, checks;
+
+
+FIELD *mock_field( int encoding )
+{
+	for (unsigned int i = 0; i < N_FIELDS; i++)
+		if ( mock[ i ].encoding == encoding ) return &mock[ i ];
+	printf( " unexpected VMCS field %04X \n", encoding );
+	++failures;
+	return	&mock[ 0 ];
+}
+
+unsigned long long mock_vmread( void *, int encoding )
+{
+	return	mock_field( encoding )->value;
+}
+
+void mock_vmwrite( void *, int encoding, unsigned long long value )
+{
+	mock_field( encoding )->value = value;
+}
+
+// a processor whose every feature-bit is set
+void fake_cpuid( unsigned int *regs )
+{
+	regs[ 1 ] = regs[ 2 ] = regs[ 3 ] = 0xFFFFFFFF;
+	regs[ 0 ] = ( regs[ 0 ] == 0 ) ? 1 : 0xFFFFFFFF;
+}
+
+void fake_nmi( void ) { ++nmi_count; }
+
+// port 0x61 is a byte register; every other port is our client's
+int fake_ioport( void *, unsigned int port, int size, int in,
+							unsigned int *data )
+{
+	if (( port != 0x61 )||( size != 1 )) return EXIT_FORWARD;
+	if ( in ) *data = port_0x61;
+	else	port_0x61 = *data;
+	return	EXIT_RESUME;
+}
+
+int fake_hypercall( void *, unsigned int function )
+{
+	++hypercall_count;
+	hypercall_function = function;
+	return	hypercall_result;
+}
+
+VMEXIT	x = {	gpr, mock, mock_vmread, mock_vmwrite, fake_cpuid,
+		fake_nmi, fake_ioport, fake_hypercall	};
+
+
+// start each case from a guest at 0x1000 in virtual-8086 mode
+void reset( int insn_length )
+{
+	memset( gpr, 0, sizeof( gpr ) );
+	for (unsigned int i = 0; i < N_FIELDS; i++) mock[ i ].value = 0;
+	mock_field( VMCS_GUEST_RIP )->value = 0x1000;
+	mock_field( VMCS_GUEST_RFLAGS )->value = RFLAGS_VM | 0x0002;
+	mock_field( VMCS_EXIT_INSN_LENGTH )->value = insn_length;
+	nmi_count = hypercall_count = hypercall_function = 0;
+	hypercall_result = EXIT_RESUME;
+}
+
+void check( const char *what, unsigned long long seen,
+					unsigned long long expected )
+{
+	++checks;
+	if ( seen == expected ) return;
+	printf( " FAILED: %s is %llX (expected %llX) \n", what, seen, expected );
+	++failures;
+}
+
+unsigned long long rip( void ) { return mock_field( VMCS_GUEST_RIP )->value; }
+
+
+int main( void )
+{
+	int	r;
+
+	// CPUID: the VMX feature-bit is hidden, RIP is advanced,
+	// and blocking by STI ends with the emulated instruction
+	reset( 2 );
+	gpr[ GPR_RAX ] = 1;
+	mock_field( VMCS_GUEST_INTERRUPTIBILITY )->value = 1;
+	r = exit_dispatch( &x, 10 );
+	check( "CPUID(1) result", r, EXIT_RESUME );
+	check( "CPUID(1) ECX", gpr[ GPR_RCX ], 0xFFFFFFDF );
+	check( "CPUID(1) EDX", gpr[ GPR_RDX ], 0xFFFFFFFF );
+	check( "CPUID(1) RIP", rip(), 0x1002 );
+	check( "CPUID(1) STI-blocking",
+		mock_field( VMCS_GUEST_INTERRUPTIBILITY )->value, 0 );
+
+	// only EAX selects the leaf (the upper half of RAX is ignored)
+	reset( 2 );
+	gpr[ GPR_RAX ] = ~0xFFFFFFFFUL | 1;
+	r = exit_dispatch( &x, 10 );
+	check( "CPUID(1), high RAX set, ECX", gpr[ GPR_RCX ], 0xFFFFFFDF );
+
+	reset( 2 );
+	r = exit_dispatch( &x, 10 );
+	check( "CPUID(0) EAX", gpr[ GPR_RAX ], 1 );
+	check( "CPUID(0) ECX", gpr[ GPR_RCX ], 0xFFFFFFFF );
+
+	// HLT: with IF=0 it goes to our client, with IF=1 it idles
+	reset( 1 );
+	r = exit_dispatch( &x, 12 );
+	check( "HLT(IF=0) result", r, EXIT_FORWARD );
+	check( "HLT(IF=0) RIP", rip(), 0x1000 );
+
+	reset( 1 );
+	mock_field( VMCS_GUEST_RFLAGS )->value |= RFLAGS_IF;
+	r = exit_dispatch( &x, 12 );
+	check( "HLT(IF=1) result", r, EXIT_IDLE );
+	check( "HLT(IF=1) RIP", rip(), 0x1001 );
+
+	// VMCALL: only one with our signature is a hypercall
+	reset( 3 );
+	gpr[ GPR_RAX ] = VMM_HC( VMM_HC_TIME );
+	r = exit_dispatch( &x, 18 );
+	check( "VMCALL(TIME) result", r, EXIT_RESUME );
+	check( "VMCALL(TIME) function", hypercall_function, VMM_HC_TIME );
+	check( "VMCALL(TIME) RIP", rip(), 0x1003 );
+
+	reset( 3 );
+	gpr[ GPR_RAX ] = VMM_HC( VMM_HC_YIELD );
+	hypercall_result = EXIT_YIELD;
+	r = exit_dispatch( &x, 18 );
+	check( "VMCALL(YIELD) result", r, EXIT_YIELD );
+	check( "VMCALL(YIELD) RIP", rip(), 0x1003 );
+
+	reset( 3 );
+	gpr[ GPR_RAX ] = VMM_HC( VMM_HC_DONE );
+	r = exit_dispatch( &x, 18 );
+	check( "VMCALL(DONE) result", r, EXIT_FORWARD );
+	check( "VMCALL(DONE) calls", hypercall_count, 1 );
+	check( "VMCALL(DONE) RIP", rip(), 0x1000 );
+
+	reset( 3 );
+	gpr[ GPR_RAX ] = VMM_HC_TIME;
+	r = exit_dispatch( &x, 18 );
+	check( "VMCALL(unsigned) result", r, EXIT_FORWARD );
+	check( "VMCALL(unsigned) calls", hypercall_count, 0 );
+	check( "VMCALL(unsigned) RIP", rip(), 0x1000 );
+
+	reset( 3 );
+	gpr[ GPR_RAX ] = VMM_HC( VMM_HC_TIME );
+	mock_field( VMCS_GUEST_RFLAGS )->value = 0x0002;
+	r = exit_dispatch( &x, 18 );
+	check( "VMCALL(not VM86) result", r, EXIT_FORWARD );
+	check( "VMCALL(not VM86) calls", hypercall_count, 0 );
+
+	// IN and OUT: completed by our 'ioport' device, if it claims them
+	reset( 2 );
+	port_0x61 = 0;
+	gpr[ GPR_RAX ] = 0x12345603;
+	mock_field( VMCS_EXIT_QUALIFICATION )->value = ( 0x61 << 16 ) | 0;
+	r = exit_dispatch( &x, 30 );
+	check( "OUT 61h,AL result", r, EXIT_RESUME );
+	check( "OUT 61h,AL data", port_0x61, 0x03 );
+	check( "OUT 61h,AL RIP", rip(), 0x1002 );
+
+	reset( 2 );
+	port_0x61 = 0x5A;
+	gpr[ GPR_RAX ] = 0x12345603;
+	mock_field( VMCS_EXIT_QUALIFICATION )->value = ( 0x61 << 16 ) | 8;
+	r = exit_dispatch( &x, 30 );
+	check( "IN AL,61h result", r, EXIT_RESUME );
+	check( "IN AL,61h EAX", gpr[ GPR_RAX ], 0x1234565A );
+	check( "IN AL,61h RIP", rip(), 0x1002 );
+
+	reset( 1 );
+	mock_field( VMCS_EXIT_QUALIFICATION )->value = ( 0x3F8 << 16 ) | 8;
+	r = exit_dispatch( &x, 30 );
+	check( "IN AL,DX (unclaimed) result", r, EXIT_FORWARD );
+	check( "IN AL,DX (unclaimed) RIP", rip(), 0x1000 );
+
+	reset( 1 );
+	mock_field( VMCS_EXIT_QUALIFICATION )->value = ( 0x61 << 16 ) | 16 | 8;
+	r = exit_dispatch( &x, 30 );
+	check( "INSB result", r, EXIT_FORWARD );
+
+	x.ioport = 0;
+	reset( 1 );
+	mock_field( VMCS_EXIT_QUALIFICATION )->value = ( 0x61 << 16 ) | 8;
+	r = exit_dispatch( &x, 30 );
+	check( "IN AL,61h (no device) result", r, EXIT_FORWARD );
+	x.ioport = fake_ioport;
+
+	// exceptions: an NMI goes to the host, a fault to our client
+	reset( 0 );
+	mock_field( VMCS_EXIT_INTR_INFO )->value = 0x80000202;
+	r = exit_dispatch( &x, 0 );
+	check( "NMI result", r, EXIT_RESUME );
+	check( "NMI delivered", nmi_count, 1 );
+
+	reset( 0 );
+	mock_field( VMCS_EXIT_INTR_INFO )->value = 0x80000B0D;
+	r = exit_dispatch( &x, 0 );
+	check( "#GP result", r, EXIT_FORWARD );
+	check( "#GP no NMI", nmi_count, 0 );
+
+	// exits which only let the host run resume the guest as it was
+	reset( 2 );
+	check( "external interrupt", exit_dispatch( &x, 1 ), EXIT_RESUME );
+	check( "interrupt window", exit_dispatch( &x, 7 ), EXIT_RESUME );
+	check( "preemption timer", exit_dispatch( &x, 52 ), EXIT_RESUME );
+	check( "RIP unchanged", rip(), 0x1000 );
+
+	// entry failures, and reasons without a handler, are forwarded
+	reset( 0 );
+	check( "entry failure", exit_dispatch( &x, 0x80000021 ), EXIT_FORWARD );
+	check( "triple fault", exit_dispatch( &x, 2 ), EXIT_FORWARD );
+	check( "unknown reason", exit_dispatch( &x, 1000 ), EXIT_FORWARD );
+
+	printf( "\n %d checks, %d failed \n\n", checks, failures );
+	return	( failures ) ? 1 : 0;
+}
@@ -0,0 +1,256 @@
+//----------------------------------------------------------------
+//	vmexits.h
+//
+//	Handlers for those VM exits which our VM manager completes
+//	by itself (so it can resume the guest without returning to
+//	its client), selected by exit-reason from 'exit_handlers[]'.
+//	A handler sees its guest only through a VMEXIT structure,
+//	whose VMCS accessors may be replaced by a mock (so that our
+//	handlers can be exercised on hosts which lack VT-x support).
+//
+//	date begun: 17 OCT 2026
+//----------------------------------------------------------------
+
+// slots in 'gpr[]' (in the processor's register-numbering order)
+#define GPR_RAX		0
+#define GPR_RCX		1
+#define GPR_RDX		2
+#define GPR_RBX		3
+#define GPR_RSP		4	// (unused: RSP is held in the VMCS)
+#define GPR_RBP		5
+#define GPR_RSI		6
+#define GPR_RDI		7
+
+// VMCS encodings our handlers use
+#define VMCS_GUEST_RIP			0x681E
+#define VMCS_GUEST_RFLAGS		0x6820
+#define VMCS_GUEST_INTERRUPTIBILITY	0x4824
+#define VMCS_EXIT_INTR_INFO		0x4404
+#define VMCS_EXIT_INSN_LENGTH		0x440C
+#define VMCS_EXIT_QUALIFICATION		0x6400
+
+// what a handler returns
+#define EXIT_RESUME	0	// completed here: resume the guest
+#define EXIT_FORWARD	1	// our client must deal with this exit
+#define EXIT_IDLE	2	// resume the guest once it has an event
+#define EXIT_YIELD	3	// resume the guest once others have run
+
+typedef struct	{
+		unsigned long	*gpr;	// guest's general registers
+		void		*vmcs;	// handle passed to the accessors
+		unsigned long long (*vmread)( void *vmcs, int encoding );
+		void (*vmwrite)( void *vmcs, int encoding,
+						unsigned long long value );
+		void (*cpuid)( unsigned int *regs );  // EAX,EBX,ECX,EDX
+		void (*nmi)( void );	// hands an NMI to the host
+		int (*ioport)( void *vmcs, unsigned int port, int size,
+				int in, unsigned int *data );  // (or 0)
+		int (*hypercall)( void *vmcs, unsigned int function );
+		} VMEXIT;
+
+typedef int (*EXIT_HANDLER)( VMEXIT *x );
+
+
+//----------------------------------------------------------------
+// Step the guest past the instruction which caused its VM exit
+// (any blocking by STI or by MOV-SS ends with that instruction)
+//----------------------------------------------------------------
+void exit_skip_instruction( VMEXIT *x )
+{
+	unsigned long long	rip, len, blocking;
+
+	rip = x->vmread( x->vmcs, VMCS_GUEST_RIP );
+	len = x->vmread( x->vmcs, VMCS_EXIT_INSN_LENGTH );
+	x->vmwrite( x->vmcs, VMCS_GUEST_RIP, (unsigned short)( rip + len ) );
+
+	blocking = x->vmread( x->vmcs, VMCS_GUEST_INTERRUPTIBILITY );
+	if ( blocking & 3 )
+		x->vmwrite( x->vmcs, VMCS_GUEST_INTERRUPTIBILITY, blocking & ~3 );
+}
+
+// reason 0: only a non-maskable interrupt can be dealt with here
+int exit_exception( VMEXIT *x )
+{
+	unsigned long long	info;
+
+	info = x->vmread( x->vmcs, VMCS_EXIT_INTR_INFO );
+	if ( ( info & (1<<31) )&&( ( ( info >> 8 )&7 ) == 2 ) )
+		{
+		x->nmi();
+		return	EXIT_RESUME;
+		}
+	return	EXIT_FORWARD;
+}
+
+// reason 1: the host took the interrupt as soon as we returned
+int exit_extint( VMEXIT *x )
+{
+	(void)x;
+	return	EXIT_RESUME;
+}
+
+// reason 7: the guest can take an interrupt now (our VM manager,
+// which asked for this exit, injects one as it resumes the guest)
+int exit_intwindow( VMEXIT *x )
+{
+	(void)x;
+	return	EXIT_RESUME;
+}
+
+// reason 10: CPUID always exits, so we answer it for the guest
+int exit_cpuid( VMEXIT *x )
+{
+	unsigned int	regs[ 4 ], leaf;
+
+	regs[ 0 ] = leaf = x->gpr[ GPR_RAX ];
+	regs[ 1 ] = x->gpr[ GPR_RBX ];
+	regs[ 2 ] = x->gpr[ GPR_RCX ];
+	regs[ 3 ] = x->gpr[ GPR_RDX ];
+	x->cpuid( regs );
+	if ( leaf == 1 ) regs[ 2 ] &= ~(1<<5);  // no VMX
+
+	x->gpr[ GPR_RAX ] = regs[ 0 ];
+	x->gpr[ GPR_RBX ] = regs[ 1 ];
+	x->gpr[ GPR_RCX ] = regs[ 2 ];
+	x->gpr[ GPR_RDX ] = regs[ 3 ];
+	exit_skip_instruction( x );
+	return	EXIT_RESUME;
+}
+
+// reason 12: a HLT with IF=1 waits for an interrupt (one with IF=0
+// could only be ended by an NMI, so it goes to our client instead)
+int exit_hlt( VMEXIT *x )
+{
+	if ( !( x->vmread( x->vmcs, VMCS_GUEST_RFLAGS ) & (1<<9) ) )
+		return	EXIT_FORWARD;
+	exit_skip_instruction( x );
+	return	EXIT_IDLE;
+}
+
+// reason 18: a VMCALL from virtual-8086 code, with our signature in
+// the upper half of EAX, is a hypercall (see VMM_HC_xxx in 'myvmx.h');
+// VMM_HC_DONE, and any other VMCALL (a client's 'return' sentinel,
+// or the one in our guest's #GP handler), goes back to our client
+int exit_vmcall( VMEXIT *x )
+{
+	unsigned int	eax = x->gpr[ GPR_RAX ];
+	int		handled;
+
+	if (( x->hypercall == 0 )||( ( eax >> 16 ) != VMM_HC_SIGNATURE ))
+		return	EXIT_FORWARD;
+	if ( !( x->vmread( x->vmcs, VMCS_GUEST_RFLAGS ) & (1<<17) ) )
+		return	EXIT_FORWARD;
+	if ( ( eax & 0xFFFF ) == VMM_HC_DONE )
+		{
+		x->hypercall( x->vmcs, VMM_HC_DONE );
+		return	EXIT_FORWARD;
+		}
+
+	handled = x->hypercall( x->vmcs, eax & 0xFFFF );
+	if ( handled != EXIT_FORWARD ) exit_skip_instruction( x );
+	return	handled;
+}
+
+// reason 30: an IN or OUT which one of our VM manager's own devices
+// may complete (the string and repeated forms go to our client)
+int exit_io( VMEXIT *x )
+{
+	unsigned long long	qual;
+	unsigned int		size, mask, data;
+	int			in;
+
+	qual = x->vmread( x->vmcs, VMCS_EXIT_QUALIFICATION );
+	if (( qual & (3<<4) )||( x->ioport == 0 )) return EXIT_FORWARD;
+
+	size = ( qual & 7 ) + 1;
+	mask = ( size == 4 ) ? 0xFFFFFFFF : ( 1 << ( size * 8 ) ) - 1;
+	in = ( qual >> 3 ) & 1;
+	data = x->gpr[ GPR_RAX ] & mask;
+	if ( x->ioport( x->vmcs, ( qual >> 16 ) & 0xFFFF, size, in, &data )
+						!= EXIT_RESUME ) return EXIT_FORWARD;
+
+	if ( in ) x->gpr[ GPR_RAX ] = ( x->gpr[ GPR_RAX ] & ~(unsigned long)mask )
+							| ( data & mask );
+	exit_skip_instruction( x );
+	return	EXIT_RESUME;
+}
+
+// reason 52: the VMX-preemption timer (our VM manager then looks at
+// the call's budget, and at its virtual timer, before resuming)
+int exit_preemption( VMEXIT *x )
+{
+	(void)x;
+	return	EXIT_RESUME;
+}
+
+// reasons whose entry is zero are forwarded to our client
+EXIT_HANDLER exit_handlers[] = {
+			exit_exception,		// 0  exception or NMI
+			exit_extint,		// 1  external interrupt
+			0,			// 2  triple fault
+			0,			// 3
+			0,			// 4
+			0,			// 5
+			0,			// 6
+			exit_intwindow,		// 7  interrupt window
+			0,			// 8
+			0,			// 9
+			exit_cpuid,		// 10 CPUID
+			0,			// 11
+			exit_hlt,		// 12 HLT
+			0,			// 13
+			0,			// 14
+			0,			// 15
+			0,			// 16
+			0,			// 17
+			exit_vmcall,		// 18 VMCALL
+			0,			// 19
+			0,			// 20
+			0,			// 21
+			0,			// 22
+			0,			// 23
+			0,			// 24
+			0,			// 25
+			0,			// 26
+			0,			// 27
+			0,			// 28 CR access
+			0,			// 29
+			exit_io,		// 30 I/O instruction
+			0,			// 31
+			0,			// 32
+			0,			// 33
+			0,			// 34
+			0,			// 35
+			0,			// 36
+			0,			// 37
+			0,			// 38
+			0,			// 39
+			0,			// 40
+			0,			// 41
+			0,			// 42
+			0,			// 43
+			0,			// 44
+			0,			// 45
+			0,			// 46
+			0,			// 47
+			0,			// 48
+			0,			// 49
+			0,			// 50
+			0,			// 51
+			exit_preemption,	// 52 preemption timer
+			};
+
+#define N_HANDLERS	( sizeof( exit_handlers ) / sizeof( EXIT_HANDLER ) )
+
+//----------------------------------------------------------------
+// Run the handler for this exit-reason (a VM-entry failure, or
+// a reason without any handler, goes back to our client)
+//----------------------------------------------------------------
+int exit_dispatch( VMEXIT *x, unsigned int reason )
+{
+	if ( reason & (1<<31) ) return EXIT_FORWARD;
+	reason &= 0xFFFF;
+	if (( reason >= N_HANDLERS )||( exit_handlers[ reason ] == 0 ))
+		return	EXIT_FORWARD;
+	return	exit_handlers[ reason ]( x );
+}
@@ -0,0 +1,188 @@
+//----------------------------------------------------------------
+//	vmpic.h
+//
+//	A virtual 8254 timer (channel 0 only) and a virtual master
+//	8259 interrupt-controller, for a guest whose timer-ticks
+//	should come from our VM manager rather than from the host's
+//	own interrupts.  Ticks which fall due while IRQ0 is still
+//	pending (or while the guest is not running) are merged into
+//	that one request, as an 8259 would merge them.  The guest's
+//	accesses to ports 0x20-0x21 and 0x40, 0x43 are completed here
+//	(see 'exit_io' in 'vmexits.h').  Include this after 'myvmx.h'.
+//
+//	date begun: 17 OCT 2026
+//----------------------------------------------------------------
+
+#define VPIT_HZ		1193182	// input clock of the 8254 timer
+
+typedef struct	{
+		// 8254 channel 0
+		unsigned long long  period;	// TSC cycles per tick (or 0)
+		unsigned long long  next;	// time-stamp of next tick
+		unsigned int	reload;		// its count (0 means 65536)
+		unsigned int	access;		// 1=lsb, 2=msb, 3=lsb,msb
+		unsigned int	count;		// count being written
+		unsigned int	latch;		// count being read
+		int		wflip, rflip;	// next byte is the msb
+		int		latched;	// 'latch' holds a latched count
+		// master 8259
+		unsigned char	irr, isr, imr;
+		unsigned char	base;		// vector for IRQ0 (from ICW2)
+		unsigned char	icw_step;	// ICW expected next (or 0)
+		unsigned char	icw4;		// ICW1 said an ICW4 follows
+		unsigned char	read_isr;	// OCW3 selected the ISR
+		// statistics
+		unsigned long long  ticks;	// IRQ0s taken by the guest
+		unsigned long long  merged;	// ticks merged into another
+		} VPIC;
+
+
+void vpic_reset( VPIC *p )
+{
+	memset( p, 0, sizeof( VPIC ) );
+	p->base = 0x08;		// as the ROM-BIOS programs it
+	p->access = 3;
+}
+
+// start channel 0 counting down from 'reload' (0 stops the timer)
+void vpit_program( VPIC *p, unsigned int reload, unsigned long long now )
+{
+	p->reload = reload;
+	p->period = ( reload ? reload : 65536 ) * 1000ULL * tsc_khz / VPIT_HZ;
+	p->next = now + p->period;
+}
+
+// see whether a tick has fallen due; raise IRQ0, or merge the tick
+void vpic_tick( VPIC *p, unsigned long long now )
+{
+	unsigned long long	due;
+
+	if (( p->period == 0 )||( now < p->next )) return;
+
+	due = ( now - p->next ) / p->period + 1;
+	p->next += due * p->period;
+	if ( !( p->irr & 1 ) ) { p->irr |= 1; --due; }
+	p->merged += due;
+}
+
+// the vector of the highest-priority request now deliverable (or -1)
+int vpic_pending( VPIC *p )
+{
+	unsigned char	req = p->irr & ~p->imr;
+	int		irq;
+
+	for (irq = 0; irq < 8; irq++)
+		{
+		if ( p->isr & ( 1 << irq ) ) return -1;
+		if ( req & ( 1 << irq ) ) return p->base + irq;
+		}
+	return	-1;
+}
+
+// the guest takes that interrupt: its request moves into service
+int vpic_ack( VPIC *p )
+{
+	int	vector = vpic_pending( p );
+
+	if ( vector < 0 ) return -1;
+	p->irr &= ~( 1 << ( vector - p->base ) );
+	p->isr |= ( 1 << ( vector - p->base ) );
+	if ( vector == p->base ) ++p->ticks;
+	return	vector;
+}
+
+// the count channel 0 would show now
+unsigned int vpit_count( VPIC *p, unsigned long long now )
+{
+	unsigned long long	left;
+
+	if (( p->period == 0 )||( tsc_khz == 0 )) return p->reload;
+	left = ( p->next > now ) ? p->next - now : 0;
+	return	(unsigned short)( left * VPIT_HZ / ( 1000ULL * tsc_khz ) );
+}
+
+//----------------------------------------------------------------
+// Complete the guest's IN or OUT (one byte) on one of our ports;
+// returns nonzero for an access this device does not implement
+//----------------------------------------------------------------
+int vpic_io( VPIC *p, unsigned int port, int in, unsigned int *data,
+						unsigned long long now )
+{
+	unsigned int	val = *data & 0xFF;
+	int		irq;
+
+	switch ( port )
+		{
+		case 0x20:
+		if ( in ) { *data = p->read_isr ? p->isr : p->irr; break; }
+		if ( val & 0x10 )		// ICW1
+			{
+			p->irr = p->isr = p->imr = 0;
+			p->icw4 = val & 1;
+			p->icw_step = 2;
+			}
+		else if ( val & 0x08 )		// OCW3
+			{
+			if ( val & 2 ) p->read_isr = val & 1;
+			}
+		else if ( ( val >> 5 ) == 1 )	// OCW2: non-specific EOI
+			{
+			for (irq = 0; irq < 8; irq++)
+				if ( p->isr & ( 1 << irq ) )
+					{ p->isr &= ~( 1 << irq ); break; }
+			}
+		else if ( ( val >> 5 ) == 3 )	// OCW2: specific EOI
+			p->isr &= ~( 1 << ( val & 7 ) );
+		break;
+
+		case 0x21:
+		if ( in ) { *data = p->imr; break; }
+		if ( p->icw_step == 2 )		// ICW2: vector base
+			{
+			p->base = val & 0xF8;
+			p->icw_step = 3;
+			}
+		else if ( p->icw_step == 3 )	// ICW3 (cascading)
+			p->icw_step = ( p->icw4 ) ? 4 : 0;
+		else if ( p->icw_step == 4 )	// ICW4 (8086 mode)
+			p->icw_step = 0;
+		else	p->imr = val;		// OCW1: interrupt mask
+		break;
+
+		case 0x40:
+		if ( in )
+			{
+			if ( !p->latched ) p->latch = vpit_count( p, now );
+			if (( p->access == 2 )||( p->rflip )) *data = p->latch >> 8;
+			else	*data = p->latch & 0xFF;
+			if (( p->access != 3 )||( p->rflip )) p->latched = 0;
+			if ( p->access == 3 ) p->rflip ^= 1;
+			break;
+			}
+		if ( p->access == 1 ) vpit_program( p, val, now );
+		else if ( p->access == 2 ) vpit_program( p, val << 8, now );
+		else if ( !p->wflip ) { p->count = val; p->wflip = 1; }
+		else	{
+			vpit_program( p, p->count | ( val << 8 ), now );
+			p->wflip = 0;
+			}
+		break;
+
+		case 0x43:
+		if (( in )||( ( val >> 6 ) != 0 )) return -1;	// channel 0 only
+		if ( ( ( val >> 4 ) & 3 ) == 0 )	// counter-latch command
+			{
+			p->latch = vpit_count( p, now );
+			p->latched = 1;
+			p->rflip = 0;
+			break;
+			}
+		p->access = ( val >> 4 ) & 3;
+		p->wflip = p->rflip = p->latched = 0;
+		break;
+
+		default:
+		return	-1;
+		}
+	return	0;
+}
@@ -0,0 +1,117 @@
+//-------------------------------------------------------------------
+//	vmrings.cpp
+//
+//	This application uses the asynchronous calls provided by our
+//	'newvmm64.c' Linux Kernel Module:  it opens several virtual
+//	machines, queues a series of ROM-BIOS calls on the ring page
+//	of each one, and then collects the results (in whatever order
+//	the VMs finish them) by waiting in poll() for any VM to have
+//	some results ready.  No thread of ours waits inside an ioctl.
+//
+//		usage:  $ ./vmrings [number-of-vms]
+//
+//	written on: 17 OCT 2026
+//-------------------------------------------------------------------
+
+#include <stdio.h>		// for printf(), perror()
+#include <fcntl.h>		// for open()
+#include <stdlib.h>		// for exit(), atoi()
+#include <poll.h>		// for poll()
+#include <sys/mman.h>		// for mmap(), munmap()
+#include <sys/ioctl.h>		// for ioctl()
+#include "myvmx.h"		// for 'ring_ia32'
+
+#define  TOS	0x00008000	// stackbase address
+#define  MAXVMS		8	// most VMs we will open
+#define  NCALLS		8	// calls queued on each VM
+
+int		fd[ MAXVMS ];
+ring_ia32	*ring[ MAXVMS ];
+struct pollfd	pfd[ MAXVMS ];
+
+void plant_int86( int id, regs_ia32 &vm )
+{
+	unsigned int	*eoi = (unsigned int*)TOS;
+	eoi[0] = 0x90C1010F;	// 'vmcall' instruction, NOP
+
+	unsigned short	*tos = (unsigned short*)TOS;
+	tos[-1] = (1<<9);	// IF-bit (in EFLAGS)
+	tos[-2] = (TOS >> 4);	// real-mode CS-value
+	tos[-3] = (TOS & 0xF);	// real-mode IP-value
+
+	vm.eflags = 0x23200;	// VM=1, IOPL=3, IF=1
+	vm.eip = *(unsigned short*)( id*4 + 0);
+	vm.cs  = *(unsigned short*)( id*4 + 2);
+	vm.esp = TOS - 6;
+	vm.ss  = 0x0000;
+}
+
+int main( int argc, char **argv )
+{
+	int	nvms = ( argc > 1 ) ? atoi( argv[1] ) : 4;
+	if (( nvms < 1 )||( nvms > MAXVMS )) nvms = MAXVMS;
+
+	int	size = 0x110000;
+	int	prot = PROT_READ | PROT_WRITE | PROT_EXEC;
+	int	flag = MAP_FIXED | MAP_SHARED;
+
+	for (int v = 0; v < nvms; v++)
+		{
+		fd[v] = open( "/dev/vmm", O_RDWR );
+		if ( fd[v] < 0 ) { perror( "/dev/vmm" ); exit(1); }
+
+		// each VM's memory is mapped in turn, while we prepare it
+		if ( mmap( NULL, size, prot, flag, fd[v], 0 ) == MAP_FAILED )
+			{ perror( "mmap" ); exit(1); }
+
+		void	*mm = mmap( NULL, 4096,
+				PROT_READ | PROT_WRITE, MAP_SHARED,
+				fd[v], VMM_RING_MMAP );
+		if ( mm == MAP_FAILED ) { perror( "mmap ring" ); exit(1); }
+		ring[v] = (ring_ia32*)mm;
+
+		// queue calls to int 0x11 (equipment) and int 0x12 (memory)
+		for (int i = 0; i < NCALLS; i++)
+			{
+			ring_entry_ia32	*e;
+
+			e = &ring[v]->sq[ ring[v]->sq_tail % VMM_RING_SLOTS ];
+			plant_int86( ( i & 1 ) ? 0x12 : 0x11, e->regs );
+			e->tag = ( v << 8 ) | i;
+			__sync_synchronize();	// request before 'sq_tail'
+			++ring[v]->sq_tail;
+			}
+		munmap( NULL, size );
+
+		pfd[v].fd = fd[v];
+		pfd[v].events = POLLIN;
+		if ( ioctl( fd[v], VMM_SUBMIT ) < 0 )
+			{ perror( "VMM_SUBMIT" ); exit(1); }
+		}
+
+	printf( "\n queued %d calls on each of %d VMs \n\n", NCALLS, nvms );
+
+	for (int done = 0; done < nvms * NCALLS; )
+		{
+		if ( poll( pfd, nvms, -1 ) < 0 ) { perror( "poll" ); exit(1); }
+
+		for (int v = 0; v < nvms; v++)
+			{
+			if ( !( pfd[v].revents & POLLIN ) ) continue;
+			volatile ring_ia32	*r = ring[v];
+			while ( r->cq_head != r->cq_tail )
+				{
+				__sync_synchronize();	// 'cq_tail' before result
+				ring_entry_ia32	e = ring[v]->cq[ r->cq_head
+							% VMM_RING_SLOTS ];
+				++r->cq_head;
+				++done;
+				printf( "   vm %d call %d: ", v, (int)( e.tag & 0xFF ) );
+				printf( "status=%d reason=%d ", e.status, e.reason );
+				printf( "int 0x%02X returned AX=%04X \n",
+					( e.tag & 1 ) ? 0x12 : 0x11, e.regs.eax & 0xFFFF );
+				}
+			}
+		}
+	printf( "\n" );
+}
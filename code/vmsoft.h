@@ -0,0 +1,1440 @@
+//----------------------------------------------------------------
+//	vmsoft.h
+//
+//	A software backend for our VM manager, for hosts whose cpus
+//	lack VT-x (or which are themselves VMs without nested VMX):
+//	an interpreter for the 16-bit real-mode (virtual-8086) code
+//	which our clients call.  It keeps the contract of our VMX
+//	backend -- the guest's registers arrive in a 'regs_ia32', its
+//	memory is the VM's own 'lower_region' (which clients mmap)
+//	plus the host's video-memory and ROMs, and each run ends with
+//	the exit-reason (and exit-fields) a VM exit would have shown.
+//	Instructions are decoded once, into basic blocks which are
+//	kept in a cache, so repeated ROM-BIOS paths don't pay their
+//	decoding cost again.  Include this after 'vmexits.h'.
+//
+//	date begun: 17 OCT 2026
+//----------------------------------------------------------------
+
+#define SOFT_BLOCKS	256	// basic blocks in each VM's cache
+#define SOFT_INSNS	16	// most instructions in one block
+#define SOFT_HASH	256	// chains in the cache's hash-table
+#define SOFT_VIDEO	0x0A0000	// host's video-memory starts here
+#define SOFT_ROM_BASE	0x0C0000	// and its ROMs (read-only for us)
+#define SOFT_ROM_TOP	0x100000	//   end here, below the HMA
+#define SOFT_REACH	0x110000	// address-reach in VM86-mode
+#define SOFT_NOWHERE	0x200000	// (an address reaching nothing)
+#define SOFT_REP_MAX	0x10000	// most string-steps per execution
+
+// EFLAGS bits
+#define SF_CF		0x0001
+#define SF_PF		0x0004
+#define SF_AF		0x0010
+#define SF_ZF		0x0040
+#define SF_SF		0x0080
+#define SF_TF		0x0100
+#define SF_IF		0x0200
+#define SF_DF		0x0400
+#define SF_OF		0x0800
+#define SF_ARITH	0x08D5	// the six arithmetic flags
+#define SF_POPF		0x0FD5	// what POPF and IRET may change
+#define SF_POPFD	0x240000	// (and with 32-bit operands: AC, ID)
+
+// decoded forms and prefixes (in 'SOFT_INSN.flags')
+#define SI_OPSIZE	0x01	// 66 prefix: 32-bit operands
+#define SI_ADDRSIZE	0x02	// 67 prefix: 32-bit addressing
+#define SI_REP		0x04	// F3 prefix
+#define SI_REPNE	0x08	// F2 prefix
+#define SI_MODRM	0x10	// has a ModR/M byte
+#define SI_MEM		0x20	// with a memory operand
+#define SI_END		0x40	// ends its basic block
+
+typedef struct	{
+		unsigned short	op;	// opcode (0x0Fxx for two-byte ones)
+		unsigned char	len;	// instruction length, with prefixes
+		unsigned char	flags;	// SI_xxx
+		signed char	seg;	// segment override (or -1)
+		unsigned char	modrm;
+		signed char	base, index;	// address registers (or -1)
+		unsigned char	scale;
+		unsigned char	ea_seg;	// default segment for that address
+		unsigned short	imm2;	// far pointer's segment, ENTER's level
+		unsigned int	disp;
+		unsigned int	imm;
+		} SOFT_INSN;
+
+typedef struct	{
+		unsigned int	linear;	// of its first instruction (or ~0)
+		unsigned int	end;	// just past its last one
+		int		count;
+		int		next;	// next block in its chain (or -1)
+		SOFT_INSN	insn[ SOFT_INSNS ];
+		} SOFT_BLOCK;
+
+typedef struct	{
+		int		hash[ SOFT_HASH ];	// first block in each chain
+		int		victim;		// block to be replaced next
+		unsigned char	code_page[ SOFT_REACH >> 12 ];	// RAM holding code
+		unsigned long	hits, misses, flushes;
+		unsigned long long  insns;	// instructions executed
+		SOFT_BLOCK	block[ SOFT_BLOCKS ];
+		} SOFT_CACHE;
+
+typedef struct	{
+		regs_ia32	*regs;		// guest's registers (in and out)
+		unsigned char	*low;		// its memory (and from 1MB up)
+		unsigned char	*high;		// host's memory (0xA0000-0xFFFFF)
+		unsigned char	*iomap;		// I/O bitmaps (a bit set: exit)
+		SOFT_CACHE	*cache;
+		void		*dev;		// passed to these (which may be 0)
+		int (*ioport)( void *dev, unsigned int port, int size, int in,
+							unsigned int *data );
+		int (*irq)( void *dev, int ready );	// a vector to take, or -1
+		int (*hypercall)( void *dev, unsigned int insn_len );
+		int		stop;		// run ends, with this VM exit:
+		unsigned int	reason;
+		unsigned int	intr_info;
+		unsigned int	insn_len;
+		unsigned long long  qual;
+		unsigned int	io_rcx;
+		unsigned int	linear;
+		int		branch;		// current block is finished
+		unsigned int	next_ip;	// where execution continues
+		unsigned char	scratch[ 4 ];	// where writes to ROM go
+		int		idle;		// or (EXIT_IDLE, EXIT_YIELD) to
+		} SOFT_CPU;			//   let the guest wait a while
+
+#define SOFT_GPR( c )	( &(c)->regs->eax )	// EAX..EDI, in encoding order
+#define SOFT_SEG( c )	( &(c)->regs->es )	// ES,CS,SS,DS,FS,GS likewise
+
+
+//----------------------------------------------------------------
+// the block cache
+//----------------------------------------------------------------
+int soft_hash( unsigned int linear )
+{
+	return	( linear ^ ( linear >> 8 ) ) & ( SOFT_HASH - 1 );
+}
+
+// blocks which lie wholly in the ROMs are never written (by the guest
+// or by our client), so only blocks in RAM need ever be discarded
+void soft_flush( SOFT_CACHE *sc, int all )
+{
+	SOFT_BLOCK	*b;
+	int		i;
+
+	for (i = 0; i < SOFT_HASH; i++) sc->hash[ i ] = -1;
+	for (i = 0; i < SOFT_BLOCKS; i++)
+		{
+		b = &sc->block[ i ];
+		if (( all )||( b->linear < SOFT_ROM_BASE )||( b->end > SOFT_ROM_TOP ))
+			b->linear = ~0;
+		if ( b->linear == ~0 ) continue;
+		b->next = sc->hash[ soft_hash( b->linear ) ];
+		sc->hash[ soft_hash( b->linear ) ] = i;
+		}
+	memset( sc->code_page, 0, sizeof( sc->code_page ) );
+	++sc->flushes;
+}
+
+void soft_cache_init( SOFT_CACHE *sc )
+{
+	memset( sc, 0, sizeof( SOFT_CACHE ) );
+	soft_flush( sc, 1 );
+	sc->flushes = 0;
+}
+
+// take the next block (round-robin) out of whichever chain holds it
+SOFT_BLOCK *soft_evict( SOFT_CACHE *sc )
+{
+	SOFT_BLOCK	*b = &sc->block[ sc->victim ];
+	int		*link;
+
+	if ( b->linear != ~0 )
+		{
+		link = &sc->hash[ soft_hash( b->linear ) ];
+		while ( *link != sc->victim ) link = &sc->block[ *link ].next;
+		*link = b->next;
+		}
+	sc->victim = ( sc->victim + 1 ) % SOFT_BLOCKS;
+	return	b;
+}
+
+
+//----------------------------------------------------------------
+// guest memory, by linear address (which in VM86 is seg*16 + off)
+//----------------------------------------------------------------
+unsigned char *soft_mem( SOFT_CPU *c, unsigned int linear, int write )
+{
+	unsigned char	*p;
+
+	if ( linear < SOFT_VIDEO ) p = c->low + linear;
+	else if ( linear < SOFT_ROM_BASE ) p = c->high + linear;
+	else if ( linear < SOFT_ROM_TOP )
+		{
+		if ( write ) return c->scratch;
+		return	c->high + linear;
+		}
+	else if ( linear < SOFT_REACH ) p = c->low + linear - SOFT_ROM_TOP;
+	else	return	c->scratch;
+
+	// a write over code we have decoded discards those decodings
+	// (and ends this block, which may be one of them)
+	if (( write )&&( c->cache->code_page[ linear >> 12 ] ))
+		{
+		soft_flush( c->cache, 0 );
+		c->branch = 1;
+		}
+	return	p;
+}
+
+unsigned int soft_read( SOFT_CPU *c, unsigned int linear, int size )
+{
+	unsigned int	v = 0;
+	int		i;
+
+	for (i = 0; i < size; i++)
+		v |= *soft_mem( c, linear + i, 0 ) << ( i * 8 );
+	return	v;
+}
+
+void soft_write( SOFT_CPU *c, unsigned int linear, int size, unsigned int v )
+{
+	int	i;
+
+	for (i = 0; i < size; i++)
+		*soft_mem( c, linear + i, 1 ) = v >> ( i * 8 );
+}
+
+
+//----------------------------------------------------------------
+// the decoder: prefixes, opcode, then (for those which have them)
+// the ModR/M, SIB, displacement and immediate bytes
+//----------------------------------------------------------------
+int soft_has_modrm( unsigned int op )
+{
+	if ( op < 0x40 ) return ( op & 7 ) < 4;
+	if ( op < 0x100 )
+		switch ( op )
+			{
+			case 0x62: case 0x63: case 0x69: case 0x6B:
+			case 0xC0: case 0xC1: case 0xC4: case 0xC5:
+			case 0xC6: case 0xC7: case 0xD0: case 0xD1:
+			case 0xD2: case 0xD3: case 0xF6: case 0xF7:
+			case 0xFE: case 0xFF:
+			return	1;
+			default:
+			return	(( op >= 0x80 )&&( op <= 0x8F ))
+				||(( op >= 0xD8 )&&( op <= 0xDF ));
+			}
+	op &= 0xFF;
+	if (( op <= 0x03 )||(( op >= 0x20 )&&( op <= 0x23 ))) return 1;
+	if (( op >= 0x90 )&&( op <= 0x9F )) return 1;
+	switch ( op )
+		{
+		case 0xA3: case 0xA4: case 0xA5: case 0xAB: case 0xAC:
+		case 0xAD: case 0xAF: case 0xB2: case 0xB3: case 0xB4:
+		case 0xB5: case 0xB6: case 0xB7: case 0xBA: case 0xBB:
+		case 0xBC: case 0xBD: case 0xBE: case 0xBF:
+		return	1;
+		}
+	return	0;
+}
+
+// bytes of immediate data, where 'v' means the operand-size
+int soft_imm_size( SOFT_INSN *in, int v )
+{
+	unsigned int	op = in->op;
+
+	if ( op < 0x40 )
+		return	( ( op & 7 ) == 4 ) ? 1 : ( ( op & 7 ) == 5 ) ? v : 0;
+	if (( op >= 0x70 )&&( op <= 0x7F )) return 1;
+	if (( op >= 0xB0 )&&( op <= 0xB7 )) return 1;
+	if (( op >= 0xB8 )&&( op <= 0xBF )) return v;
+	if (( op >= 0xE0 )&&( op <= 0xE7 )) return 1;
+	if (( op >= 0x0F80 )&&( op <= 0x0F8F )) return v;
+	switch ( op )
+		{
+		case 0x6A: case 0x6B: case 0x80: case 0x82: case 0x83:
+		case 0xA8: case 0xC0: case 0xC1: case 0xC6: case 0xCD:
+		case 0xD4: case 0xD5: case 0xEB: case 0x0FBA:
+		return	1;
+		case 0x68: case 0x69: case 0x81: case 0xA9: case 0xC7:
+		case 0xE8: case 0xE9: case 0x9A: case 0xEA:
+		return	v;
+		case 0xC2: case 0xCA: case 0xC8:
+		return	2;
+		case 0xF6:
+		return	( ( in->modrm >> 3 ) & 7 ) < 2 ? 1 : 0;
+		case 0xF7:
+		return	( ( in->modrm >> 3 ) & 7 ) < 2 ? v : 0;
+		}
+	return	0;
+}
+
+int soft_ends_block( unsigned int op )
+{
+	if (( op >= 0x70 )&&( op <= 0x7F )) return 1;
+	if (( op >= 0xE0 )&&( op <= 0xE3 )) return 1;
+	if (( op >= 0xE8 )&&( op <= 0xEB )) return 1;
+	if (( op >= 0xC2 )&&( op <= 0xC3 )) return 1;
+	if (( op >= 0xCA )&&( op <= 0xCF )) return 1;
+	if (( op >= 0x0F80 )&&( op <= 0x0F8F )) return 1;
+	switch ( op )
+		{
+		case 0x9A: case 0x9D: case 0xF4: case 0xFB: case 0xFF:
+		case 0x0F01:
+		return	1;
+		}
+	return	0;
+}
+
+void soft_decode( SOFT_CPU *c, unsigned int cs, unsigned int ip,
+							SOFT_INSN *in )
+{
+	unsigned int	base = ( cs & 0xFFFF ) << 4, start = ip;
+	unsigned int	b, mod, rm, sib;
+	int		v, n, i;
+
+#define	FETCH()	( *soft_mem( c, base + ( ip++ & 0xFFFF ), 0 ) )
+
+	memset( in, 0, sizeof( SOFT_INSN ) );
+	in->seg = in->base = in->index = -1;
+	in->ea_seg = 3;
+	for (;;)
+		{
+		b = FETCH();
+		if ( ip - start > 14 ) break;
+		switch ( b )
+			{
+			case 0x26: in->seg = 0; continue;
+			case 0x2E: in->seg = 1; continue;
+			case 0x36: in->seg = 2; continue;
+			case 0x3E: in->seg = 3; continue;
+			case 0x64: in->seg = 4; continue;
+			case 0x65: in->seg = 5; continue;
+			case 0x66: in->flags |= SI_OPSIZE; continue;
+			case 0x67: in->flags |= SI_ADDRSIZE; continue;
+			case 0xF0: continue;
+			case 0xF2: in->flags |= SI_REPNE; continue;
+			case 0xF3: in->flags |= SI_REP; continue;
+			}
+		break;
+		}
+	if ( b == 0x0F ) b = 0x0F00 | FETCH();
+	in->op = b;
+
+	if ( soft_has_modrm( in->op ) )
+		{
+		in->flags |= SI_MODRM;
+		in->modrm = FETCH();
+		mod = in->modrm >> 6;
+		rm = in->modrm & 7;
+		if ( mod != 3 ) in->flags |= SI_MEM;
+		if (( mod != 3 )&&( !( in->flags & SI_ADDRSIZE ) ))
+			{
+			static const signed char  base16[] = { 3, 3, 5, 5, 6, 7, 5, 3 };
+			static const signed char  index16[] = { 6, 7, 6, 7, -1, -1, -1, -1 };
+
+			in->base = base16[ rm ];
+			in->index = index16[ rm ];
+			if (( rm == 2 )||( rm == 3 )||( rm == 6 )) in->ea_seg = 2;
+			if (( mod == 0 )&&( rm == 6 ))
+				{ in->base = -1; in->ea_seg = 3; mod = 2; }
+			if ( mod == 1 ) in->disp = (signed char)FETCH();
+			if ( mod == 2 )
+				{ in->disp = FETCH(); in->disp |= FETCH() << 8; }
+			}
+		else if ( mod != 3 )
+			{
+			in->base = rm;
+			if ( rm == 4 )
+				{
+				sib = FETCH();
+				in->scale = sib >> 6;
+				in->index = ( ( ( sib >> 3 ) & 7 ) == 4 ) ? -1 : ( sib >> 3 ) & 7;
+				in->base = sib & 7;
+				if (( mod == 0 )&&( in->base == 5 ))
+					{ in->base = -1; mod = 2; }
+				}
+			else if (( mod == 0 )&&( rm == 5 ))
+				{ in->base = -1; mod = 2; }
+			if (( in->base == 4 )||( in->base == 5 )) in->ea_seg = 2;
+			if ( mod == 1 ) in->disp = (signed char)FETCH();
+			if ( mod == 2 )
+				for (i = 0; i < 4; i++) in->disp |= FETCH() << ( i * 8 );
+			}
+		}
+
+	// a memory-offset operand is a displacement with no registers
+	if (( in->op >= 0xA0 )&&( in->op <= 0xA3 ))
+		{
+		in->flags |= SI_MEM;
+		n = ( in->flags & SI_ADDRSIZE ) ? 4 : 2;
+		for (i = 0; i < n; i++) in->disp |= FETCH() << ( i * 8 );
+		}
+
+	v = ( in->flags & SI_OPSIZE ) ? 4 : 2;
+	n = soft_imm_size( in, v );
+	for (i = 0; i < n; i++) in->imm |= FETCH() << ( i * 8 );
+	if (( in->op == 0x9A )||( in->op == 0xEA ))
+		{ in->imm2 = FETCH(); in->imm2 |= FETCH() << 8; }
+	if ( in->op == 0xC8 ) in->imm2 = FETCH();
+
+	in->len = ip - start;
+	if ( soft_ends_block( in->op ) ) in->flags |= SI_END;
+#undef	FETCH
+}
+
+// find the block which starts at CS:IP, or decode it into the cache
+SOFT_BLOCK *soft_block( SOFT_CPU *c, unsigned int cs, unsigned int ip )
+{
+	SOFT_CACHE	*sc = c->cache;
+	SOFT_BLOCK	*b;
+	unsigned int	linear = ( ( cs & 0xFFFF ) << 4 ) + ( ip & 0xFFFF );
+	unsigned int	page, len = 0;
+	int		i, h = soft_hash( linear );
+
+	for (i = sc->hash[ h ]; i >= 0; i = sc->block[ i ].next)
+		if ( sc->block[ i ].linear == linear )
+			{
+			++sc->hits;
+			return	&sc->block[ i ];
+			}
+
+	++sc->misses;
+	b = soft_evict( sc );
+	b->count = 0;
+	while ( b->count < SOFT_INSNS )
+		{
+		SOFT_INSN	*in = &b->insn[ b->count++ ];
+
+		soft_decode( c, cs, ( ip + len ) & 0xFFFF, in );
+		len += in->len;
+		if ( in->flags & SI_END ) break;
+		if ( ( ip & 0xFFFF ) + len > 0xFFFF ) break;	// (segment wraps)
+		}
+	b->linear = linear;
+	b->end = linear + len;
+	b->next = sc->hash[ h ];
+	sc->hash[ h ] = b - sc->block;
+
+	// note the RAM it came from, so writes there can discard it
+	for (page = linear >> 12; page <= ( b->end - 1 ) >> 12; page++)
+		if (( page < ( SOFT_REACH >> 12 ) )
+			&&(( page < ( SOFT_ROM_BASE >> 12 ) )
+			||( page >= ( SOFT_ROM_TOP >> 12 ) )))
+			sc->code_page[ page ] = 1;
+	return	b;
+}
+
+
+//----------------------------------------------------------------
+// operands
+//----------------------------------------------------------------
+unsigned int soft_mask( int size )
+{
+	return	( size == 4 ) ? 0xFFFFFFFF : ( 1U << ( size * 8 ) ) - 1;
+}
+
+int soft_sext( unsigned int v, int size )
+{
+	if ( size == 1 ) return (signed char)v;
+	if ( size == 2 ) return (short)v;
+	return	(int)v;
+}
+
+unsigned int soft_getreg( SOFT_CPU *c, int r, int size )
+{
+	unsigned int	*gpr = SOFT_GPR( c );
+
+	if ( size == 1 )
+		return	( r < 4 ) ? gpr[ r ] & 0xFF : ( gpr[ r - 4 ] >> 8 ) & 0xFF;
+	return	gpr[ r ] & soft_mask( size );
+}
+
+void soft_setreg( SOFT_CPU *c, int r, int size, unsigned int v )
+{
+	unsigned int	*gpr = SOFT_GPR( c );
+
+	if (( size == 1 )&&( r < 4 ))
+		gpr[ r ] = ( gpr[ r ] & ~0xFF ) | ( v & 0xFF );
+	else if ( size == 1 )
+		gpr[ r - 4 ] = ( gpr[ r - 4 ] & ~0xFF00 ) | ( ( v & 0xFF ) << 8 );
+	else if ( size == 2 )
+		gpr[ r ] = ( gpr[ r ] & ~0xFFFF ) | ( v & 0xFFFF );
+	else	gpr[ r ] = v;
+}
+
+// the guest takes an exception: the run ends, as a VM exit would
+void soft_fault( SOFT_CPU *c, int vector )
+{
+	if ( c->stop ) return;
+	c->stop = 1;
+	c->reason = 0;
+	c->intr_info = (1<<31) | (3<<8) | vector;
+	if (( vector == 13 )||( vector == 12 )) c->intr_info |= (1<<11);
+}
+
+unsigned int soft_offset( SOFT_CPU *c, SOFT_INSN *in )
+{
+	unsigned int	*gpr = SOFT_GPR( c ), off = in->disp;
+
+	if ( in->base >= 0 ) off += gpr[ in->base ];
+	if ( in->index >= 0 ) off += gpr[ in->index ] << in->scale;
+	if ( !( in->flags & SI_ADDRSIZE ) ) off &= 0xFFFF;
+	return	off;
+}
+
+unsigned int soft_seg_base( SOFT_CPU *c, SOFT_INSN *in, int seg )
+{
+	if ( in->seg >= 0 ) seg = in->seg;
+	return	( SOFT_SEG( c )[ seg ] & 0xFFFF ) << 4;
+}
+
+// the linear address of a memory operand (beyond a segment's 64KB
+// limit, a 32-bit offset faults)
+unsigned int soft_ea( SOFT_CPU *c, SOFT_INSN *in )
+{
+	unsigned int	off = soft_offset( c, in );
+
+	if ( off > 0xFFFF ) { soft_fault( c, 13 ); return SOFT_NOWHERE; }
+	return	soft_seg_base( c, in, in->ea_seg ) + off;
+}
+
+unsigned int soft_rm( SOFT_CPU *c, SOFT_INSN *in, unsigned int ea, int size )
+{
+	if ( in->flags & SI_MEM ) return soft_read( c, ea, size );
+	return	soft_getreg( c, in->modrm & 7, size );
+}
+
+void soft_set_rm( SOFT_CPU *c, SOFT_INSN *in, unsigned int ea, int size,
+							unsigned int v )
+{
+	if ( in->flags & SI_MEM ) soft_write( c, ea, size, v );
+	else	soft_setreg( c, in->modrm & 7, size, v );
+}
+
+// (the stack is always SS:SP, since VM86 segments are 16-bit)
+void soft_push( SOFT_CPU *c, int size, unsigned int v )
+{
+	regs_ia32	*r = c->regs;
+	unsigned int	sp = ( r->esp - size ) & 0xFFFF;
+
+	r->esp = ( r->esp & ~0xFFFF ) | sp;
+	soft_write( c, ( ( r->ss & 0xFFFF ) << 4 ) + sp, size, v );
+}
+
+unsigned int soft_pop( SOFT_CPU *c, int size )
+{
+	regs_ia32	*r = c->regs;
+	unsigned int	sp = r->esp & 0xFFFF;
+
+	r->esp = ( r->esp & ~0xFFFF ) | ( ( sp + size ) & 0xFFFF );
+	return	soft_read( c, ( ( r->ss & 0xFFFF ) << 4 ) + sp, size );
+}
+
+
+//----------------------------------------------------------------
+// flags and arithmetic
+//----------------------------------------------------------------
+int soft_parity( unsigned int v )
+{
+	v &= 0xFF;
+	v ^= v >> 4;
+	v ^= v >> 2;
+	v ^= v >> 1;
+	return	!( v & 1 );
+}
+
+// set ZF, SF and PF for a result
+void soft_szp( SOFT_CPU *c, unsigned int v, int size )
+{
+	unsigned int	*fl = &c->regs->eflags;
+
+	v &= soft_mask( size );
+	*fl &= ~( SF_ZF | SF_SF | SF_PF );
+	if ( v == 0 ) *fl |= SF_ZF;
+	if ( v >> ( size * 8 - 1 ) ) *fl |= SF_SF;
+	if ( soft_parity( v ) ) *fl |= SF_PF;
+}
+
+// ADD, OR, ADC, SBB, AND, SUB, XOR, CMP (as numbered in opcodes)
+unsigned int soft_alu( SOFT_CPU *c, int op, unsigned int a, unsigned int b,
+							int size )
+{
+	unsigned int	*fl = &c->regs->eflags, mask = soft_mask( size );
+	unsigned int	sign = 1U << ( size * 8 - 1 );
+	unsigned int	cf = *fl & SF_CF, res, f = 0;
+	unsigned long long  wide;
+
+	a &= mask;
+	b &= mask;
+	switch ( op )
+		{
+		case 0: case 2:
+		wide = (unsigned long long)a + b + ( op == 2 ? cf : 0 );
+		res = wide & mask;
+		if ( wide > mask ) f |= SF_CF;
+		if ( ( a ^ res ) & ( b ^ res ) & sign ) f |= SF_OF;
+		break;
+		case 3: case 5: case 7:
+		wide = (unsigned long long)b + ( op == 3 ? cf : 0 );
+		res = ( a - wide ) & mask;
+		if ( a < wide ) f |= SF_CF;
+		if ( ( a ^ b ) & ( a ^ res ) & sign ) f |= SF_OF;
+		break;
+		case 1: res = a | b; break;
+		case 4: res = a & b; break;
+		default: res = a ^ b; break;
+		}
+	if ( ( a ^ b ^ res ) & 0x10 ) f |= SF_AF;
+	*fl = ( *fl & ~SF_ARITH ) | f;
+	soft_szp( c, res, size );
+	if (( op == 1 )||( op == 4 )||( op == 6 )) *fl &= ~SF_AF;
+	return	res;
+}
+
+// INC and DEC leave CF alone
+unsigned int soft_incdec( SOFT_CPU *c, unsigned int v, int dec, int size )
+{
+	unsigned int	cf = c->regs->eflags & SF_CF;
+
+	v = soft_alu( c, dec ? 5 : 0, v, 1, size );
+	c->regs->eflags = ( c->regs->eflags & ~SF_CF ) | cf;
+	return	v;
+}
+
+// ROL, ROR, RCL, RCR, SHL, SHR, SAL, SAR (as numbered in opcodes)
+unsigned int soft_shift( SOFT_CPU *c, int op, unsigned int v, int count,
+							int size )
+{
+	unsigned int	*fl = &c->regs->eflags, mask = soft_mask( size );
+	unsigned int	msb = 1U << ( size * 8 - 1 ), orig, out, cf;
+	int		i;
+
+	count &= 0x1F;
+	if ( count == 0 ) return v;
+	v &= mask;
+	orig = v;
+	cf = *fl & SF_CF;
+	for (i = 0; i < count; i++)
+		switch ( op )
+			{
+			case 0: cf = !!( v & msb ); v = ( ( v << 1 ) | cf ) & mask; break;
+			case 1: cf = v & 1; v = ( v >> 1 ) | ( cf ? msb : 0 ); break;
+			case 2: out = !!( v & msb );
+				v = ( ( v << 1 ) | cf ) & mask; cf = out; break;
+			case 3: out = v & 1;
+				v = ( v >> 1 ) | ( cf ? msb : 0 ); cf = out; break;
+			case 4: case 6: cf = !!( v & msb ); v = ( v << 1 ) & mask; break;
+			case 5: cf = v & 1; v >>= 1; break;
+			default: cf = v & 1; v = ( v >> 1 ) | ( v & msb ); break;
+			}
+	*fl &= ~( SF_CF | SF_OF );
+	if ( cf ) *fl |= SF_CF;
+	if (( op == 0 )||( op == 2 )||( op == 4 )||( op == 6 ))
+		{ if ( !( v & msb ) != !cf ) *fl |= SF_OF; }
+	else if (( op == 1 )||( op == 3 ))
+		{ if ( !( v & msb ) != !( v & ( msb >> 1 ) ) ) *fl |= SF_OF; }
+	else if ( op == 5 )
+		{ if ( orig & msb ) *fl |= SF_OF; }
+	if ( op >= 4 ) soft_szp( c, v, size );
+	return	v;
+}
+
+// the condition tested by Jcc, SETcc (and LOOPcc's ZF)
+int soft_cond( unsigned int f, int cc )
+{
+	int	r, lt = !( f & SF_SF ) != !( f & SF_OF );
+
+	switch ( ( cc >> 1 ) & 7 )
+		{
+		case 0: r = f & SF_OF; break;
+		case 1: r = f & SF_CF; break;
+		case 2: r = f & SF_ZF; break;
+		case 3: r = f & ( SF_CF | SF_ZF ); break;
+		case 4: r = f & SF_SF; break;
+		case 5: r = f & SF_PF; break;
+		case 6: r = lt; break;
+		default: r = ( f & SF_ZF ) || lt; break;
+		}
+	return	( cc & 1 ) ? !r : !!r;
+}
+
+// MUL, IMUL, DIV, IDIV on the accumulator (0 if #DE is raised)
+int soft_muldiv( SOFT_CPU *c, int op, unsigned int v, int size )
+{
+	regs_ia32	*r = c->regs;
+	unsigned int	mask = soft_mask( size ), bits = size * 8;
+	unsigned long long  a, q, rem;
+	long long	sa, sq, sr, sv;
+	int		over;
+
+	// the double-width accumulator: AX, DX:AX or EDX:EAX
+	if ( size == 1 ) a = r->eax & 0xFFFF;
+	else	a = ( (unsigned long long)( r->edx & mask ) << bits ) | ( r->eax & mask );
+
+	switch ( op )
+		{
+		case 4:
+		a = (unsigned long long)( r->eax & mask ) * ( v & mask );
+		over = ( a >> bits ) != 0;
+		break;
+		case 5:
+		sa = (long long)soft_sext( r->eax, size ) * soft_sext( v, size );
+		a = sa;
+		over = sa != soft_sext( sa & mask, size );
+		break;
+		case 6:
+		if ( ( v & mask ) == 0 ) return 0;
+		q = a / ( v & mask );
+		rem = a % ( v & mask );
+		if ( q > mask ) return 0;
+		a = ( rem << bits ) | q;
+		over = 0;
+		break;
+		default:
+		sv = soft_sext( v, size );
+		if ( size == 1 ) sa = (short)a;
+		else if ( size == 2 ) sa = (int)a;
+		else	sa = (long long)a;
+		if (( sv == 0 )||(( sv == -1 )&&( sa == -0x7FFFFFFFFFFFFFFFLL - 1 ))) return 0;
+		sq = sa / sv;
+		sr = sa % sv;
+		if ( sq != soft_sext( sq & mask, size ) ) return 0;
+		a = ( ( sr & mask ) << bits ) | ( sq & mask );
+		over = 0;
+		break;
+		}
+
+	if ( size == 1 ) soft_setreg( c, 0, 2, a );
+	else	{
+		soft_setreg( c, 0, size, a & mask );
+		soft_setreg( c, 2, size, ( a >> bits ) & mask );
+		}
+	if ( op < 6 )
+		{
+		r->eflags &= ~( SF_CF | SF_OF );
+		if ( over ) r->eflags |= SF_CF | SF_OF;
+		}
+	return	1;
+}
+
+// IMUL with two or three operands
+unsigned int soft_imul( SOFT_CPU *c, unsigned int a, unsigned int b, int size )
+{
+	long long	p = (long long)soft_sext( a, size ) * soft_sext( b, size );
+	unsigned int	res = p & soft_mask( size );
+
+	c->regs->eflags &= ~( SF_CF | SF_OF );
+	if ( p != soft_sext( res, size ) ) c->regs->eflags |= SF_CF | SF_OF;
+	return	res;
+}
+
+// DAA, DAS, AAA, AAS
+void soft_decimal( SOFT_CPU *c, unsigned int op )
+{
+	regs_ia32	*r = c->regs;
+	unsigned int	al = r->eax & 0xFF, cf = r->eflags & SF_CF;
+	unsigned int	af = r->eflags & SF_AF, old = al;
+
+	r->eflags &= ~( SF_CF | SF_AF );
+	switch ( op )
+		{
+		case 0x27:
+		case 0x2F:
+		if ( ( al & 0x0F ) > 9 || af )
+			{
+			al = ( op == 0x27 ) ? al + 6 : al - 6;
+			r->eflags |= SF_AF;
+			}
+		if (( old > 0x99 )||( cf ))
+			{
+			al = ( op == 0x27 ) ? al + 0x60 : al - 0x60;
+			r->eflags |= SF_CF;
+			}
+		soft_setreg( c, 0, 1, al );
+		soft_szp( c, al, 1 );
+		break;
+		default:
+		if ( ( al & 0x0F ) > 9 || af )
+			{
+			if ( op == 0x37 ) soft_setreg( c, 0, 2, ( r->eax & 0xFFFF ) + 0x106 );
+			else	soft_setreg( c, 0, 2, ( r->eax & 0xFFFF ) - 0x106 );
+			r->eflags |= SF_AF | SF_CF;
+			}
+		soft_setreg( c, 0, 1, r->eax & 0x0F );
+		break;
+		}
+}
+
+
+//----------------------------------------------------------------
+// interrupts, and far transfers of control
+//----------------------------------------------------------------
+
+// an INT n (or an interrupt we deliver) goes through the guest's
+// own interrupt-vector table; returns the new IP (CS is loaded)
+unsigned int soft_interrupt( SOFT_CPU *c, int vector, unsigned int ip )
+{
+	regs_ia32	*r = c->regs;
+
+	soft_push( c, 2, r->eflags );
+	soft_push( c, 2, r->cs );
+	soft_push( c, 2, ip );
+	r->eflags &= ~( SF_IF | SF_TF );
+	r->cs = soft_read( c, vector * 4 + 2, 2 );
+	return	soft_read( c, vector * 4, 2 );
+}
+
+void soft_popf( SOFT_CPU *c, unsigned int v, int size )
+{
+	unsigned int	mask = SF_POPF | ( ( size == 4 ) ? SF_POPFD : 0 );
+
+	c->regs->eflags = ( c->regs->eflags & ~mask ) | ( v & mask );
+}
+
+
+//----------------------------------------------------------------
+// I/O: ports whose bits are set in the I/O bitmaps make the guest
+// exit (unless one of our own devices completes the access), as
+// with VMX; other ports are accessed directly, as the guest would
+// ('ins' and 'outs' here for 'in' and 'out' of a string)
+//----------------------------------------------------------------
+int soft_io_exits( SOFT_CPU *c, unsigned int port, int size )
+{
+	int	i;
+
+	for (i = 0; i < size; i++, port++)
+		if (( port > 0xFFFF )||( c->iomap[ port >> 3 ] & ( 1 << ( port & 7 ) ) ))
+			return	1;
+	return	0;
+}
+
+// returns nonzero if the guest exits for this access instead
+int soft_io( SOFT_CPU *c, SOFT_INSN *in, unsigned int port, int size,
+			int inp, int string, unsigned int linear, unsigned int *data )
+{
+	if ( soft_io_exits( c, port, size ) )
+		{
+		if (( !string )&&( c->ioport )
+			&&( c->ioport( c->dev, port, size, inp, data ) == EXIT_RESUME ))
+			return	0;
+		c->stop = 1;
+		c->reason = 30;
+		c->qual = ( size - 1 ) | ( inp << 3 ) | ( string << 4 ) | ( port << 16 );
+		if ( in->flags & ( SI_REP | SI_REPNE ) ) c->qual |= ( 1 << 5 );
+		if (( in->op >= 0xE4 )&&( in->op <= 0xE7 )) c->qual |= ( 1 << 6 );
+		c->insn_len = in->len;
+		c->io_rcx = c->regs->ecx;
+		c->linear = linear;
+		return	1;
+		}
+
+	if ( inp ) switch ( size )
+		{
+		case 1: *data = inb( port ); break;
+		case 2: *data = inw( port ); break;
+		default: *data = inl( port ); break;
+		}
+	else switch ( size )
+		{
+		case 1: outb( *data, port ); break;
+		case 2: outw( *data, port ); break;
+		default: outl( *data, port ); break;
+		}
+	return	0;
+}
+
+// MOVS, CMPS, STOS, LODS, SCAS, INS, OUTS (with or without REP)
+void soft_string( SOFT_CPU *c, SOFT_INSN *in, unsigned int ip )
+{
+	regs_ia32	*r = c->regs;
+	unsigned int	*gpr = SOFT_GPR( c ), op = in->op;
+	unsigned int	amask = ( in->flags & SI_ADDRSIZE ) ? 0xFFFFFFFF : 0xFFFF;
+	unsigned int	count = 1, si, di, src, dst, v, w, steps = 0;
+	int		size, step, rep = in->flags & ( SI_REP | SI_REPNE );
+
+	size = ( op & 1 ) ? ( ( in->flags & SI_OPSIZE ) ? 4 : 2 ) : 1;
+	step = ( r->eflags & SF_DF ) ? -size : size;
+	if ( rep ) count = gpr[ 1 ] & amask;
+
+	while (( count > 0 )&&( !c->stop ))
+		{
+		// a long REP is restarted, as after an interrupt would be
+		if ( steps++ == SOFT_REP_MAX ) { c->next_ip = ip; break; }
+
+		si = gpr[ 6 ] & amask;
+		di = gpr[ 7 ] & amask;
+		src = soft_seg_base( c, in, 3 ) + si;
+		dst = ( ( r->es & 0xFFFF ) << 4 ) + di;
+		if (( si > 0xFFFF )||( di > 0xFFFF )) { soft_fault( c, 13 ); break; }
+		switch ( op )
+			{
+			case 0xA4: case 0xA5:
+			soft_write( c, dst, size, soft_read( c, src, size ) );
+			break;
+			case 0xA6: case 0xA7:
+			soft_alu( c, 7, soft_read( c, src, size ),
+						soft_read( c, dst, size ), size );
+			break;
+			case 0xAA: case 0xAB:
+			soft_write( c, dst, size, r->eax );
+			break;
+			case 0xAC: case 0xAD:
+			soft_setreg( c, 0, size, soft_read( c, src, size ) );
+			break;
+			case 0xAE: case 0xAF:
+			soft_alu( c, 7, r->eax, soft_read( c, dst, size ), size );
+			break;
+			case 0x6C: case 0x6D:
+			if ( soft_io( c, in, r->edx & 0xFFFF, size, 1, 1, dst, &v ) )
+				return;
+			soft_write( c, dst, size, v );
+			break;
+			default:
+			w = soft_read( c, src, size );
+			if ( soft_io( c, in, r->edx & 0xFFFF, size, 0, 1, src, &w ) )
+				return;
+			break;
+			}
+
+		// advance the index registers this form uses
+		if (( op != 0xAA )&&( op != 0xAB )&&( op != 0xAE )&&( op != 0xAF )
+			&&( op != 0x6C )&&( op != 0x6D ))
+			gpr[ 6 ] = ( gpr[ 6 ] & ~amask ) | ( ( si + step ) & amask );
+		if (( op != 0xAC )&&( op != 0xAD )&&( op != 0x6E )&&( op != 0x6F ))
+			gpr[ 7 ] = ( gpr[ 7 ] & ~amask ) | ( ( di + step ) & amask );
+		if ( !rep ) break;
+		--count;
+		gpr[ 1 ] = ( gpr[ 1 ] & ~amask ) | count;
+
+		// REPE and REPNE also stop on the comparison's outcome
+		if (( op >= 0xA6 && op <= 0xA7 )||( op >= 0xAE && op <= 0xAF ))
+			{
+			if (( in->flags & SI_REP )&&( !( r->eflags & SF_ZF ) )) break;
+			if (( in->flags & SI_REPNE )&&( r->eflags & SF_ZF )) break;
+			}
+		}
+}
+
+
+//----------------------------------------------------------------
+// Execute one (decoded) instruction.  It leaves 'c->next_ip' where
+// execution goes on (any new CS is loaded directly); a VM exit, or
+// a fault, instead stops the run with IP still at the instruction.
+// A HLT with IF=1, or a hypercall which leaves the guest waiting,
+// stops the run with 'c->idle' set and IP past the instruction.
+//----------------------------------------------------------------
+void soft_step( SOFT_CPU *c, SOFT_INSN *in )
+{
+	regs_ia32	*r = c->regs;
+	unsigned int	*gpr = SOFT_GPR( c ), *seg = SOFT_SEG( c );
+	unsigned int	ip = r->eip & 0xFFFF, op = in->op;
+	unsigned int	ea = 0, a, b, v, w, reg = ( in->modrm >> 3 ) & 7;
+	unsigned int	amask = ( in->flags & SI_ADDRSIZE ) ? 0xFFFFFFFF : 0xFFFF;
+	unsigned int	eax, ebx, ecx, edx;
+	int		osz = ( in->flags & SI_OPSIZE ) ? 4 : 2, size, i;
+
+	c->next_ip = ( ip + in->len ) & 0xFFFF;
+	if (( in->flags & SI_MEM )&&( op != 0x8D ))
+		{
+		ea = soft_ea( c, in );
+		if ( c->stop ) return;
+		}
+	size = ( op & 1 ) ? osz : 1;	// (for most byte/word pairs)
+
+	// the eight arithmetic and logical operations, in six forms each
+	if (( op < 0x40 )&&( ( op & 7 ) < 6 ))
+		{
+		int	alu = op >> 3;
+
+		switch ( op & 7 )
+			{
+			case 0: case 1:
+			v = soft_alu( c, alu, soft_rm( c, in, ea, size ),
+						soft_getreg( c, reg, size ), size );
+			if ( alu != 7 ) soft_set_rm( c, in, ea, size, v );
+			break;
+			case 2: case 3:
+			v = soft_alu( c, alu, soft_getreg( c, reg, size ),
+						soft_rm( c, in, ea, size ), size );
+			if ( alu != 7 ) soft_setreg( c, reg, size, v );
+			break;
+			default:
+			v = soft_alu( c, alu, r->eax, in->imm, size );
+			if ( alu != 7 ) soft_setreg( c, 0, size, v );
+			break;
+			}
+		return;
+		}
+
+	if (( op >= 0x40 )&&( op <= 0x4F ))		// INC, DEC reg
+		{
+		soft_setreg( c, op & 7, osz,
+			soft_incdec( c, gpr[ op & 7 ], op >= 0x48, osz ) );
+		return;
+		}
+	if (( op >= 0x50 )&&( op <= 0x57 ))		// PUSH reg
+		{
+		soft_push( c, osz, gpr[ op & 7 ] );
+		return;
+		}
+	if (( op >= 0x58 )&&( op <= 0x5F ))		// POP reg
+		{
+		v = soft_pop( c, osz );
+		soft_setreg( c, op & 7, osz, v );
+		return;
+		}
+	if (( op >= 0x70 )&&( op <= 0x7F ))		// Jcc short
+		{
+		if ( soft_cond( r->eflags, op ) )
+			c->next_ip = ( c->next_ip + (signed char)in->imm ) & 0xFFFF;
+		return;
+		}
+	if (( op >= 0x0F80 )&&( op <= 0x0F8F ))	// Jcc near
+		{
+		if ( soft_cond( r->eflags, op ) )
+			c->next_ip = ( c->next_ip + in->imm ) & 0xFFFF;
+		return;
+		}
+	if (( op >= 0x0F90 )&&( op <= 0x0F9F ))	// SETcc
+		{
+		soft_set_rm( c, in, ea, 1, soft_cond( r->eflags, op ) );
+		return;
+		}
+	if (( op >= 0x91 )&&( op <= 0x97 ))		// XCHG eAX, reg
+		{
+		v = soft_getreg( c, op & 7, osz );
+		soft_setreg( c, op & 7, osz, r->eax );
+		soft_setreg( c, 0, osz, v );
+		return;
+		}
+	if (( op >= 0xB0 )&&( op <= 0xBF ))		// MOV reg, imm
+		{
+		soft_setreg( c, op & 7, ( op < 0xB8 ) ? 1 : osz, in->imm );
+		return;
+		}
+	if ((( op >= 0xA4 )&&( op <= 0xA7 ))||(( op >= 0xAA )&&( op <= 0xAF ))
+		||(( op >= 0x6C )&&( op <= 0x6F )))
+		{
+		soft_string( c, in, ip );
+		return;
+		}
+
+	switch ( op )
+		{
+		case 0x06: case 0x0E: case 0x16: case 0x1E:	// PUSH sreg
+		soft_push( c, osz, seg[ op >> 3 ] & 0xFFFF );
+		break;
+		case 0x07: case 0x17: case 0x1F:		// POP sreg
+		seg[ op >> 3 ] = soft_pop( c, osz ) & 0xFFFF;
+		break;
+		case 0x0FA0: case 0x0FA8:
+		soft_push( c, osz, seg[ ( op == 0x0FA0 ) ? 4 : 5 ] & 0xFFFF );
+		break;
+		case 0x0FA1: case 0x0FA9:
+		seg[ ( op == 0x0FA1 ) ? 4 : 5 ] = soft_pop( c, osz ) & 0xFFFF;
+		break;
+
+		case 0x27: case 0x2F: case 0x37: case 0x3F:
+		soft_decimal( c, op );
+		break;
+
+		case 0x60:					// PUSHA
+		v = r->esp;
+		for (i = 0; i < 8; i++) soft_push( c, osz, ( i == 4 ) ? v : gpr[ i ] );
+		break;
+		case 0x61:					// POPA
+		for (i = 7; i >= 0; i--)
+			{
+			v = soft_pop( c, osz );
+			if ( i != 4 ) soft_setreg( c, i, osz, v );
+			}
+		break;
+
+		case 0x68: case 0x6A:				// PUSH imm
+		soft_push( c, osz, ( op == 0x6A ) ? soft_sext( in->imm, 1 ) : in->imm );
+		break;
+		case 0x69: case 0x6B:				// IMUL reg, r/m, imm
+		b = ( op == 0x6B ) ? soft_sext( in->imm, 1 ) : in->imm;
+		soft_setreg( c, reg, osz, soft_imul( c, soft_rm( c, in, ea, osz ), b, osz ) );
+		break;
+		case 0x0FAF:					// IMUL reg, r/m
+		soft_setreg( c, reg, osz, soft_imul( c, soft_getreg( c, reg, osz ),
+					soft_rm( c, in, ea, osz ), osz ) );
+		break;
+
+		case 0x80: case 0x81: case 0x82: case 0x83:	// group 1
+		size = ( op == 0x80 || op == 0x82 ) ? 1 : osz;
+		b = ( op == 0x83 ) ? soft_sext( in->imm, 1 ) : in->imm;
+		v = soft_alu( c, reg, soft_rm( c, in, ea, size ), b, size );
+		if ( reg != 7 ) soft_set_rm( c, in, ea, size, v );
+		break;
+
+		case 0x84: case 0x85:				// TEST r/m, reg
+		soft_alu( c, 4, soft_rm( c, in, ea, size ),
+					soft_getreg( c, reg, size ), size );
+		break;
+		case 0xA8: case 0xA9:				// TEST eAX, imm
+		soft_alu( c, 4, r->eax, in->imm, size );
+		break;
+		case 0x86: case 0x87:				// XCHG r/m, reg
+		v = soft_rm( c, in, ea, size );
+		soft_set_rm( c, in, ea, size, soft_getreg( c, reg, size ) );
+		soft_setreg( c, reg, size, v );
+		break;
+
+		case 0x88: case 0x89:				// MOV r/m, reg
+		soft_set_rm( c, in, ea, size, soft_getreg( c, reg, size ) );
+		break;
+		case 0x8A: case 0x8B:				// MOV reg, r/m
+		soft_setreg( c, reg, size, soft_rm( c, in, ea, size ) );
+		break;
+		case 0x8C:					// MOV r/m, sreg
+		if ( reg > 5 ) { soft_fault( c, 6 ); break; }
+		soft_set_rm( c, in, ea, ( in->flags & SI_MEM ) ? 2 : osz,
+							seg[ reg ] & 0xFFFF );
+		break;
+		case 0x8E:					// MOV sreg, r/m
+		if (( reg > 5 )||( reg == 1 )) { soft_fault( c, 6 ); break; }
+		seg[ reg ] = soft_rm( c, in, ea, 2 );
+		break;
+		case 0x8D:					// LEA
+		if ( !( in->flags & SI_MEM ) ) { soft_fault( c, 6 ); break; }
+		soft_setreg( c, reg, osz, soft_offset( c, in ) );
+		break;
+		case 0x8F:					// POP r/m
+		soft_set_rm( c, in, ea, osz, soft_pop( c, osz ) );
+		break;
+
+		case 0x90: case 0x9B:				// NOP, WAIT
+		break;
+		case 0x98:					// CBW, CWDE
+		soft_setreg( c, 0, osz, soft_sext( r->eax, osz / 2 ) );
+		break;
+		case 0x99:					// CWD, CDQ
+		soft_setreg( c, 2, osz, ( soft_sext( r->eax, osz ) < 0 ) ? ~0 : 0 );
+		break;
+
+		case 0x9A:					// CALL far
+		soft_push( c, osz, r->cs & 0xFFFF );
+		soft_push( c, osz, c->next_ip );
+		r->cs = in->imm2;
+		c->next_ip = in->imm & 0xFFFF;
+		break;
+		case 0xEA:					// JMP far
+		r->cs = in->imm2;
+		c->next_ip = in->imm & 0xFFFF;
+		break;
+		case 0xE8:					// CALL near
+		soft_push( c, osz, c->next_ip );
+		c->next_ip = ( c->next_ip + in->imm ) & 0xFFFF;
+		break;
+		case 0xE9:					// JMP near
+		c->next_ip = ( c->next_ip + in->imm ) & 0xFFFF;
+		break;
+		case 0xEB:					// JMP short
+		c->next_ip = ( c->next_ip + (signed char)in->imm ) & 0xFFFF;
+		break;
+		case 0xC2: case 0xC3:				// RET
+		c->next_ip = soft_pop( c, osz ) & 0xFFFF;
+		if ( op == 0xC2 ) r->esp = ( r->esp & ~0xFFFF ) | ( ( r->esp + in->imm ) & 0xFFFF );
+		break;
+		case 0xCA: case 0xCB:				// RETF
+		c->next_ip = soft_pop( c, osz ) & 0xFFFF;
+		r->cs = soft_pop( c, osz ) & 0xFFFF;
+		if ( op == 0xCA ) r->esp = ( r->esp & ~0xFFFF ) | ( ( r->esp + in->imm ) & 0xFFFF );
+		break;
+		case 0xCF:					// IRET
+		c->next_ip = soft_pop( c, osz ) & 0xFFFF;
+		r->cs = soft_pop( c, osz ) & 0xFFFF;
+		soft_popf( c, soft_pop( c, osz ), osz );
+		break;
+		case 0xCC:					// INT3
+		c->next_ip = soft_interrupt( c, 3, c->next_ip );
+		break;
+		case 0xCD:					// INT n
+		c->next_ip = soft_interrupt( c, in->imm & 0xFF, c->next_ip );
+		break;
+		case 0xCE:					// INTO
+		if ( r->eflags & SF_OF ) c->next_ip = soft_interrupt( c, 4, c->next_ip );
+		break;
+
+		case 0xE0: case 0xE1: case 0xE2:		// LOOPNE, LOOPE, LOOP
+		v = ( gpr[ 1 ] - 1 ) & amask;
+		gpr[ 1 ] = ( gpr[ 1 ] & ~amask ) | v;
+		if (( v != 0 )&&(( op == 0xE2 )||( soft_cond( r->eflags, 4 ) == ( op == 0xE1 ) )))
+			c->next_ip = ( c->next_ip + (signed char)in->imm ) & 0xFFFF;
+		break;
+		case 0xE3:					// JCXZ
+		if ( ( gpr[ 1 ] & amask ) == 0 )
+			c->next_ip = ( c->next_ip + (signed char)in->imm ) & 0xFFFF;
+		break;
+
+		case 0x9C:					// PUSHF
+		soft_push( c, osz, r->eflags & 0x00FCFFFF );
+		break;
+		case 0x9D:					// POPF
+		soft_popf( c, soft_pop( c, osz ), osz );
+		break;
+		case 0x9E:					// SAHF
+		r->eflags = ( r->eflags & ~0xD5 ) | ( ( r->eax >> 8 ) & 0xD5 );
+		break;
+		case 0x9F:					// LAHF
+		soft_setreg( c, 4, 1, ( r->eflags & 0xD5 ) | 2 );
+		break;
+
+		case 0xA0: case 0xA1:				// MOV eAX, moffs
+		soft_setreg( c, 0, size, soft_read( c, ea, size ) );
+		break;
+		case 0xA2: case 0xA3:				// MOV moffs, eAX
+		soft_write( c, ea, size, r->eax );
+		break;
+
+		case 0xC0: case 0xC1: case 0xD0: case 0xD1: case 0xD2: case 0xD3:
+		b = ( op <= 0xC1 ) ? in->imm : ( op <= 0xD1 ) ? 1 : r->ecx;
+		v = soft_shift( c, reg, soft_rm( c, in, ea, size ), b & 0xFF, size );
+		soft_set_rm( c, in, ea, size, v );
+		break;
+
+		case 0xC4: case 0xC5: case 0x0FB2: case 0x0FB4: case 0x0FB5:
+		if ( !( in->flags & SI_MEM ) ) { soft_fault( c, 6 ); break; }
+		v = soft_read( c, ea, osz );
+		w = soft_read( c, ea + osz, 2 );
+		soft_setreg( c, reg, osz, v );
+		if ( op == 0xC4 ) r->es = w;
+		else if ( op == 0xC5 ) r->ds = w;
+		else if ( op == 0x0FB2 ) r->ss = w;
+		else if ( op == 0x0FB4 ) r->fs = w;
+		else	r->gs = w;
+		break;
+
+		case 0xC6: case 0xC7:				// MOV r/m, imm
+		soft_set_rm( c, in, ea, size, in->imm );
+		break;
+
+		case 0xC8:					// ENTER
+		soft_push( c, osz, r->ebp );
+		v = r->esp & 0xFFFF;
+		for (i = 1; i < ( in->imm2 & 0x1F ); i++)
+			{
+			r->ebp = ( r->ebp & ~0xFFFF ) | ( ( r->ebp - osz ) & 0xFFFF );
+			soft_push( c, osz, soft_read( c,
+				( ( r->ss & 0xFFFF ) << 4 ) + ( r->ebp & 0xFFFF ), osz ) );
+			}
+		if ( in->imm2 & 0x1F ) soft_push( c, osz, v );
+		soft_setreg( c, 5, osz, v );
+		r->esp = ( r->esp & ~0xFFFF ) | ( ( r->esp - in->imm ) & 0xFFFF );
+		break;
+		case 0xC9:					// LEAVE
+		r->esp = ( r->esp & ~0xFFFF ) | ( r->ebp & 0xFFFF );
+		soft_setreg( c, 5, osz, soft_pop( c, osz ) );
+		break;
+
+		case 0xD4:					// AAM
+		if ( ( in->imm & 0xFF ) == 0 ) { soft_fault( c, 0 ); break; }
+		v = r->eax & 0xFF;
+		soft_setreg( c, 0, 2, ( ( v / in->imm ) << 8 ) | ( v % in->imm ) );
+		soft_szp( c, r->eax, 1 );
+		break;
+		case 0xD5:					// AAD
+		v = ( ( r->eax & 0xFF ) + ( ( r->eax >> 8 ) & 0xFF ) * in->imm ) & 0xFF;
+		soft_setreg( c, 0, 2, v );
+		soft_szp( c, v, 1 );
+		break;
+		case 0xD6:					// SALC
+		soft_setreg( c, 0, 1, ( r->eflags & SF_CF ) ? 0xFF : 0 );
+		break;
+		case 0xD7:					// XLAT
+		v = ( r->ebx + ( r->eax & 0xFF ) ) & amask;
+		soft_setreg( c, 0, 1, soft_read( c, soft_seg_base( c, in, 3 ) + v, 1 ) );
+		break;
+
+		case 0xE4: case 0xE5: case 0xEC: case 0xED:	// IN
+		a = ( op <= 0xE5 ) ? in->imm & 0xFF : r->edx & 0xFFFF;
+		if ( soft_io( c, in, a, size, 1, 0, 0, &v ) ) break;
+		soft_setreg( c, 0, size, v );
+		break;
+		case 0xE6: case 0xE7: case 0xEE: case 0xEF:	// OUT
+		a = ( op <= 0xE7 ) ? in->imm & 0xFF : r->edx & 0xFFFF;
+		v = r->eax & soft_mask( size );
+		soft_io( c, in, a, size, 0, 0, 0, &v );
+		break;
+
+		case 0xF4:					// HLT
+		c->stop = 1;
+		c->reason = 12;
+		c->insn_len = in->len;
+		if ( r->eflags & SF_IF )
+			{ c->idle = EXIT_IDLE; r->eip = c->next_ip; }
+		break;
+		case 0x0F01:					// VMCALL
+		if ( in->modrm != 0xC1 ) { soft_fault( c, 13 ); break; }
+		i = ( c->hypercall ) ? c->hypercall( c->dev, in->len ) 
+							: EXIT_FORWARD;
+		if ( i != EXIT_FORWARD )
+			{
+			// (our caller's handler has stepped past the VMCALL)
+			c->next_ip = r->eip & 0xFFFF;
+			if ( i == EXIT_RESUME ) break;
+			c->idle = i;
+			}
+		c->stop = 1;
+		c->reason = 18;
+		c->insn_len = in->len;
+		break;
+
+		case 0xF5: r->eflags ^= SF_CF; break;		// CMC
+		case 0xF8: r->eflags &= ~SF_CF; break;		// CLC
+		case 0xF9: r->eflags |= SF_CF; break;		// STC
+		case 0xFA: r->eflags &= ~SF_IF; break;		// CLI
+		case 0xFB: r->eflags |= SF_IF; break;		// STI
+		case 0xFC: r->eflags &= ~SF_DF; break;		// CLD
+		case 0xFD: r->eflags |= SF_DF; break;		// STD
+
+		case 0xF6: case 0xF7:				// group 3
+		v = soft_rm( c, in, ea, size );
+		if ( reg < 2 ) soft_alu( c, 4, v, in->imm, size );
+		else if ( reg == 2 ) soft_set_rm( c, in, ea, size, ~v );
+		else if ( reg == 3 ) soft_set_rm( c, in, ea, size, soft_alu( c, 5, 0, v, size ) );
+		else if ( !soft_muldiv( c, reg, v, size ) ) soft_fault( c, 0 );
+		break;
+
+		case 0xFE: case 0xFF:				// groups 4 and 5
+		if (( op == 0xFE )&&( reg > 1 )) { soft_fault( c, 6 ); break; }
+		switch ( reg )
+			{
+			case 0: case 1:
+			soft_set_rm( c, in, ea, size,
+				soft_incdec( c, soft_rm( c, in, ea, size ), reg, size ) );
+			break;
+			case 2:
+			v = soft_rm( c, in, ea, osz );
+			soft_push( c, osz, c->next_ip );
+			c->next_ip = v & 0xFFFF;
+			break;
+			case 4:
+			c->next_ip = soft_rm( c, in, ea, osz ) & 0xFFFF;
+			break;
+			case 3: case 5:
+			if ( !( in->flags & SI_MEM ) ) { soft_fault( c, 6 ); break; }
+			v = soft_read( c, ea, osz );
+			w = soft_read( c, ea + osz, 2 );
+			if ( reg == 3 )
+				{
+				soft_push( c, osz, r->cs & 0xFFFF );
+				soft_push( c, osz, c->next_ip );
+				}
+			r->cs = w;
+			c->next_ip = v & 0xFFFF;
+			break;
+			case 6:
+			soft_push( c, osz, soft_rm( c, in, ea, osz ) );
+			break;
+			default:
+			soft_fault( c, 6 );
+			break;
+			}
+		break;
+
+		case 0x0FB6: case 0x0FB7:			// MOVZX
+		soft_setreg( c, reg, osz, soft_rm( c, in, ea, ( op & 1 ) ? 2 : 1 ) );
+		break;
+		case 0x0FBE: case 0x0FBF:			// MOVSX
+		size = ( op & 1 ) ? 2 : 1;
+		soft_setreg( c, reg, osz, soft_sext( soft_rm( c, in, ea, size ), size ) );
+		break;
+
+		case 0x0FA3: case 0x0FAB: case 0x0FB3: case 0x0FBB: case 0x0FBA:
+		if ( op == 0x0FBA )
+			{
+			if ( reg < 4 ) { soft_fault( c, 6 ); break; }
+			b = in->imm & ( osz * 8 - 1 );
+			a = reg & 3;
+			}
+		else	{
+			// a register's bit-offset may reach beyond the operand
+			b = soft_getreg( c, reg, osz );
+			if ( in->flags & SI_MEM )
+				ea += ( soft_sext( b, osz ) >> ( osz == 4 ? 5 : 4 ) ) * osz;
+			b &= osz * 8 - 1;
+			a = ( op >> 3 ) & 3;
+			}
+		v = soft_rm( c, in, ea, osz );
+		r->eflags &= ~SF_CF;
+		if ( ( v >> b ) & 1 ) r->eflags |= SF_CF;
+		if ( a == 1 ) soft_set_rm( c, in, ea, osz, v | ( 1U << b ) );
+		if ( a == 2 ) soft_set_rm( c, in, ea, osz, v & ~( 1U << b ) );
+		if ( a == 3 ) soft_set_rm( c, in, ea, osz, v ^ ( 1U << b ) );
+		break;
+		case 0x0FBC: case 0x0FBD:			// BSF, BSR
+		v = soft_rm( c, in, ea, osz );
+		r->eflags |= SF_ZF;
+		if ( v == 0 ) break;
+		r->eflags &= ~SF_ZF;
+		for (i = 0; !( ( v >> i ) & 1 ); i++);
+		if ( op == 0x0FBD ) for (i = osz * 8 - 1; !( ( v >> i ) & 1 ); i--);
+		soft_setreg( c, reg, osz, i );
+		break;
+
+		case 0x0F31:					// RDTSC
+		asm volatile( " rdtsc " : "=a" (eax), "=d" (edx) );
+		r->eax = eax;
+		r->edx = edx;
+		break;
+		case 0x0FA2:					// CPUID
+		eax = r->eax;
+		ecx = r->ecx;
+		asm volatile( " cpuid " : "+a" (eax), "=b" (ebx), "+c" (ecx), "=d" (edx) );
+		if ( r->eax == 1 ) ecx &= ~(1<<5);	// (no VMX for this guest)
+		r->eax = eax;
+		r->ebx = ebx;
+		r->ecx = ecx;
+		r->edx = edx;
+		break;
+
+		case 0x0F06: case 0x0F08: case 0x0F09: case 0x0F20: case 0x0F22:
+		case 0x0F30: case 0x0F32:
+		soft_fault( c, 13 );		// (privileged, as in VM86)
+		break;
+
+		default:
+		soft_fault( c, 6 );		// (an opcode we don't implement)
+		break;
+		}
+}
+
+//----------------------------------------------------------------
+// Run the guest for about 'count' instructions, a block at a time
+// (an interrupt is taken between blocks), or until it exits
+//----------------------------------------------------------------
+void soft_exec( SOFT_CPU *c, unsigned long count )
+{
+	regs_ia32	*r = c->regs;
+	SOFT_BLOCK	*b;
+	int		i, vector;
+
+	while (( count > 0 )&&( !c->stop ))
+		{
+		if ( c->irq )
+			{
+			vector = c->irq( c->dev, ( r->eflags & SF_IF ) != 0 );
+			if ( vector >= 0 )
+				r->eip = soft_interrupt( c, vector, r->eip & 0xFFFF );
+			}
+
+		b = soft_block( c, r->cs, r->eip );
+		c->branch = 0;
+		for (i = 0; ( i < b->count )&&( !c->branch ); i++)
+			{
+			soft_step( c, &b->insn[ i ] );
+			if ( c->stop ) break;
+			r->eip = c->next_ip;
+			if ( b->insn[ i ].flags & SI_END ) { ++i; break; }
+			}
+		c->cache->insns += i;
+		count = ( count > i ) ? count - i : 0;
+		}
+}
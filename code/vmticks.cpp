@@ -0,0 +1,77 @@
+//-------------------------------------------------------------------
+//	vmticks.cpp
+//
+//	This application gives a guest the virtual timer and PIC of
+//	our 'newvmm64.c' Linux Kernel Module (see VMM_VTIMER), and
+//	then lets it spin, with interrupts enabled, for the length of
+//	a budget (see VMM_BUDGET).  The ROM-BIOS timer-tick handler
+//	runs in the guest for each IRQ0, so the tick-counter at 0x46C
+//	should advance at the rate we asked for, no matter how many
+//	(or how few) of the host's interrupts made the guest exit.
+//
+//		usage:  $ ./vmticks [hz] [milliseconds]
+//
+//	written on: 17 OCT 2026
+//-------------------------------------------------------------------
+
+#include <stdio.h>		// for printf(), perror()
+#include <fcntl.h>		// for open()
+#include <stdlib.h>		// for exit(), atoi()
+#include <errno.h>		// for errno, ETIMEDOUT
+#include <sys/mman.h>		// for mmap()
+#include <sys/ioctl.h>		// for ioctl()
+#include "myvmx.h"		// for 'vtimer_ia32'
+
+regs_ia32	vm;
+vtimer_ia32	vt;
+budget_ia32	budget;
+
+int main( int argc, char **argv )
+{
+	int	hz = ( argc > 1 ) ? atoi( argv[1] ) : 18;
+	int	ms = ( argc > 2 ) ? atoi( argv[2] ) : 1000;
+
+	int	fd = open( "/dev/vmm", O_RDWR );
+	if ( fd < 0 ) { perror( "/dev/vmm" ); exit(1); }
+
+	int	size = 0x110000;
+	int	prot = PROT_READ | PROT_WRITE | PROT_EXEC;
+	int	flag = MAP_FIXED | MAP_SHARED;
+	if ( mmap( NULL, size, prot, flag, fd, 0 ) == MAP_FAILED )
+		{ perror( "mmap" ); exit(1); }
+
+	// our guest spins at 0000:8000 (with IF=1) until stopped
+	unsigned char	*code = (unsigned char*)0x8000;
+	code[ 0 ] = 0xEB;	// 'jmp $' instruction
+	code[ 1 ] = 0xFE;
+
+	vt.hz = hz;
+	if ( ioctl( fd, VMM_VTIMER, &vt ) < 0 )
+		{ perror( "VMM_VTIMER" ); exit(1); }
+	budget.microseconds = ms * 1000;
+	if ( ioctl( fd, VMM_BUDGET, &budget ) < 0 )
+		{ perror( "VMM_BUDGET" ); exit(1); }
+
+	vm.eflags = 0x23200;	// VM=1, IOPL=3, IF=1
+	vm.eip = 0x8000;
+	vm.esp = 0x7FF0;
+
+	unsigned int	*tickcount = (unsigned int*)0x0000046C;
+	unsigned int	ttc_before = *tickcount;
+	int	retval = ioctl( fd, sizeof( vm ), &vm );
+	unsigned int	ttc_after = *tickcount;
+	if (( retval < 0 )&&( errno != ETIMEDOUT ))
+		{ perror( "ioctl" ); exit(1); }
+
+	// a rate of zero just fetches the statistics (and stops the timer)
+	vt.hz = 0;
+	ioctl( fd, VMM_VTIMER, &vt );
+
+	printf( "\n guest ran %d ms, with IRQ0 at %d Hz ", ms, hz );
+	printf( "(8254 count %u) \n", vt.reload );
+	printf( "\n\t Timer-Tick Counter (before): %d ", ttc_before );
+	printf( "\n\t Timer-Tick Counter (after):  %d ", ttc_after );
+	printf( "\n\t ticks taken: %llu, ticks merged: %llu ",
+						vt.ticks, vt.merged );
+	printf( "\n\t guest stopped at %04X:%04X \n\n", vm.cs, vm.eip );
+}
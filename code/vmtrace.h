@@ -0,0 +1,151 @@
+//----------------------------------------------------------------
+//	vmtrace.h
+//
+//	Per-cpu trace-rings which record our guest's VM exits (see
+//	'trace_ia32' in 'myvmx.h'), for those modules that formerly
+//	used printk() to show each exit.  Each ring has just one
+//	writer (whichever of our ioctls is running on its cpu), and
+//	is read from userspace, by way of mmap(), without any calls
+//	into our driver.  Include this after 'myvmx.h'.
+//
+//	date begun: 17 OCT 2026
+//----------------------------------------------------------------
+
+#define VMTRACE_ORDER	4	// 2^4 pages, for VMM_TRACE_LENGTH
+#define VMTRACE_SLOTS	( ( VMM_TRACE_LENGTH - PAGE_SIZE ) / sizeof( trace_ia32 ) )
+
+trace_ring_ia32	*vmtrace_ring[ NR_CPUS ];
+
+// our own copies of each ring's header-fields (which the ring's
+// mmap'ed page only shows): a reader may write 'tail' there, and
+// 'tail' is the only one of those fields we ever read back
+unsigned long long	vmtrace_head[ NR_CPUS ];
+unsigned long long	vmtrace_dropped[ NR_CPUS ];
+int			vmtrace_mode[ NR_CPUS ];
+
+
+void vmtrace_free( void )
+{
+	int	cpu;
+
+	for_each_possible_cpu( cpu )
+		if ( vmtrace_ring[ cpu ] )
+			{
+			free_pages( (unsigned long)vmtrace_ring[ cpu ],
+							VMTRACE_ORDER );
+			vmtrace_ring[ cpu ] = NULL;
+			}
+}
+
+int vmtrace_alloc( void )
+{
+	int	cpu;
+
+	for_each_possible_cpu( cpu )
+		{
+		vmtrace_ring[ cpu ] = (trace_ring_ia32*)__get_free_pages(
+				GFP_KERNEL | __GFP_ZERO, VMTRACE_ORDER );
+		if ( !vmtrace_ring[ cpu ] ) { vmtrace_free(); return -ENOMEM; }
+		vmtrace_ring[ cpu ]->size = VMTRACE_SLOTS;
+		vmtrace_ring[ cpu ]->mode = VMM_TRACE_OVERWRITE;
+		vmtrace_head[ cpu ] = vmtrace_dropped[ cpu ] = 0;
+		vmtrace_mode[ cpu ] = VMM_TRACE_OVERWRITE;
+		}
+	return	0;
+}
+
+//----------------------------------------------------------------
+// Append a record to this cpu's ring; interrupts are disabled so
+// that no other writer (nor 'vmtrace_reset') can interleave here
+//----------------------------------------------------------------
+void vmtrace_exit( unsigned int reason, unsigned long long qualification,
+		unsigned int interrupt_info, unsigned short cs,
+		unsigned int ip, unsigned int error )
+{
+	trace_ring_ia32		*ring;
+	trace_ia32		*rec;
+	unsigned long long	head, tail;
+	unsigned long		flags;
+	unsigned int		lo, hi;
+	int			cpu;
+
+	local_irq_save( flags );
+	cpu = smp_processor_id();
+	ring = vmtrace_ring[ cpu ];
+	head = vmtrace_head[ cpu ];
+	tail = *(volatile unsigned long long*)&ring->tail;
+	if ( head - tail >= VMTRACE_SLOTS )
+		{
+		ring->dropped = ++vmtrace_dropped[ cpu ];
+		if ( vmtrace_mode[ cpu ] == VMM_TRACE_STOP )
+			{
+			local_irq_restore( flags );
+			return;
+			}
+		}
+
+	asm volatile( " rdtsc " : "=a" (lo), "=d" (hi) );
+	rec = (trace_ia32*)( (char*)ring + PAGE_SIZE ) + head % VMTRACE_SLOTS;
+	rec->tsc = ( (unsigned long long)hi << 32 ) | lo;
+	rec->qualification = qualification;
+	rec->reason = reason;
+	rec->interrupt_info = interrupt_info;
+	rec->ip = ip;
+	rec->cs = cs;
+	rec->error = error;
+
+	// the record is complete before a reader can see it
+	smp_wmb();
+	ring->head = vmtrace_head[ cpu ] = head + 1;
+	local_irq_restore( flags );
+}
+
+// runs on every cpu, to empty its ring
+void vmtrace_reset( void *info )
+{
+	int			cpu = smp_processor_id();
+	trace_ring_ia32		*ring = vmtrace_ring[ cpu ];
+
+	vmtrace_head[ cpu ] = vmtrace_dropped[ cpu ] = 0;
+	vmtrace_mode[ cpu ] = *(int*)info;
+	ring->head = ring->tail = ring->dropped = 0;
+	ring->size = VMTRACE_SLOTS;
+	ring->mode = vmtrace_mode[ cpu ];
+}
+
+int vmtrace_control( unsigned long buf )
+{
+	int	mode;
+
+	if ( copy_from_user( &mode, (void*)buf, sizeof( mode ) ) )
+		return -EFAULT;
+	if (( mode != VMM_TRACE_OVERWRITE )&&( mode != VMM_TRACE_STOP ))
+		return -EINVAL;
+
+	get_cpu();
+	vmtrace_reset( &mode );
+	smp_call_function( vmtrace_reset, &mode, 1, 1 );
+	put_cpu();
+	return	0;
+}
+
+// map a cpu's ring (when mmap is called at VMM_TRACE_MMAP(cpu))
+int vmtrace_mmap( struct vm_area_struct *vma )
+{
+	unsigned long	offset = vma->vm_pgoff << PAGE_SHIFT;
+	unsigned long	cpu, pfn;
+
+	if ( offset < VMM_TRACE_MMAP( 0 ) ) return -EINVAL;
+	if ( ( offset - VMM_TRACE_MMAP( 0 ) ) % VMM_TRACE_LENGTH ) return -EINVAL;
+	if ( vma->vm_end - vma->vm_start != VMM_TRACE_LENGTH ) return -EINVAL;
+
+	cpu = ( offset - VMM_TRACE_MMAP( 0 ) ) / VMM_TRACE_LENGTH;
+	if (( cpu >= NR_CPUS )||( !vmtrace_ring[ cpu ] )) return -EINVAL;
+
+	vma->vm_flags |= VM_RESERVED;
+	pfn = virt_to_phys( vmtrace_ring[ cpu ] ) >> PAGE_SHIFT;
+	if ( remap_pfn_range( vma, vma->vm_start, pfn, VMM_TRACE_LENGTH,
+						vma->vm_page_prot ) )
+		return -EAGAIN;
+	return	0;
+}
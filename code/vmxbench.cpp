@@ -0,0 +1,82 @@
+//-------------------------------------------------------------------
+//	vmxbench.cpp
+//
+//	This application uses the VMM_BENCH service of our 'newvmm64.c'
+//	Linux Kernel Module to time each of the VMX primitives on every
+//	online cpu, showing the minimum, median and 99th-percentile of
+//	the TSC cycles they took.  Our guest sits at a CPUID, which
+//	always causes a VM exit, so that each VMLAUNCH or VMRESUME makes
+//	exactly one round trip.
+//
+//		usage:  $ ./vmxbench [samples]
+//
+//	written on: 17 OCT 2026
+//-------------------------------------------------------------------
+
+#include <stdio.h>		// for printf(), perror()
+#include <fcntl.h>		// for open()
+#include <stdlib.h>		// for exit(), atoi()
+#include <unistd.h>		// for sysconf()
+#include <sys/mman.h>		// for mmap()
+#include <sys/ioctl.h>		// for ioctl()
+#include "myvmx.h"		// for 'bench_ia32'
+
+const char *primitive[] = {	"RDTSC (overhead)",
+				"VMREAD",
+				"VMWRITE",
+				"VMCLEAR",
+				"VMPTRLD",
+				"VMLAUNCH + exit",
+				"VMRESUME + exit",
+				"VMXOFF",
+				"VMXON"		};
+
+bench_ia32	bench;
+
+int main( int argc, char **argv )
+{
+	int	samples = ( argc > 1 ) ? atoi( argv[1] ) : 1000;
+
+	int	fd = open( "/dev/vmm", O_RDWR );
+	if ( fd < 0 ) { perror( "/dev/vmm" ); exit(1); }
+
+	int	size = 0x110000;
+	int	prot = PROT_READ | PROT_WRITE | PROT_EXEC;
+	int	flag = MAP_FIXED | MAP_SHARED;
+	if ( mmap( NULL, size, prot, flag, fd, 0 ) == MAP_FAILED )
+		{ perror( "mmap" ); exit(1); }
+
+	// our guest sits at a CPUID-instruction (at 0000:8000)
+	unsigned int	*eoi = (unsigned int*)0x8000;
+	eoi[ 0 ] = 0x9090A20F;	// CPUID-instruction, NOP, NOP
+
+	int	ncpus = sysconf( _SC_NPROCESSORS_ONLN );
+	for (int cpu = 0; cpu < ncpus; cpu++)
+		{
+		if ( ioctl( fd, VMM_PIN, &cpu ) < 0 )
+			{ perror( "VMM_PIN" ); continue; }
+
+		bench.regs.eflags = 0x23002;	// VM=1, IOPL=3
+		bench.regs.eip = 0x8000;
+		bench.regs.esp = 0x7FF0;
+		bench.samples = samples;
+		if ( ioctl( fd, VMM_BENCH, &bench ) < 0 )
+			{ perror( "VMM_BENCH" ); exit(1); }
+
+		printf( "\n cpu %d: %d samples ", bench.cpu, samples );
+		printf( "(round trips exit with reason %d) \n\n",
+							bench.reason );
+		printf( "   %-18s %10s %10s %10s \n",
+				"primitive", "min", "median", "p99" );
+		for (int i = 0; i < VMM_BENCH_OPS; i++)
+			{
+			printf( "   %-18s ", primitive[ i ] );
+			if ( bench.op[ i ].count == 0 )
+				{ printf( "   (skipped: other VMs active) \n" );
+				continue; }
+			printf( "%10llu %10llu %10llu \n", bench.op[ i ].min,
+				bench.op[ i ].median, bench.op[ i ].p99 );
+			}
+		}
+	printf( "\n" );
+}